@@ -1,346 +1,6295 @@
-// cpu_monitor.c
-// Compile: gcc cpu_monitor.c -o cpu_monitor -lncurses
-// Run: sudo ./cpu_monitor   (log file location may require permissions)
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <string.h>
-#include <ncurses.h>
-#include <time.h>
-#include <sys/time.h>
-#include <signal.h>
-#include <errno.h>
-#include <arpa/inet.h>
-#include <sys/stat.h>
-
-#define DELAY_US 500000            // 0.5 seconds between samples
-#define ALERT_THRESHOLD 80.0       // CPU % above which an alert is triggered
-#define LOG_FILE "cpu_monitor.log"
-#define LOG_MAX_BYTES (1024 * 1024) // rotate when log > 1MB
-#define SEND_ALERTS 1              // 1 to enable UDP alert forwarding, 0 to disable
-#define SERVER_IP "127.0.0.1"      // Alert server (set to your monitoring server)
-#define SERVER_PORT 9999           // Alert server port
-
-static volatile int keep_running = 1;
-static FILE *logf = NULL;
-static int udp_sock = -1;
-static struct sockaddr_in server_addr;
-
-// forward declarations
-void handle_signal(int sig);
-void open_log();
-void close_log();
-void rotate_log_if_needed();
-void write_log(const char *fmt, ...);
-int get_cpu_cores();
-void get_cpu_times(unsigned long long *idle, unsigned long long *total, int *ok);
-double calculate_cpu_usage(unsigned long long prev_idle, unsigned long long prev_total, unsigned long long idle, unsigned long long total, int ok);
-void get_system_info(double *loadavg1, double *loadavg5, double *loadavg15, double *uptime, int *ok);
-void send_udp_alert(const char *message);
-const char* timestamp_now();
-
-void handle_signal(int sig) {
-    keep_running = 0;
-}
-
-void open_log() {
-    if (!logf) {
-        logf = fopen(LOG_FILE, "a");
-        if (!logf) {
-            // fallback to stderr but continue running
-            fprintf(stderr, "Warning: could not open log file '%s': %s\n", LOG_FILE, strerror(errno));
-        } else {
-            setvbuf(logf, NULL, _IOLBF, 0); // line buffered
-        }
-    }
-}
-
-void close_log() {
-    if (logf) {
-        fclose(logf);
-        logf = NULL;
-    }
-}
-
-void rotate_log_if_needed() {
-    if (!logf) return;
-    // Get file size
-    long size = 0;
-    struct stat st;
-    if (stat(LOG_FILE, &st) == 0) {
-        size = st.st_size;
-    } else {
-        return;
-    }
-    if (size < LOG_MAX_BYTES) return;
-
-    // Close, rename, and reopen
-    fclose(logf);
-    logf = NULL;
-
-    // create rotated filename with timestamp
-    char rotated[512];
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    snprintf(rotated, sizeof(rotated), "%s.%04d%02d%02d_%02d%02d%02d",
-             LOG_FILE,
-             tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-    if (rename(LOG_FILE, rotated) != 0) {
-        // rename may fail; try unlinking and continue
-        fprintf(stderr, "Warning: could not rotate log file: %s\n", strerror(errno));
-    }
-    // reopen a fresh log
-    open_log();
-    if (logf) {
-        fprintf(logf, "%s Log rotated: previous file moved to %s\n", timestamp_now(), rotated);
-    }
-}
-
-void write_log(const char *fmt, ...) {
-    open_log();
-    rotate_log_if_needed();
-    if (!logf) return;
-    va_list ap;
-    va_start(ap, fmt);
-    fprintf(logf, "%s ", timestamp_now());
-    vfprintf(logf, fmt, ap);
-    fprintf(logf, "\n");
-    va_end(ap);
-    fflush(logf);
-}
-
-int get_cpu_cores() {
-    FILE *fp = fopen("/proc/cpuinfo", "r");
-    if (!fp) return 1;
-    int cores = 0;
-    char line[256];
-    while (fgets(line, sizeof(line), fp)) {
-        if (strncmp(line, "processor", 9) == 0) cores++;
-    }
-    fclose(fp);
-    return (cores > 0) ? cores : 1;
-}
-
-/*
- * Reads /proc/stat and extracts CPU times. If it fails, sets ok=0.
- */
-void get_cpu_times(unsigned long long *idle, unsigned long long *total, int *ok) {
-    *ok = 0;
-    FILE *fp = fopen("/proc/stat", "r");
-    if (!fp) {
-        write_log("Warning: Failed to open /proc/stat: %s", strerror(errno));
-        return;
-    }
-    char line[512];
-    if (!fgets(line, sizeof(line), fp)) {
-        write_log("Warning: Failed to read /proc/stat");
-        fclose(fp);
-        return;
-    }
-    fclose(fp);
-
-    unsigned long long user=0, nice=0, system=0, idle_time=0, iowait=0, irq=0, softirq=0, steal=0;
-    // Some kernels may not provide all fields; use sscanf return count to be safe
-    int cnt = sscanf(line, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
-                     &user, &nice, &system, &idle_time, &iowait, &irq, &softirq, &steal);
-    if (cnt < 4) {
-        write_log("Warning: Unexpected /proc/stat format");
-        return;
-    }
-    *idle = idle_time + iowait;
-    *total = user + nice + system + idle_time + iowait + irq + softirq + steal;
-    *ok = 1;
-}
-
-/*
- * Returns CPU usage percent. If ok==0 (cannot compute), returns 0.0.
- * Handles first iteration where prev_total == 0.
- */
-double calculate_cpu_usage(unsigned long long prev_idle, unsigned long long prev_total, unsigned long long idle, unsigned long long total, int ok) {
-    if (!ok) return 0.0;
-    if (total <= prev_total || prev_total == 0) {
-        // can't compute meaningful delta yet
-        return 0.0;
-    }
-    unsigned long long idle_diff = idle - prev_idle;
-    unsigned long long total_diff = total - prev_total;
-    if (total_diff == 0) return 0.0;
-    double usage = 100.0 * (1.0 - ((double)idle_diff / (double)total_diff));
-    if (usage < 0.0) usage = 0.0;
-    if (usage > 100.0) usage = 100.0;
-    return usage;
-}
-
-void get_system_info(double *loadavg1, double *loadavg5, double *loadavg15, double *uptime, int *ok) {
-    *ok = 0;
-    FILE *fp = fopen("/proc/loadavg", "r");
-    if (!fp) {
-        write_log("Warning: Failed to open /proc/loadavg: %s", strerror(errno));
-    } else {
-        if (fscanf(fp, "%lf %lf %lf", loadavg1, loadavg5, loadavg15) < 1) {
-            write_log("Warning: /proc/loadavg unexpected format");
-        }
-        fclose(fp);
-    }
-    fp = fopen("/proc/uptime", "r");
-    if (!fp) {
-        write_log("Warning: Failed to open /proc/uptime: %s", strerror(errno));
-        return;
-    }
-    if (fscanf(fp, "%lf", uptime) != 1) {
-        write_log("Warning: /proc/uptime unexpected format");
-        fclose(fp);
-        return;
-    }
-    fclose(fp);
-    *ok = 1;
-}
-
-void send_udp_alert(const char *message) {
-#if SEND_ALERTS
-    if (udp_sock < 0) return;
-    size_t len = strlen(message);
-    ssize_t sent = sendto(udp_sock, message, len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
-    if (sent < 0) {
-        write_log("Warning: UDP send failed: %s", strerror(errno));
-    } else {
-        write_log("Sent UDP alert (%zd bytes): %s", (ssize_t)sent, message);
-    }
-#endif
-}
-
-const char* timestamp_now() {
-    static char buf[64];
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    struct tm *tm = localtime(&tv.tv_sec);
-    snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03ld",
-             tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
-             tm->tm_hour, tm->tm_min, tm->tm_sec, tv.tv_usec/1000);
-    return buf;
-}
-
-int main() {
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
-
-    // Prepare UDP socket if enabled
-#if SEND_ALERTS
-    udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_sock < 0) {
-        fprintf(stderr, "Warning: could not create UDP socket: %s\n", strerror(errno));
-        // continue without network alerts
-        udp_sock = -1;
-    } else {
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(SERVER_PORT);
-        if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
-            fprintf(stderr, "Warning: invalid SERVER_IP '%s'\n", SERVER_IP);
-            close(udp_sock);
-            udp_sock = -1;
-        }
-    }
-#endif
-
-    open_log();
-    write_log("Starting CPU monitor");
-
-    int cpu_cores = get_cpu_cores();
-
-    // ncurses init
-    initscr();
-    noecho();
-    cbreak();
-    timeout(0); // non-blocking getch
-    curs_set(FALSE);
-
-    unsigned long long prev_idle = 0ULL, prev_total = 0ULL;
-    unsigned long long idle = 0ULL, total = 0ULL;
-    double cpu_usage = 0.0;
-    double max_usage = 0.0, min_usage = 100.0;
-    double loadavg1 = 0.0, loadavg5 = 0.0, loadavg15 = 0.0, uptime = 0.0;
-    int ok_times = 0, ok_sys = 0;
-    int cycle = 0;
-
-    while (keep_running) {
-        get_cpu_times(&idle, &total, &ok_times);
-        double usage = calculate_cpu_usage(prev_idle, prev_total, idle, total, ok_times);
-
-        // update previous for next cycle (always update to current if ok)
-        if (ok_times) {
-            prev_idle = idle;
-            prev_total = total;
-        }
-
-        // compute system info
-        get_system_info(&loadavg1, &loadavg5, &loadavg15, &uptime, &ok_sys);
-
-        // on first cycle usage may be 0; we keep showing it
-        cpu_usage = usage;
-        if (cpu_usage > max_usage) max_usage = cpu_usage;
-        if (cpu_usage < min_usage) min_usage = cpu_usage;
-
-        // write to log every cycle (or you can throttle)
-        write_log("CPU: %.2f%% | Max: %.2f | Min: %.2f | Loadavg: %.2f/%.2f/%.2f | Uptime: %.2f s",
-                  cpu_usage, max_usage, min_usage, loadavg1, loadavg5, loadavg15, uptime);
-
-        // render ncurses UI
-        clear();
-        mvprintw(0, 0, "Real-Time CPU Usage Monitor (PID %d)", getpid());
-        mvprintw(1, 0, "Current CPU Usage: %.2f%%", cpu_usage);
-        mvprintw(2, 0, "Max CPU Usage Observed: %.2f%%", max_usage);
-        mvprintw(3, 0, "Min CPU Usage Observed: %.2f%%", min_usage);
-        mvprintw(5, 0, "Load Averages (1/5/15 min): %.2f / %.2f / %.2f", loadavg1, loadavg5, loadavg15);
-        mvprintw(6, 0, "System Uptime: %.2f seconds", uptime);
-        mvprintw(7, 0, "Number of CPU Cores: %d", cpu_cores);
-
-        int usage_bar_width = 40;
-        int usage_fill = (int)((cpu_usage / 100.0) * usage_bar_width);
-        if (usage_fill < 0) usage_fill = 0;
-        if (usage_fill > usage_bar_width) usage_fill = usage_bar_width;
-
-        mvprintw(9, 0, "[");
-        for (int i = 0; i < usage_fill; ++i) mvprintw(9, i + 1, "#");
-        for (int i = usage_fill; i < usage_bar_width; ++i) mvprintw(9, i + 1, "-");
-        mvprintw(9, usage_bar_width + 1, "]");
-
-        // alerting logic
-        if (cpu_usage >= ALERT_THRESHOLD) {
-            attron(A_BOLD);
-            mvprintw(11, 0, "ALERT: CPU Usage Above %.1f%%", ALERT_THRESHOLD);
-            attroff(A_BOLD);
-            // send UDP alert (non-blocking)
-            char alert_msg[512];
-            snprintf(alert_msg, sizeof(alert_msg), "%s ALERT CPU %.2f%% load %.2f/%.2f/%.2f",
-                     timestamp_now(), cpu_usage, loadavg1, loadavg5, loadavg15);
-            write_log("ALERT triggered: %s", alert_msg);
-            send_udp_alert(alert_msg);
-        } else {
-            mvprintw(11, 0, "Status: OK");
-        }
-
-        mvprintw(13, 0, "Press 'q' to quit. Cycle: %d", cycle++);
-        refresh();
-
-        // check user input
-        int ch = getch();
-        if (ch == 'q' || ch == 'Q') {
-            keep_running = 0;
-            break;
-        }
-
-        // sleep
-        usleep(DELAY_US);
-    }
-
-    // cleanup
-    endwin();
-    write_log("Shutting down CPU monitor");
-    close_log();
-#if SEND_ALERTS
-    if (udp_sock >= 0) close(udp_sock);
-#endif
-    return 0;
-}
+// cpu_monitor.c
+// Compile: gcc cpu_monitor.c -o cpu_monitor -lncursesw -lm -lz -lpthread
+// Run: sudo ./cpu_monitor   (log file location may require permissions)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ncurses.h>
+#include <time.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/bpf.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <netdb.h>
+#include <sys/prctl.h>
+#include <locale.h>
+#include <langinfo.h>
+#include <sys/resource.h>
+#include "cpu_shm.h"
+
+#define DELAY_US 500000            // 0.5 seconds between samples
+#define ALERT_THRESHOLD 80.0       // CPU % above which an alert is triggered
+#define LOG_FILE "cpu_monitor.log"
+#define LOG_MAX_BYTES (1024 * 1024) // rotate when log > 1MB
+#define LOG_KEEP_GENERATIONS 10    // rotated logs kept, 0 for no limit
+#define LOG_KEEP_BYTES (20 * 1024 * 1024) // total size of rotated logs kept, 0 for no limit
+#define LOG_COMPRESS 1             // 1 to gzip rotated logs on a background thread
+#define LOG_ROTATE_QUEUE 8         // rotated files waiting for compression
+#define LOG_SCAN_MAX 4096          // rotated files considered when pruning
+#define LOG_LINE_BYTES 8192        // longest log line; longer ones are cut
+#define IO_ENGINE IO_ENGINE_PREAD  // default I/O engine, -e pread|uring at run time
+#define ENABLE_IO_URING 1          // 1 to build the io_uring engine
+#define URING_ENTRIES 64           // submission queue size
+#define URING_MAX_FILES 32         // files read every tick through the batch
+#define URING_LOG_BYTES (64 * 1024) // log lines buffered until the next batch
+#define ENABLE_REPLAY 1            // 1 to build record (-r) and replay (-R) of the per-tick /proc reads
+#define REPLAY_MAX_FILES 32        // files read in one recorded tick
+#define SEND_ALERTS 1              // 1 to enable UDP alert forwarding, 0 to disable
+#define SERVER_IP "127.0.0.1"      // Alert server (set to your monitoring server)
+#define SERVER_PORT 9999           // Alert server port
+#define ENABLE_FLEET 1             // 1 to build the fleet view (-f) and per-sample sending to it (-u HOST[:PORT])
+#define FLEET_PORT 9998            // UDP port of the fleet view
+#define FLEET_MAX_HOSTS 8192       // hosts in one fleet view (power of two)
+#define FLEET_SPARK_LEN 16         // recent samples drawn per host
+#define FLEET_STALE_S 10.0         // hosts silent for longer are marked STALE
+#define FLEET_FRAME_MS 500         // fleet view redraw interval
+#define FLEET_SORT_MS 2000         // fleet view re-sort interval while the sort column stays the same
+#define FLEET_RECV_BATCH 64        // datagrams per recvmmsg call
+#define FLEET_RCVBUF_BYTES (4 * 1024 * 1024)
+#define FLEET_LINE_BYTES 512       // one formatted table row
+#define MAX_CPUS 256               // per-core arrays are indexed by kernel CPU number
+#define ENABLE_METRICS_HTTP 1      // 1 to serve Prometheus metrics over HTTP, 0 to disable
+#define METRICS_PORT 9101          // Prometheus scrape port (GET /metrics)
+#define METRICS_MAX_CLIENTS 16     // concurrent scrape connections
+#define METRICS_BUF_BYTES (256 * 1024)
+#define PROC_STAT_BUF_BYTES (256 * 1024) // all of /proc/stat, including a long "intr" line
+#define STEAL_ALERT_THRESHOLD 20.0 // steal % (time taken by the hypervisor) that raises an alert
+#define IOWAIT_ALERT_THRESHOLD 30.0 // iowait % that raises an alert
+#define MEM_ALERT_THRESHOLD 90.0   // % of RAM in use (MemTotal - MemAvailable) that raises an alert
+#define SWAP_ALERT_RATE 1000.0     // pages/s swapped in + out that raises an alert
+#define DIRECT_SCAN_ALERT_RATE 1000.0 // pages/s scanned by direct reclaim that raises an alert
+#define DISK_DEVICES ""            // comma-separated devices to sample, "" for all whole disks except loop/ram
+#define MAX_DISKS 64               // devices tracked after filtering
+#define DISK_AWAIT_ALERT_MS 100.0  // average I/O completion time that raises an alert
+#define DISK_UTIL_ALERT 90.0       // % of time a device was busy that raises an alert
+#define DISKSTATS_BUF_BYTES (256 * 1024)
+#define MAX_NETS 32                // network interfaces tracked from /proc/net/dev
+#define NET_SKIP_LOOPBACK 1        // 1 to leave "lo" out of the interface table
+#define NET_DROP_ALERT_RATE 100.0  // packets/s dropped on an interface that raises an alert
+#define NET_ERROR_ALERT_RATE 10.0  // receive + transmit errors/s on an interface that raises an alert
+#define MAX_NUMA_NODES 64          // NUMA nodes with CPUs
+#define NUMA_IMBALANCE_ALERT 40.0  // usage spread between the busiest and idlest NUMA node that raises an alert
+#define SMT_BUSY_THRESHOLD 50.0    // usage every SMT sibling of a core must reach for the core to count as saturated
+#define TRACK_PERF 1               // 1 to read per-CPU hardware counters with perf_event_open (needs root or CAP_PERFMON)
+#define PERF_SOFTWARE_EVENTS 0     // 1 to count software events instead of the PMU, e.g. to test in a VM
+#define PROFILE_ON_ALERT 1         // 1 to sample on-CPU stacks for PROFILE_SECONDS after a CPU alert
+#define PROFILE_SECONDS 10         // length of one alert profile
+#define PROFILE_FREQ 99            // stack samples per second per CPU
+#define PROFILE_COOLDOWN_S 300     // minimum time between the end of one profile and the next
+#define PROFILE_MAX_DEPTH 127      // frames kept per stack
+#define PROFILE_MAX_NODES 262144   // trie nodes, 24 bytes each; later samples are cut short when full
+#define PROFILE_MAX_PIDS 4096      // processes in one profile
+#define PROFILE_MAX_MAPS 512       // executable mappings per process used to name user frames
+#define PROFILE_RING_PAGES 32      // per-CPU sample ring (power of two), drained every tick
+#define MAX_THERMAL_ZONES 32       // /sys/class/thermal zones sampled
+#define CTXT_ALERT_RATE 200000.0   // context switches/s that raise an alert
+#define FORK_ALERT_RATE 2000.0     // new processes/s that raise an alert
+#define RUNQ_DELAY_ALERT_MS 10.0   // average wait on a run queue per timeslice that raises an alert
+#define TRACK_INTERRUPTS 1         // 1 to sample /proc/interrupts and /proc/softirqs
+#define MAX_IRQ_ROWS 1024          // /proc/interrupts sources tracked
+#define MAX_SOFTIRQ_ROWS 16        // /proc/softirqs sources tracked
+#define INTERRUPTS_BUF_BYTES (4 * 1024 * 1024) // /proc/interrupts is one column per CPU
+#define IRQ_HEATMAP_ROWS 8         // busiest sources drawn in each heatmap
+#define IRQ_IMBALANCE_MIN_RATE 1000.0 // interrupts/s a source (or all of them) needs before its balance is checked
+#define IRQ_IMBALANCE_SHARE 90.0   // % of a softirq's interrupts on one CPU that raises an alert
+#define IRQ_IMBALANCE_CPU_RATIO 4.0 // busiest CPU's hardware interrupts over the per-CPU mean that raises an alert
+#define PUBLISH_SHM 1              // 1 to publish every sample to shared memory (see cpu_shm.h)
+#define SHM_SETUP_WAIT_TRIES 50    // 10 ms waits for a ring another monitor is still setting up
+#define HISTORY_SECONDS 3600       // in-memory history kept for queries
+#define HISTORY_LEN (HISTORY_SECONDS * (1000000 / DELAY_US))
+#define HISTORY_GRAPH 1            // 1 to draw the history graph panel ('g' toggles it)
+#define GRAPH_MINUTES 5            // time covered by the graphs, at most HISTORY_SECONDS
+#define GRAPH_WIDTH 60             // columns; each is the mean of GRAPH_MINUTES * 60 / GRAPH_WIDTH seconds
+#define GRAPH_HEIGHT 4             // rows of the aggregate graph, 8 levels each
+#define GRAPH_CORES_SHOWN 16       // cores with their own sparkline
+#define ENABLE_JOURNAL 1           // 1 to journal samples to disk and recover them on restart
+#define JOURNAL_FILE "cpu_monitor.journal"
+#define JOURNAL_RECORDS HISTORY_LEN // samples kept in the journal ring
+#define JOURNAL_SYNC_MS 2000       // fdatasync interval; samples newer than this can be lost on power failure
+#define TRACK_PROCS 1              // 1 to sample per-process CPU from /proc/<pid>/stat each cycle
+#define PROC_TABLE_SIZE 65536      // per-process slots (power of two), ~45k live PIDs
+#define TOP_PROCS 10               // hottest processes kept per sample
+#define TRACK_THREADS 1            // 1 to allow a per-thread drill-down of one process (-p PID)
+#define MAX_THREADS 16384          // threads read per tick in the drill-down
+#define THREAD_GROUP_SLOTS 4096    // distinct thread names (power of two)
+#define THREAD_GROUPS_SHOWN 10     // hottest thread groups drawn in the UI
+#define PROC_SOURCE PROC_SOURCE_PROCFS // default per-process source, -s procfs|ebpf at run time
+#define PROC_EBPF 1                // 1 to build the sched_switch eBPF source (needs root or CAP_BPF + CAP_PERFMON)
+#define EBPF_MAP_ENTRIES 32768     // processes that can run within one tick
+#define EBPF_DRAIN_CHUNK 1024      // map entries removed per batch syscall
+#define ENABLE_QUERY_SOCKET 1      // 1 to answer queries on a Unix domain socket, 0 to disable
+#define QUERY_SOCKET_PATH "cpu_monitor.sock"
+#define QUERY_MAX_CLIENTS 8
+#define QUERY_OUT_BYTES 16384      // per-client response buffer, refilled as the socket drains
+#define STATS_WINDOW_SECONDS 60    // sliding window for mean/stddev
+#define STATS_WINDOW (STATS_WINDOW_SECONDS * (1000000 / DELAY_US))
+#define STATS_EWMA_ALPHA 0.1       // weight of the newest sample in the EWMA
+#define SKETCH_ACCURACY 0.01       // DDSketch relative accuracy of percentiles
+#define SKETCH_MIN 0.01            // values below this count as zero
+#define SKETCH_BUCKETS 512         // covers SKETCH_MIN..100% at 1% accuracy
+#define STATS_LOG_EVERY 120        // cycles between per-core statistics log lines
+
+/*
+ * CPU time counters from a /proc/stat "cpu" line, in kernel order. guest and
+ * guest_nice are also counted inside user and nice.
+ */
+enum { CT_USER, CT_NICE, CT_SYSTEM, CT_IDLE, CT_IOWAIT, CT_IRQ, CT_SOFTIRQ, CT_STEAL, CT_GUEST, CT_GUEST_NICE,
+       CPU_TIME_FIELDS };
+static const char *cpu_time_names[CPU_TIME_FIELDS] = {
+    "user", "nice", "system", "idle", "iowait", "irq", "softirq", "steal", "guest", "guest_nice"
+};
+
+/*
+ * Scheduler counters from the non-cpu lines of /proc/stat, read in the same
+ * pass as the CPU times.
+ */
+enum { ST_CTXT, ST_INTR, ST_PROCESSES, ST_PROCS_RUNNING, ST_PROCS_BLOCKED, STAT_COUNTERS };
+
+struct sched_sample {
+    unsigned long long procs_running, procs_blocked;
+    double ctxt_rate, intr_rate, fork_rate;     // per second
+    double runq_delay_ms;                       // average run-queue wait per timeslice, all CPUs
+    double core_runq_delay_ms[MAX_CPUS];        // same, per CPU, from /proc/schedstat
+};
+
+/*
+ * Fields picked out of /proc/meminfo (kB) and /proc/vmstat (event counters).
+ * The key tables below must list the names in the same order.
+ */
+enum { MI_MEMTOTAL, MI_MEMFREE, MI_MEMAVAILABLE, MI_BUFFERS, MI_CACHED, MI_SWAPTOTAL, MI_SWAPFREE,
+       MI_DIRTY, MI_WRITEBACK, MI_ANONPAGES, MI_SHMEM, MI_SLAB, MEMINFO_FIELDS };
+static const char *const meminfo_keys[MEMINFO_FIELDS] = {
+    "MemTotal", "MemFree", "MemAvailable", "Buffers", "Cached", "SwapTotal", "SwapFree",
+    "Dirty", "Writeback", "AnonPages", "Shmem", "Slab"
+};
+enum { VM_PGSCAN_KSWAPD, VM_PGSCAN_DIRECT, VM_PGSTEAL_KSWAPD, VM_PGSTEAL_DIRECT,
+       VM_PSWPIN, VM_PSWPOUT, VM_PGMAJFAULT, VMSTAT_FIELDS };
+static const char *const vmstat_keys[VMSTAT_FIELDS] = {
+    "pgscan_kswapd", "pgscan_direct", "pgsteal_kswapd", "pgsteal_direct",
+    "pswpin", "pswpout", "pgmajfault"
+};
+
+struct mem_sample {
+    unsigned long long meminfo[MEMINFO_FIELDS]; // kB
+    double vm_rate[VMSTAT_FIELDS];              // events per second over the last interval
+    double used_pct;                            // (MemTotal - MemAvailable) / MemTotal
+    double swap_used_pct;
+};
+
+/*
+ * CPU topology, built once by topology_init(). Sockets, physical cores and
+ * NUMA nodes are numbered densely from 0; the cpu_* arrays map a CPU number
+ * to those indexes and are -1 for CPUs that are not present.
+ */
+struct cpu_topology {
+    int ncpus;                     // one past the highest present CPU
+    int ncores, nsockets, nnodes;
+    int smt;                       // most threads seen on one physical core
+    int cpu_core[MAX_CPUS];
+    int cpu_socket[MAX_CPUS];
+    int cpu_node[MAX_CPUS];
+    int core_cpus[MAX_CPUS];       // threads per physical core
+    int socket_cpus[MAX_CPUS];     // threads per socket
+    int socket_id[MAX_CPUS];       // physical_package_id per socket index
+    int node_cpus[MAX_NUMA_NODES];
+    int node_id[MAX_NUMA_NODES];   // NUMA node number per node index
+};
+
+/*
+ * Per-CPU usage rolled up along the topology, indexed like struct cpu_topology.
+ */
+struct topo_sample {
+    double core_usage[MAX_CPUS];   // physical core, mean of its SMT threads
+    double socket_usage[MAX_CPUS];
+    double node_usage[MAX_NUMA_NODES];
+    double node_imbalance;         // busiest minus idlest node, 0 with one node
+    int smt_busy;                  // physical cores with every sibling busy
+};
+
+/*
+ * Per-CPU counter group read with perf_event_open. The four slots hold cycles,
+ * instructions, LLC misses and branch misses on the PMU; in software mode
+ * they hold cpu-clock (ns), context switches, page faults and migrations.
+ */
+enum { PE_CYCLES, PE_INSTRUCTIONS, PE_LLC_MISSES, PE_BRANCH_MISSES, PERF_EVENTS };
+enum { PERF_MODE_OFF, PERF_MODE_HW, PERF_MODE_SW };
+
+struct perf_sample {
+    int mode;                      // PERF_MODE_*
+    int ncpus;                     // CPUs with a delta this cycle
+    double rate[MAX_CPUS][PERF_EVENTS]; // per second
+    double ipc[MAX_CPUS];          // instructions per cycle, PMU only
+    double llc_mpki[MAX_CPUS];     // LLC misses per 1000 instructions
+    double branch_mpki[MAX_CPUS];  // branch misses per 1000 instructions
+    double total_rate[PERF_EVENTS];
+    double total_ipc, total_llc_mpki, total_branch_mpki;
+};
+
+/*
+ * Clock frequency and temperature from sysfs cpufreq and thermal zones.
+ */
+struct freq_sample {
+    int ncpus;                     // CPUs with cpufreq, 0 when the kernel or VM has none
+    double cur_mhz[MAX_CPUS];      // 0 for a CPU without cpufreq
+    double max_mhz[MAX_CPUS];      // cpuinfo_max_freq
+    double avg_mhz, avg_max_mhz;
+    double weighted_usage;         // mean of per-core usage scaled by cur/max frequency
+    unsigned long long throttle_events; // thermal_throttle counter increments this interval
+    int nzones;
+    char zone_type[MAX_THERMAL_ZONES][20];
+    double zone_temp_c[MAX_THERMAL_ZONES];
+    double zone_trip_c[MAX_THERMAL_ZONES]; // lowest passive trip point, 0 if none
+    double max_temp_c;
+    int throttled;                 // throttle counters moved or a zone reached its passive trip point
+};
+
+/*
+ * Per-device I/O rates from two /proc/diskstats snapshots.
+ */
+struct disk_rate {
+    char name[32];
+    double reads, writes;          // completed I/Os per second
+    double read_kb, write_kb;      // kB per second
+    double await_ms;               // average time per completed I/O, queueing included
+    double queue_depth;            // average I/Os in flight
+    double util;                   // % of the interval with at least one I/O in flight
+};
+
+/*
+ * Per-interface rates from two /proc/net/dev snapshots, all per second.
+ */
+struct net_rate {
+    char name[16];
+    double rx_bytes, tx_bytes;
+    double rx_packets, tx_packets;
+    double rx_drops, tx_drops;
+    double rx_errors, tx_errors;
+};
+
+/*
+ * Perfect hash from a fixed key set to field indexes. A seed is searched once
+ * at startup so every wanted key lands in its own slot; a lookup is one hash
+ * and one memcmp, and any other key either hits an empty slot or fails the compare.
+ */
+#define KEY_TABLE_BITS 6
+struct key_table {
+    unsigned int seed;
+    signed char field[1 << KEY_TABLE_BITS]; // field index per slot, -1 if empty
+    const char *const *keys;
+};
+
+/*
+ * One sample of everything the monitor reports. Filled once per cycle in
+ * main() and handed to the UI, log and export paths.
+ */
+struct cpu_sample {
+    double usage;                  // aggregate CPU %
+    double max_usage, min_usage;
+    double loadavg1, loadavg5, loadavg15;
+    double uptime;
+    int ncores;                    // one past the highest CPU number in /proc/stat
+    double core_usage[MAX_CPUS];   // 0 for a CPU that is offline or has no baseline yet
+    unsigned char core_online[MAX_CPUS]; // CPU sampled this cycle: online and in both /proc/stat snapshots
+    int nonline;                   // online CPUs
+    float breakdown[MAX_CPUS + 1][CPU_TIME_FIELDS]; // % per state; row 0 aggregate, row c + 1 core c
+    int alert;                     // usage >= ALERT_THRESHOLD
+    unsigned long long alert_samples; // samples in alert so far, across restarts with ENABLE_JOURNAL
+    double alert_since;            // wall clock start of the current alert, 0 when not in alert
+    int valid;                     // 0 on the first cycle, before there is a delta to report
+    struct sched_sample sched;
+    struct topo_sample topo;
+    struct freq_sample freq;
+    struct perf_sample perf;
+    struct mem_sample mem;
+    int ndisks;
+    struct disk_rate disks[MAX_DISKS];
+    int nnets;
+    struct net_rate nets[MAX_NETS];
+    unsigned long cycle;
+};
+
+/*
+ * Constant-memory streaming statistics for one usage series: an EWMA, mean
+ * and stddev over a sliding window kept in a ring, and a DDSketch histogram
+ * with logarithmic buckets for percentiles since start.
+ */
+struct stream_stats {
+    double ewma;
+    float window[STATS_WINDOW];
+    int wpos, wcount;
+    double wsum, wsumsq;
+    unsigned long long count;
+    unsigned int zero_count;       // samples below SKETCH_MIN
+    unsigned int buckets[SKETCH_BUCKETS];
+};
+
+// called from wait_for_events() when a registered descriptor is ready
+typedef void (*poll_handler)(void *arg, short revents);
+#define MAX_POLL_FDS 64
+
+static volatile int keep_running = 1;
+static FILE *log_fp = NULL;
+static const char *log_path = LOG_FILE; // <recording>.log during a replay, a scratch file under -I
+static int udp_sock = -1;
+static struct sockaddr_in server_addr;
+static int ui_utf8 = 0;            // terminal takes UTF-8, so graphs can use Unicode blocks
+
+/*
+ * Ring of recent samples, indexed by a running sample number: sample n lives
+ * in slot n % HISTORY_LEN and is valid while n >= history_count - HISTORY_LEN.
+ * Per-core usage is kept as hundredths of a percent to keep the ring compact;
+ * HISTORY_CORE_OFFLINE marks a CPU that was not sampled.
+ */
+#define HISTORY_CORE_OFFLINE 0xFFFF
+struct history_entry {
+    double ts;                     // wall clock seconds since the epoch
+    float usage;
+    float loadavg1, loadavg5, loadavg15;
+    unsigned short ncores;
+    unsigned char alert;
+    float breakdown[CPU_TIME_FIELDS]; // aggregate % per CPU state
+};
+static struct history_entry history[HISTORY_LEN];
+static unsigned short history_core[HISTORY_LEN][MAX_CPUS];
+static unsigned long long history_count = 0;
+
+static char alert_text[256];        // alerts raised this cycle, shown in the UI
+static const struct cpu_sample *last_sample = NULL; // most recent complete sample, for queries
+
+static struct cpu_topology topo;
+
+#if TRACK_PERF
+struct perf_event_spec {
+    unsigned int type;
+    unsigned long long config;
+};
+static const struct perf_event_spec perf_hw_events[PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+// for PMUs without an LL cache event; its meaning varies by CPU model
+static const struct perf_event_spec perf_llc_generic = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES };
+static int perf_use_llc_generic = 0;
+static const struct perf_event_spec perf_sw_events[PERF_EVENTS] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+static int perf_mode = PERF_MODE_OFF;
+static int perf_fd[MAX_CPUS][PERF_EVENTS];           // [c][0] is the group leader, -1 when closed
+static unsigned char perf_failed[MAX_CPUS];          // group could not be opened, not retried until the CPU comes back
+static unsigned long long perf_prev[MAX_CPUS][2 + PERF_EVENTS]; // time_enabled, time_running, counts
+#endif
+static struct stream_stats agg_stats;
+static struct stream_stats core_stats[MAX_CPUS];
+static double sketch_log_gamma;    // log((1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY))
+
+#if TRACK_PROCS
+/*
+ * Per-process CPU accounting. Two open-addressing tables keyed by PID hold the
+ * previous and current scan; an entry belongs to a scan only if its epoch
+ * matches, so tables never need clearing.
+ */
+struct proc_entry {
+    int pid;
+    unsigned int epoch;
+    unsigned long long ticks;      // utime + stime
+    char comm[16];
+};
+struct top_proc {
+    int pid;
+    double cpu;                    // % of one CPU over the last interval
+    char comm[16];
+};
+static struct proc_entry proc_tables[2][PROC_TABLE_SIZE];
+static unsigned int proc_epoch = 0;
+static struct timespec proc_last_scan;
+static struct top_proc top_procs[TOP_PROCS];
+static int top_procs_count = 0;
+static int procs_seen = 0;        // processes scanned (procfs) or that ran this tick (eBPF)
+#endif
+enum { PROC_SOURCE_PROCFS, PROC_SOURCE_EBPF };
+static int proc_source = PROC_SOURCE;
+enum { IO_ENGINE_PREAD, IO_ENGINE_URING };
+
+#if TRACK_INTERRUPTS
+/*
+ * Per-CPU counts from /proc/interrupts or /proc/softirqs. Both files are a row
+ * per source and a column per online CPU. Counts and rates are stored
+ * column-major (col * max_rows + row), so one CPU's column is contiguous for
+ * the per-CPU sums and the heatmap.
+ */
+#define IRQ_NAME_LEN 24
+struct irq_matrix {
+    const char *path;
+    int max_rows;
+    int nrows, ncols;
+    int col_cpu[MAX_CPUS];         // CPU number of each column
+    char (*name)[IRQ_NAME_LEN];    // "NET_RX", "LOC", "24:virtio0-input.0"
+    unsigned long long *prev;      // counts from the last read
+    float *rate;                   // per second
+    double *row_rate;              // per source, all CPUs
+    int *row_top;                  // column with the highest rate per source
+    double col_rate[MAX_CPUS];     // per CPU, all sources
+    double total_rate;
+    int fd;
+    struct timespec prev_ts;
+};
+static char irq_hw_name[MAX_IRQ_ROWS][IRQ_NAME_LEN];
+static unsigned long long irq_hw_prev[MAX_CPUS * MAX_IRQ_ROWS];
+static float irq_hw_rate[MAX_CPUS * MAX_IRQ_ROWS];
+static double irq_hw_row_rate[MAX_IRQ_ROWS];
+static int irq_hw_row_top[MAX_IRQ_ROWS];
+static struct irq_matrix irq_hw = {
+    .path = "/proc/interrupts", .max_rows = MAX_IRQ_ROWS, .name = irq_hw_name, .prev = irq_hw_prev,
+    .rate = irq_hw_rate, .row_rate = irq_hw_row_rate, .row_top = irq_hw_row_top, .fd = -1
+};
+static char irq_soft_name[MAX_SOFTIRQ_ROWS][IRQ_NAME_LEN];
+static unsigned long long irq_soft_prev[MAX_CPUS * MAX_SOFTIRQ_ROWS];
+static float irq_soft_rate[MAX_CPUS * MAX_SOFTIRQ_ROWS];
+static double irq_soft_row_rate[MAX_SOFTIRQ_ROWS];
+static int irq_soft_row_top[MAX_SOFTIRQ_ROWS];
+static struct irq_matrix irq_soft = {
+    .path = "/proc/softirqs", .max_rows = MAX_SOFTIRQ_ROWS, .name = irq_soft_name, .prev = irq_soft_prev,
+    .rate = irq_soft_rate, .row_rate = irq_soft_row_rate, .row_top = irq_soft_row_top, .fd = -1
+};
+static char irq_buf[INTERRUPTS_BUF_BYTES];
+#endif
+
+#if ENABLE_QUERY_SOCKET
+struct query_client {
+    int fd;                        // -1 when slot is free
+    size_t in_len;
+    char in[256];
+    size_t out_len, out_sent;
+    unsigned long long range_next, range_end; // pending "range" rows still to stream
+    double range_t1;
+    char out[QUERY_OUT_BYTES];
+};
+static int query_sock = -1;
+static struct query_client query_clients[QUERY_MAX_CLIENTS];
+static float query_scratch[HISTORY_LEN]; // percentile workspace
+#endif
+
+#if ENABLE_METRICS_HTTP
+/*
+ * Scrape responses are rendered once per sample into one of two buffers and
+ * served straight from it, so a scrape costs one write() and no formatting.
+ * A buffer holds the complete HTTP response starting at metrics_off[i].
+ */
+struct metrics_client {
+    int fd;                        // -1 when slot is free
+    int buf;                       // buffer being sent, -1 while reading request
+    size_t sent;
+    size_t req_len;
+    char req[1024];
+};
+static int metrics_sock = -1;
+static char metrics_buf[2][METRICS_BUF_BYTES];
+static size_t metrics_off[2], metrics_len[2];
+static int metrics_front = -1;     // buffer holding the latest sample, -1 until first render
+static int metrics_refs[2];        // clients still writing from each buffer
+static struct metrics_client metrics_clients[METRICS_MAX_CLIENTS];
+#endif
+
+#if PUBLISH_SHM
+_Static_assert(MAX_CPUS <= CPU_SHM_MAX_CPUS, "shared-memory sample too small for MAX_CPUS");
+_Static_assert(CPU_TIME_FIELDS == CPU_SHM_TIME_FIELDS, "shared-memory breakdown does not match /proc/stat fields");
+static struct cpu_shm_header *shm_hdr = NULL;
+#endif
+
+// forward declarations
+void handle_signal(int sig);
+void open_log();
+void close_log();
+void rotate_log_if_needed();
+void write_log(const char *fmt, ...);
+int get_cpu_cores();
+int read_sysfs_int(const char *path, int def);
+int parse_cpu_list(const char *s, unsigned char *mask);
+void topology_init();
+void topology_rollup(const double *core_usage, const unsigned char *online, int ncores, struct topo_sample *ts);
+ssize_t pread_file(int *fd, const char *path, char *buf, size_t size);
+ssize_t tick_read(int *fd, const char *path, char *buf, size_t size);
+int uring_open();
+void uring_close();
+void uring_tick();
+int uring_log_append(const char *s, size_t n);
+void uring_log_flush();
+void sample_clock(struct timespec *ts);
+void sample_wall(struct timeval *tv);
+int record_open(const char *path);
+void record_tick();
+void record_close();
+int replay_open(const char *path, int fast);
+int replay_next_tick();
+long replay_delay_us();
+double replay_time();
+void replay_close();
+int sparkline(char *out, size_t size, const float *vals, int n);
+int fleet_send_open(const char *target);
+void fleet_send(const struct cpu_sample *cur);
+void fleet_send_close();
+int fleet_view(int port, int load_hosts);
+const char *parse_ull(const char *p, unsigned long long *v);
+void get_cpu_times(unsigned long long *times, unsigned long long *counters, unsigned char *seen, int *ncores, int *ok);
+int get_online_cpus(unsigned char *mask);
+void get_sched_stats(const unsigned long long *counters, struct sched_sample *sched);
+void cpu_row_sums(const unsigned long long *row, unsigned long long *idle, unsigned long long *total);
+void calculate_cpu_breakdown(const unsigned long long *prev, const unsigned long long *times, int rows, float *pct);
+double calculate_cpu_usage(unsigned long long prev_idle, unsigned long long prev_total, unsigned long long idle, unsigned long long total, int ok);
+void get_system_info(double *loadavg1, double *loadavg5, double *loadavg15, double *uptime, int *ok);
+void key_table_build(struct key_table *kt, const char *const *keys, int nkeys);
+int key_table_find(const struct key_table *kt, const char *key, size_t len);
+void get_mem_info(struct mem_sample *mem, int *ok);
+void get_disk_stats(struct disk_rate *disks, int *ndisks, int *ok);
+void get_net_stats(struct net_rate *nets, int *nnets, int *ok);
+void get_interrupts(int *ok);
+int read_sysfs_ull(int fd, unsigned long long *v);
+void get_freq_stats(struct freq_sample *fs, const double *core_usage, const unsigned char *online, int ncores);
+void get_perf_stats(struct perf_sample *ps, const unsigned char *online, int ncores);
+void perf_close();
+const char *perf_summary(const struct perf_sample *ps);
+void profile_start(const char *reason, const unsigned char *online, int ncores);
+void profile_tick();
+void profile_close();
+#if TRACK_INTERRUPTS
+int get_irq_matrix(struct irq_matrix *m);
+double irq_row_share(const struct irq_matrix *m, int r);
+void check_irq_balance(const struct irq_matrix *m, const char *prefix, const struct cpu_sample *cur);
+void check_irq_cpu_spread(const struct irq_matrix *m, const char *prefix, const struct cpu_sample *cur);
+int draw_irq_heatmap(const struct irq_matrix *m, const char *title, int row);
+#endif
+void stats_add(struct stream_stats *st, double x);
+double stats_mean(const struct stream_stats *st);
+double stats_stddev(const struct stream_stats *st);
+double stats_quantile(const struct stream_stats *st, double q);
+void send_udp_alert(const char *message);
+void alert_reset();
+void raise_alert(const char *kind, double value, const char *unit, double threshold, const struct cpu_sample *cur);
+const char* timestamp_now();
+void metrics_open();
+void metrics_close();
+void metrics_render(const struct cpu_sample *cur);
+void metrics_poll_fds();
+void wait_for_events(long usec);
+void add_poll_fd(int fd, short events, poll_handler handler, void *arg);
+void history_append(const struct cpu_sample *cur);
+void journal_open(struct cpu_sample *cur);
+void journal_append(const struct cpu_sample *cur);
+void journal_close();
+void sample_processes();
+int ebpf_open();
+void ebpf_close();
+int bench_proc_sources(int npids);
+int threads_open(int pid);
+void threads_close();
+int sample_threads();
+int draw_threads(int row);
+const char *threads_summary();
+void graph_update();
+void graph_toggle();
+int draw_history_graph(int row, int ncores);
+void query_open();
+void query_close();
+void query_poll_fds();
+void shm_publish_open();
+void shm_publish(const struct cpu_sample *cur);
+void shm_publish_close();
+
+void handle_signal(int sig) {
+    keep_running = 0;
+}
+
+/*
+ * Log rotation. When the log passes LOG_MAX_BYTES it is renamed to
+ * <log>.<time> while still open, a fresh log is opened, and only then
+ * is the old stream closed, so every line lands in one file or the other.
+ * Compression (LOG_COMPRESS) and pruning to LOG_KEEP_GENERATIONS files and
+ * LOG_KEEP_BYTES in total run on a background thread; the sampling loop only
+ * does the rename and the open. The thread never writes the log itself: it
+ * queues messages that the next write_log() copies in.
+ */
+static pthread_t log_worker;
+static int log_worker_started = 0;
+static pthread_mutex_t log_worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_worker_cond = PTHREAD_COND_INITIALIZER;
+static char log_jobs[LOG_ROTATE_QUEUE][512]; // rotated files waiting to be compressed
+static int log_jobs_head, log_jobs_count;
+static int log_prune_pending = 0;
+static int log_worker_stop = 0;
+static char log_worker_msgs[8][320];
+static int log_worker_nmsgs;       // written under log_worker_lock, read without it by the fast path
+static long long log_bytes = 0;    // size of the current log, kept without a stat() per line
+
+// directory holding the log and its file name, for scanning rotated files
+static void log_split_path(char *dir, size_t dir_size, const char **base) {
+    const char *slash = strrchr(log_path, '/');
+    if (slash) snprintf(dir, dir_size, "%.*s", (int)(slash - log_path), log_path);
+    else snprintf(dir, dir_size, ".");
+    *base = slash ? slash + 1 : log_path;
+}
+
+static void log_worker_note(const char *fmt, ...) {
+    pthread_mutex_lock(&log_worker_lock);
+    int n = log_worker_nmsgs;
+    if (n < (int)(sizeof(log_worker_msgs) / sizeof(log_worker_msgs[0]))) {
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(log_worker_msgs[n], sizeof(log_worker_msgs[0]), fmt, ap);
+        va_end(ap);
+        __atomic_store_n(&log_worker_nmsgs, n + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&log_worker_lock);
+}
+
+#if LOG_COMPRESS
+// gzips path to path.gz through a temporary file, then removes path
+static void log_compress(const char *path) {
+    char tmp[560], gz[560];
+    snprintf(gz, sizeof(gz), "%s.gz", path);
+    snprintf(tmp, sizeof(tmp), "%s.gz.tmp", path);
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        log_worker_note("Warning: could not open rotated log %s: %s", path, strerror(errno));
+        return;
+    }
+    gzFile out = gzopen(tmp, "wb6");
+    if (!out) {
+        log_worker_note("Warning: could not create %s: %s", tmp, strerror(errno));
+        close(in);
+        return;
+    }
+    static char buf[64 * 1024];
+    ssize_t n;
+    int ok = 1;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (gzwrite(out, buf, (unsigned)n) != n) {
+            ok = 0;
+            break;
+        }
+    }
+    if (n < 0) ok = 0;
+    close(in);
+    if (gzclose(out) != Z_OK) ok = 0;
+    if (!ok || rename(tmp, gz) != 0) {
+        log_worker_note("Warning: could not compress rotated log %s", path);
+        unlink(tmp);
+        return;
+    }
+    unlink(path);
+}
+#endif
+
+struct log_generation {
+    char name[256];
+    long long bytes;
+};
+
+// length of a rotated name without its ".gz", so both forms of a generation compare alike
+static size_t log_generation_key_len(const char *name) {
+    size_t n = strlen(name);
+    return n > 3 && strcmp(name + n - 3, ".gz") == 0 ? n - 3 : n;
+}
+
+static int log_generation_cmp(const void *a, const void *b) {
+    // "<base>.<timestamp>" then an optional "-NN" counter; a longer name with an equal prefix
+    // carries the counter and is the newer one. Newest sorts first.
+    const char *na = ((const struct log_generation *)a)->name, *nb = ((const struct log_generation *)b)->name;
+    size_t la = log_generation_key_len(na), lb = log_generation_key_len(nb);
+    int c = memcmp(nb, na, la < lb ? la : lb);
+    if (c) return c;
+    return (lb > la) - (lb < la);
+}
+
+/*
+ * Deletes the oldest rotated logs beyond LOG_KEEP_GENERATIONS files or
+ * LOG_KEEP_BYTES in total (0 turns either limit off), except files still
+ * queued for compression. Also clears temporary files left by a compression
+ * that was interrupted; this runs on the worker, so none is in progress.
+ */
+static void log_prune() {
+    static struct log_generation gens[LOG_SCAN_MAX];
+    static char queued[LOG_ROTATE_QUEUE][256];
+    char dir_path[512], path[800];
+    const char *base;
+    pthread_mutex_lock(&log_worker_lock);
+    int nqueued = log_jobs_count;
+    for (int i = 0; i < nqueued; ++i) {
+        const char *job = log_jobs[(log_jobs_head + i) % LOG_ROTATE_QUEUE];
+        const char *slash = strrchr(job, '/');
+        snprintf(queued[i], sizeof(queued[i]), "%.255s", slash ? slash + 1 : job);
+    }
+    pthread_mutex_unlock(&log_worker_lock);
+    log_split_path(dir_path, sizeof(dir_path), &base);
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+    size_t base_len = strlen(base);
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL && n < LOG_SCAN_MAX) {
+        // rotated files are "<base>.<YYYYmmdd_HHMMSS>[-N][.gz]"
+        if (strncmp(de->d_name, base, base_len) != 0 || de->d_name[base_len] != '.') continue;
+        const char *suffix = de->d_name + base_len + 1;
+        if (suffix[0] < '0' || suffix[0] > '9') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, de->d_name);
+        size_t len = strlen(de->d_name);
+        if (len > 4 && strcmp(de->d_name + len - 4, ".tmp") == 0) {
+            unlink(path);
+            continue;
+        }
+        int is_queued = 0;
+        for (int i = 0; i < nqueued && !is_queued; ++i) is_queued = strcmp(queued[i], de->d_name) == 0;
+        if (is_queued) continue;
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+        snprintf(gens[n].name, sizeof(gens[n].name), "%s", de->d_name);
+        gens[n++].bytes = st.st_size;
+    }
+    closedir(dir);
+    qsort(gens, n, sizeof(gens[0]), log_generation_cmp);
+    long long total = 0;
+    int removed = 0;
+    for (int i = 0; i < n; ++i) {
+        total += gens[i].bytes;
+        int over_count = LOG_KEEP_GENERATIONS > 0 && i >= LOG_KEEP_GENERATIONS;
+        int over_bytes = LOG_KEEP_BYTES > 0 && total > LOG_KEEP_BYTES && i > 0;
+        if (!over_count && !over_bytes) continue;
+        snprintf(path, sizeof(path), "%s/%.255s", dir_path, gens[i].name);
+        if (unlink(path) == 0) removed++;
+        total -= gens[i].bytes;
+    }
+    if (removed) log_worker_note("Log retention removed %d old file%s", removed, removed == 1 ? "" : "s");
+}
+
+static void *log_worker_main(void *arg) {
+    pthread_mutex_lock(&log_worker_lock);
+    for (;;) {
+        while (!log_jobs_count && !log_prune_pending && !log_worker_stop) pthread_cond_wait(&log_worker_cond, &log_worker_lock);
+        if (!log_jobs_count && !log_prune_pending) break; // stopping with nothing left to do
+        char path[512] = "";
+        if (log_jobs_count) snprintf(path, sizeof(path), "%s", log_jobs[log_jobs_head]);
+        log_prune_pending = 0;
+        pthread_mutex_unlock(&log_worker_lock);
+#if LOG_COMPRESS
+        if (path[0]) log_compress(path);
+#endif
+        pthread_mutex_lock(&log_worker_lock);
+        if (path[0]) {
+            log_jobs_head = (log_jobs_head + 1) % LOG_ROTATE_QUEUE;
+            log_jobs_count--;
+        }
+        pthread_mutex_unlock(&log_worker_lock);
+        log_prune();
+        pthread_mutex_lock(&log_worker_lock);
+    }
+    pthread_mutex_unlock(&log_worker_lock);
+    return NULL;
+}
+
+// hands a rotated file to the worker, or only asks for pruning when path is NULL
+static void log_worker_submit(const char *path) {
+    pthread_mutex_lock(&log_worker_lock);
+    if (path && LOG_COMPRESS) {
+        if (log_jobs_count < LOG_ROTATE_QUEUE) {
+            snprintf(log_jobs[(log_jobs_head + log_jobs_count) % LOG_ROTATE_QUEUE], sizeof(log_jobs[0]), "%s", path);
+            log_jobs_count++;
+        }
+        // a full queue leaves the file uncompressed; the next startup picks it up
+    }
+    log_prune_pending = 1;
+    pthread_cond_signal(&log_worker_cond);
+    pthread_mutex_unlock(&log_worker_lock);
+}
+
+/*
+ * Starts the worker and queues rotated files that an earlier run left
+ * uncompressed, e.g. because it was killed in the middle.
+ */
+static void log_worker_start() {
+    if (log_worker_started) return;
+    if (pthread_create(&log_worker, NULL, log_worker_main, NULL) != 0) {
+        fprintf(stderr, "Warning: could not start the log rotation thread, rotated logs are kept as is\n");
+        return;
+    }
+    log_worker_started = 1;
+#if LOG_COMPRESS
+    char dir_path[512], path[800];
+    const char *base;
+    log_split_path(dir_path, sizeof(dir_path), &base);
+    DIR *dir = opendir(dir_path);
+    size_t base_len = strlen(base);
+    struct dirent *de;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, base, base_len) != 0 || de->d_name[base_len] != '.') continue;
+        const char *suffix = de->d_name + base_len + 1;
+        if (suffix[0] < '0' || suffix[0] > '9' || strchr(suffix, '.')) continue; // only plain rotated files
+        snprintf(path, sizeof(path), "%s/%s", dir_path, de->d_name);
+        log_worker_submit(path);
+    }
+    if (dir) closedir(dir);
+#endif
+    log_worker_submit(NULL);
+}
+
+// lets a pending compression finish, then stops the worker
+static void log_worker_join() {
+    if (!log_worker_started) return;
+    pthread_mutex_lock(&log_worker_lock);
+    log_worker_stop = 1;
+    pthread_cond_signal(&log_worker_cond);
+    pthread_mutex_unlock(&log_worker_lock);
+    pthread_join(log_worker, NULL);
+    log_worker_started = 0;
+}
+
+// writes one formatted line, batched with the tick's reads under the io_uring engine
+static void log_put(const char *s, size_t n) {
+    if (!uring_log_append(s, n)) {
+        uring_log_flush(); // keep the order of anything still buffered
+        fwrite(s, 1, n, log_fp);
+        fflush(log_fp);
+    }
+    log_bytes += n;
+}
+
+// copies messages from the worker into the log
+static void log_worker_flush_notes() {
+    // unlocked check so write_log() does not take the lock per line; the copy below is locked
+    if (!__atomic_load_n(&log_worker_nmsgs, __ATOMIC_RELAXED) || !log_fp) return;
+    pthread_mutex_lock(&log_worker_lock);
+    char line[400];
+    for (int i = 0; i < log_worker_nmsgs; ++i) {
+        int n = snprintf(line, sizeof(line), "%s %s\n", timestamp_now(), log_worker_msgs[i]);
+        if (n > 0) log_put(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+    }
+    __atomic_store_n(&log_worker_nmsgs, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log_worker_lock);
+}
+
+void open_log() {
+    if (!log_fp) {
+        log_fp = fopen(log_path, "a");
+        if (!log_fp) {
+            // fallback to stderr but continue running
+            fprintf(stderr, "Warning: could not open log file '%s': %s\n", log_path, strerror(errno));
+        } else {
+            setvbuf(log_fp, NULL, _IOLBF, 0); // line buffered
+            struct stat st;
+            log_bytes = fstat(fileno(log_fp), &st) == 0 ? st.st_size : 0;
+            log_worker_start();
+        }
+    }
+}
+
+void close_log() {
+    log_worker_join();
+    if (log_fp) {
+        log_worker_flush_notes();
+        uring_log_flush();
+        fclose(log_fp);
+        log_fp = NULL;
+    }
+}
+
+void rotate_log_if_needed() {
+    if (!log_fp || log_bytes < LOG_MAX_BYTES) return;
+
+    // create rotated filename with timestamp, with a counter if one already exists
+    char rotated[512];
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+    struct stat st;
+    int len = snprintf(rotated, sizeof(rotated), "%s.%04d%02d%02d_%02d%02d%02d", log_path,
+                       tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    for (int k = 1; k < 100; ++k) {
+        char gz[520];
+        snprintf(gz, sizeof(gz), "%s.gz", rotated);
+        if (stat(rotated, &st) != 0 && stat(gz, &st) != 0) break;
+        snprintf(rotated + len, sizeof(rotated) - len, "-%02d", k);
+    }
+
+    // rename while the old stream is still open, so nothing is lost between the two files
+    uring_log_flush();
+    fflush(log_fp);
+    if (rename(log_path, rotated) != 0) {
+        fprintf(stderr, "Warning: could not rotate log file: %s\n", strerror(errno));
+        log_bytes = 0; // try again after another LOG_MAX_BYTES instead of on every line
+        return;
+    }
+    FILE *old = log_fp;
+    log_fp = NULL;
+    open_log();
+    if (!log_fp) {
+        // keep writing to the old file under its original name
+        rename(rotated, log_path);
+        log_fp = old;
+        log_bytes = 0;
+        return;
+    }
+    fclose(old);
+    char line[700];
+    int n = snprintf(line, sizeof(line), "%s Log rotated: previous file moved to %s%s\n", timestamp_now(), rotated,
+                     LOG_COMPRESS ? " (compressing in the background)" : "");
+    if (n > 0) log_put(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+    log_worker_submit(rotated);
+}
+
+void write_log(const char *fmt, ...) {
+    open_log();
+    rotate_log_if_needed();
+    if (!log_fp) return;
+    log_worker_flush_notes();
+    char line[LOG_LINE_BYTES];
+    int len = snprintf(line, sizeof(line), "%s ", timestamp_now());
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line + len, sizeof(line) - len - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    len += n < (int)(sizeof(line) - len - 1) ? n : (int)(sizeof(line) - len - 2);
+    line[len++] = '\n';
+    log_put(line, len);
+}
+
+int get_cpu_cores() {
+    if (topo.ncpus == 0) topology_init();
+    return topo.ncpus;
+}
+
+/*
+ * Reads a single integer from a sysfs file. Returns def if the file is
+ * missing or empty.
+ */
+int read_sysfs_int(const char *path, int def) {
+    char buf[32];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return def;
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    if (n <= 0) return def;
+    buf[n] = '\0';
+    return (int)strtol(buf, NULL, 10);
+}
+
+/*
+ * Parses a sysfs CPU list such as "0-3,8-11" into mask (one byte per CPU,
+ * MAX_CPUS entries). Returns the number of CPUs set.
+ */
+int parse_cpu_list(const char *s, unsigned char *mask) {
+    int count = 0;
+    memset(mask, 0, MAX_CPUS);
+    while (*s >= '0' && *s <= '9') {
+        unsigned long long lo, hi;
+        s = parse_ull(s, &lo);
+        hi = lo;
+        if (*s == '-') s = parse_ull(s + 1, &hi);
+        for (unsigned long long c = lo; c <= hi && c < MAX_CPUS; ++c) {
+            if (!mask[c]) count++;
+            mask[c] = 1;
+        }
+        if (*s == ',') s++;
+    }
+    return count;
+}
+
+/*
+ * Builds the CPU topology once from /sys/devices/system/cpu/cpuN/topology and
+ * /sys/devices/system/node/nodeN/cpulist. Sockets, physical cores and nodes
+ * get dense indexes so per-sample rollups index plain arrays. Without sysfs,
+ * every CPU counted by sysconf is its own core on socket 0, node 0.
+ */
+void topology_init() {
+    char path[320], buf[4096];
+    unsigned char present[MAX_CPUS];
+    int socket_key[MAX_CPUS], core_socket[MAX_CPUS], core_key[MAX_CPUS];
+    memset(&topo, 0, sizeof(topo));
+
+    int fd = -1;
+    if (pread_file(&fd, "/sys/devices/system/cpu/present", buf, sizeof(buf)) > 0) {
+        parse_cpu_list(buf, present);
+    } else {
+        long n = sysconf(_SC_NPROCESSORS_CONF);
+        if (n < 1) n = 1;
+        memset(present, 0, sizeof(present));
+        memset(present, 1, n < MAX_CPUS ? (size_t)n : MAX_CPUS);
+    }
+    if (fd >= 0) close(fd);
+
+    for (int c = 0; c < MAX_CPUS; ++c) {
+        topo.cpu_core[c] = topo.cpu_socket[c] = topo.cpu_node[c] = -1;
+        if (!present[c]) continue;
+        topo.ncpus = c + 1;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+        int pkg = read_sysfs_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+        int core = read_sysfs_int(path, -1 - c); // unknown: a core of its own
+
+        int s = 0;
+        while (s < topo.nsockets && socket_key[s] != pkg) s++;
+        if (s == topo.nsockets) {
+            socket_key[s] = pkg;
+            topo.socket_id[s] = pkg;
+            topo.nsockets++;
+        }
+        // core_id is only unique within a package
+        int k = 0;
+        while (k < topo.ncores && !(core_socket[k] == s && core_key[k] == core)) k++;
+        if (k == topo.ncores) {
+            core_socket[k] = s;
+            core_key[k] = core;
+            topo.ncores++;
+        }
+        topo.cpu_socket[c] = s;
+        topo.cpu_core[c] = k;
+        topo.core_cpus[k]++;
+        topo.socket_cpus[s]++;
+        if (topo.core_cpus[k] > topo.smt) topo.smt = topo.core_cpus[k];
+    }
+
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *de;
+    while (dir && (de = readdir(dir)) != NULL && topo.nnodes < MAX_NUMA_NODES) {
+        if (strncmp(de->d_name, "node", 4) != 0 || de->d_name[4] < '0' || de->d_name[4] > '9') continue;
+        unsigned char cpus[MAX_CPUS];
+        fd = -1;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", de->d_name);
+        int ok = pread_file(&fd, path, buf, sizeof(buf)) > 0;
+        if (fd >= 0) close(fd);
+        if (!ok || parse_cpu_list(buf, cpus) == 0) continue; // memory-only node
+        int n = topo.nnodes++;
+        topo.node_id[n] = atoi(de->d_name + 4);
+        for (int c = 0; c < topo.ncpus; ++c) {
+            if (cpus[c] && topo.cpu_core[c] >= 0) {
+                topo.cpu_node[c] = n;
+                topo.node_cpus[n]++;
+            }
+        }
+    }
+    if (dir) closedir(dir);
+
+    // anything not claimed by a node (or no NUMA sysfs at all) goes to node 0
+    for (int c = 0; c < topo.ncpus; ++c) {
+        if (topo.cpu_core[c] < 0 || topo.cpu_node[c] >= 0) continue;
+        if (topo.nnodes == 0) topo.nnodes = 1;
+        topo.cpu_node[c] = 0;
+        topo.node_cpus[0]++;
+    }
+    if (topo.ncpus == 0) topo.ncpus = 1;
+}
+
+/*
+ * Reads the online CPU mask from /sys/devices/system/cpu/online, kept open
+ * and re-read with pread every cycle so vCPU hotplug is picked up without a
+ * restart. Returns the number of online CPUs, or -1 if the file is unavailable.
+ */
+int get_online_cpus(unsigned char *mask) {
+    static int fd = -1;
+    static int unavailable = 0;
+    static char buf[4096];
+    if (unavailable) return -1;
+    if (tick_read(&fd, "/sys/devices/system/cpu/online", buf, sizeof(buf)) <= 0) {
+        write_log("Warning: Failed to read /sys/devices/system/cpu/online: %s, using /proc/stat for the online CPUs", strerror(errno));
+        unavailable = 1;
+        return -1;
+    }
+    return parse_cpu_list(buf, mask);
+}
+
+/*
+ * Rolls per-CPU usage up to physical cores, sockets and NUMA nodes in one pass
+ * over the CPUs using the index maps from topology_init(). Offline CPUs are
+ * left out, so a core, socket or node is the mean of its online threads only.
+ * A physical core's usage is the mean of its SMT threads; smt_busy counts
+ * cores whose threads are all at or above SMT_BUSY_THRESHOLD, i.e. cores with
+ * no idle sibling left.
+ */
+void topology_rollup(const double *core_usage, const unsigned char *online, int ncores, struct topo_sample *ts) {
+    double core_min[MAX_CPUS];
+    int core_n[MAX_CPUS], socket_n[MAX_CPUS], node_n[MAX_NUMA_NODES];
+    memset(ts, 0, sizeof(*ts));
+    memset(core_n, 0, topo.ncores * sizeof(int));
+    memset(socket_n, 0, topo.nsockets * sizeof(int));
+    memset(node_n, 0, topo.nnodes * sizeof(int));
+    for (int k = 0; k < topo.ncores; ++k) core_min[k] = 100.0;
+    for (int c = 0; c < ncores && c < topo.ncpus; ++c) {
+        int k = topo.cpu_core[c];
+        if (k < 0 || !online[c]) continue;
+        double u = core_usage[c];
+        ts->core_usage[k] += u;
+        ts->socket_usage[topo.cpu_socket[c]] += u;
+        ts->node_usage[topo.cpu_node[c]] += u;
+        core_n[k]++;
+        socket_n[topo.cpu_socket[c]]++;
+        node_n[topo.cpu_node[c]]++;
+        if (u < core_min[k]) core_min[k] = u;
+    }
+    for (int k = 0; k < topo.ncores; ++k) {
+        if (core_n[k] == 0) continue;
+        ts->core_usage[k] /= core_n[k];
+        if (core_n[k] > 1 && core_min[k] >= SMT_BUSY_THRESHOLD) ts->smt_busy++;
+    }
+    for (int k = 0; k < topo.nsockets; ++k) {
+        if (socket_n[k] > 0) ts->socket_usage[k] /= socket_n[k];
+    }
+    double lo = 100.0, hi = 0.0;
+    int nodes = 0;
+    for (int n = 0; n < topo.nnodes; ++n) {
+        if (node_n[n] == 0) continue; // every CPU of the node is offline
+        ts->node_usage[n] /= node_n[n];
+        if (ts->node_usage[n] < lo) lo = ts->node_usage[n];
+        if (ts->node_usage[n] > hi) hi = ts->node_usage[n];
+        nodes++;
+    }
+    ts->node_imbalance = nodes > 1 ? hi - lo : 0.0;
+}
+
+/*
+ * Reads a whole procfs/sysfs file into buf with pread() on a descriptor that
+ * is opened on first use and kept for later calls. Returns bytes read (buf is
+ * NUL-terminated) or -1.
+ */
+ssize_t pread_file(int *fd, const char *path, char *buf, size_t size) {
+    if (*fd < 0) {
+        *fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (*fd < 0) return -1;
+    }
+    ssize_t n = pread(*fd, buf, size - 1, 0);
+    if (n < 0) {
+        close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+#if ENABLE_IO_URING
+/*
+ * io_uring engine (-e uring). Files read every tick are registered with
+ * tick_read() the first time they are read; from then on uring_tick()
+ * submits all of their reads, into registered buffers through registered
+ * (fixed) files, together with the log lines buffered since the last tick,
+ * as one io_uring_enter() that also waits for every completion. tick_read()
+ * then only copies the result. Built on raw syscalls, no liburing.
+ */
+struct uring_file {
+    const char *path;              // string literal owned by the caller
+    int fd;
+    char *buf;                     // registered buffer, buf_bytes long
+    size_t buf_bytes;
+    int res;                       // bytes read this tick, or -errno
+    int fresh;                     // res is from this tick's batch and not yet consumed
+};
+static int uring_fd = -1;
+static unsigned int *uring_sq_head, *uring_sq_tail, *uring_sq_mask, *uring_sq_array;
+static unsigned int *uring_cq_head, *uring_cq_tail, *uring_cq_mask;
+static struct io_uring_sqe *uring_sqes;
+static struct io_uring_cqe *uring_cqes;
+static void *uring_sq_ring, *uring_cq_ring;
+static size_t uring_sq_ring_bytes, uring_cq_ring_bytes;
+static struct uring_file uring_files[URING_MAX_FILES];
+static int uring_nfiles;
+static int uring_registered;       // uring_files[0..uring_registered) are in the batch
+static int uring_fixed = 1;        // 0 once registration failed, e.g. over RLIMIT_MEMLOCK
+static char uring_log_buf[URING_LOG_BYTES];
+static size_t uring_log_len;
+static unsigned long long uring_enters; // io_uring_enter calls, for the benchmark
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    uring_enters++;
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// creates the ring; returns 0, or -1 with errno set (ENOSYS, or EPERM when io_uring is disabled)
+int uring_open() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    uring_fd = io_uring_setup(URING_ENTRIES, &p);
+    if (uring_fd < 0) return -1;
+    uring_sq_ring_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    uring_cq_ring_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring_cq_ring_bytes > uring_sq_ring_bytes) uring_sq_ring_bytes = uring_cq_ring_bytes;
+        uring_cq_ring_bytes = uring_sq_ring_bytes;
+    }
+    uring_sq_ring = mmap(NULL, uring_sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd,
+                         IORING_OFF_SQ_RING);
+    uring_cq_ring = p.features & IORING_FEAT_SINGLE_MMAP ? uring_sq_ring
+                  : mmap(NULL, uring_cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd,
+                         IORING_OFF_CQ_RING);
+    uring_sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQES);
+    if (uring_sq_ring == MAP_FAILED || uring_cq_ring == MAP_FAILED || uring_sqes == MAP_FAILED) {
+        int err = errno;
+        close(uring_fd);
+        uring_fd = -1;
+        errno = err;
+        return -1;
+    }
+    char *sq = uring_sq_ring, *cq = uring_cq_ring;
+    uring_sq_head = (unsigned int *)(sq + p.sq_off.head);
+    uring_sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    uring_sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    uring_sq_array = (unsigned int *)(sq + p.sq_off.array);
+    uring_cq_head = (unsigned int *)(cq + p.cq_off.head);
+    uring_cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    uring_cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    uring_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_close() {
+    if (uring_fd < 0) return;
+    uring_log_flush();
+    close(uring_fd);
+    uring_fd = -1;
+    for (int i = 0; i < uring_nfiles; ++i) {
+        close(uring_files[i].fd);
+        free(uring_files[i].buf);
+    }
+    uring_nfiles = uring_registered = 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe() {
+    unsigned int tail = *uring_sq_tail;
+    if (tail - __atomic_load_n(uring_sq_head, __ATOMIC_ACQUIRE) > *uring_sq_mask) return NULL; // full
+    unsigned int idx = tail & *uring_sq_mask;
+    uring_sq_array[idx] = idx;
+    struct io_uring_sqe *sqe = &uring_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(uring_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// registers the current file set and its buffers, replacing the previous registration
+static void uring_register_files() {
+    static int fds[URING_MAX_FILES];
+    static struct iovec iov[URING_MAX_FILES];
+    if (!uring_fixed) {
+        uring_registered = uring_nfiles; // plain reads through the files' own descriptors
+        return;
+    }
+    if (uring_registered) {
+        io_uring_register(uring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        io_uring_register(uring_fd, IORING_UNREGISTER_FILES, NULL, 0);
+        uring_registered = 0;
+    }
+    for (int i = 0; i < uring_nfiles; ++i) {
+        fds[i] = uring_files[i].fd;
+        iov[i].iov_base = uring_files[i].buf;
+        iov[i].iov_len = uring_files[i].buf_bytes;
+    }
+    int ok = io_uring_register(uring_fd, IORING_REGISTER_FILES, fds, uring_nfiles) == 0;
+    if (ok && io_uring_register(uring_fd, IORING_REGISTER_BUFFERS, iov, uring_nfiles) != 0) {
+        io_uring_register(uring_fd, IORING_UNREGISTER_FILES, NULL, 0);
+        ok = 0;
+    }
+    if (!ok) {
+        write_log("Warning: io_uring buffer registration failed (%s), using unregistered reads", strerror(errno));
+        uring_fixed = 0;
+    }
+    uring_registered = uring_nfiles;
+}
+
+// adds the buffered log lines to the submission queue; returns 1 if one was queued
+static int uring_queue_log() {
+    if (!uring_log_len || !log_fp) return 0;
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (!sqe) return 0;
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fileno(log_fp);
+    sqe->off = (unsigned long long)-1; // current position; the log is O_APPEND
+    sqe->addr = (unsigned long)uring_log_buf;
+    sqe->len = (unsigned int)uring_log_len;
+    sqe->user_data = URING_MAX_FILES; // marks the log write
+    return 1;
+}
+
+// checks the log write's result and writes whatever it did not
+static void uring_log_done(int res) {
+    size_t done = res > 0 ? (size_t)res : 0;
+    if (done < uring_log_len && log_fp) {
+        ssize_t w = write(fileno(log_fp), uring_log_buf + done, uring_log_len - done);
+        (void)w;
+    }
+    uring_log_len = 0;
+}
+
+// reaps completions until none are left
+static void uring_reap() {
+    unsigned int head = *uring_cq_head;
+    while (head != __atomic_load_n(uring_cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &uring_cqes[head & *uring_cq_mask];
+        if (cqe->user_data == URING_MAX_FILES) uring_log_done(cqe->res);
+        else if (cqe->user_data < (unsigned long long)uring_nfiles) {
+            uring_files[cqe->user_data].res = cqe->res;
+            uring_files[cqe->user_data].fresh = 1;
+        }
+        head++;
+    }
+    __atomic_store_n(uring_cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Submits one read for every registered tick file plus the pending log
+ * lines, and waits for all of them in the same system call.
+ */
+void uring_tick() {
+    if (uring_fd < 0) return;
+    if (uring_registered != uring_nfiles) uring_register_files();
+    unsigned int n = 0;
+    for (int i = 0; i < uring_registered; ++i) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        if (!sqe) break;
+        if (uring_fixed) {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->fd = i;           // index into the registered files
+            sqe->buf_index = (unsigned short)i;
+        } else {
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = uring_files[i].fd;
+        }
+        sqe->off = 0;
+        sqe->addr = (unsigned long)uring_files[i].buf;
+        sqe->len = (unsigned int)uring_files[i].buf_bytes - 1;
+        sqe->user_data = (unsigned long long)i;
+        uring_files[i].fresh = 0;
+        n++;
+    }
+    n += uring_queue_log();
+    if (n == 0) return;
+    if (io_uring_enter(uring_fd, n, n, IORING_ENTER_GETEVENTS) < 0) {
+        // leave the reads to the pread path this tick
+        for (int i = 0; i < uring_registered; ++i) uring_files[i].fresh = 0;
+    }
+    uring_reap();
+}
+
+/*
+ * Appends one log line to the buffer that goes out with the next tick.
+ * Returns 0 when the engine is off so the caller writes it directly.
+ */
+int uring_log_append(const char *s, size_t n) {
+    if (uring_fd < 0 || !log_fp) return 0;
+    if (uring_log_len + n > sizeof(uring_log_buf)) uring_log_flush();
+    if (n > sizeof(uring_log_buf)) return 0;
+    memcpy(uring_log_buf + uring_log_len, s, n);
+    uring_log_len += n;
+    return 1;
+}
+
+// writes the buffered log lines now, e.g. before the log is rotated or closed
+void uring_log_flush() {
+    if (uring_fd < 0 || !uring_log_len) return;
+    if (uring_queue_log() && io_uring_enter(uring_fd, 1, 1, IORING_ENTER_GETEVENTS) >= 0) uring_reap();
+    if (uring_log_len) uring_log_done(0); // the ring failed; write it directly
+}
+
+/*
+ * pread_file() for files read on every tick. With the io_uring engine the
+ * read was already done by uring_tick() and is only copied into buf; the
+ * first read of a path adds it to the batch. Without the engine this is
+ * pread_file().
+ */
+static ssize_t tick_read_live(int *fd, const char *path, char *buf, size_t size) {
+    if (uring_fd < 0) return pread_file(fd, path, buf, size);
+    for (int i = 0; i < uring_nfiles; ++i) {
+        struct uring_file *f = &uring_files[i];
+        if (strcmp(f->path, path) != 0) continue;
+        if (!f->fresh || f->res < 0) break;
+        f->fresh = 0;
+        size_t n = (size_t)f->res < size - 1 ? (size_t)f->res : size - 1;
+        memcpy(buf, f->buf, n);
+        buf[n] = '\0';
+        return (ssize_t)n;
+    }
+    ssize_t n = pread_file(fd, path, buf, size);
+    if (n < 0 || uring_nfiles >= URING_MAX_FILES) return n;
+    for (int i = 0; i < uring_nfiles; ++i) {
+        if (strcmp(uring_files[i].path, path) == 0) return n; // known, its batched read just failed
+    }
+    struct uring_file *f = &uring_files[uring_nfiles];
+    f->fd = open(path, O_RDONLY | O_CLOEXEC);
+    f->buf = f->fd >= 0 ? malloc(size) : NULL;
+    if (!f->buf) {
+        if (f->fd >= 0) close(f->fd);
+        return n;
+    }
+    f->path = path;
+    f->buf_bytes = size;
+    f->fresh = 0;
+    uring_nfiles++;
+    return n;
+}
+#else
+int uring_open() {
+    errno = ENOSYS;
+    return -1;
+}
+void uring_close() {}
+void uring_tick() {}
+int uring_log_append(const char *s, size_t n) { return 0; }
+void uring_log_flush() {}
+static ssize_t tick_read_live(int *fd, const char *path, char *buf, size_t size) { return pread_file(fd, path, buf, size); }
+#endif
+
+#if ENABLE_REPLAY
+/*
+ * Record and replay (-r FILE, -R FILE). Recording appends every file that
+ * tick_read() returns to FILE, after a marker carrying the tick's monotonic
+ * and wall clock time. Replay maps FILE and serves those reads back tick by
+ * tick, and sample_clock() returns the recorded time, so rates and usage come
+ * out exactly as they did live while everything after the reads (usage,
+ * statistics, alerts, log, UI) runs for real. Sources that are not read
+ * through tick_read() (processes, threads, interrupts, cpufreq, perf) are
+ * switched off during a replay, and so is everything a live monitor shares:
+ * the replay logs to FILE.log and sends no alerts or fleet samples, and the
+ * journal, shared memory, query socket and metrics port are left alone.
+ *
+ * File: "CPUREC1\n", then records of { u32 type, u32 bytes, payload }:
+ * REC_TICK holds two doubles, REC_FILE a u16 path length, the path and the data.
+ */
+#define REC_MAGIC "CPUREC1\n"
+enum { REC_TICK = 1, REC_FILE = 2 };
+struct rec_header {
+    unsigned int type;
+    unsigned int bytes;            // payload bytes that follow
+};
+struct replay_file {
+    const char *path;
+    unsigned short path_len;
+    const char *data;
+    unsigned int bytes;
+};
+static FILE *record_fp;
+static int replay_active = 0;
+static int replay_fast = 0;        // 1 to run ticks back to back instead of at the recorded pace
+static const char *replay_map;
+static size_t replay_size, replay_pos;
+static struct replay_file replay_files[REPLAY_MAX_FILES];
+static int replay_nfiles;
+static double replay_mono, replay_prev_mono, replay_wall;
+static unsigned long long replay_ticks;
+
+int record_open(const char *path) {
+    record_fp = fopen(path, "w");
+    if (!record_fp) return -1;
+    setvbuf(record_fp, NULL, _IOFBF, 1 << 20);
+    fwrite(REC_MAGIC, 1, strlen(REC_MAGIC), record_fp);
+    return 0;
+}
+
+// starts a new tick in the recording
+void record_tick() {
+    if (!record_fp) return;
+    struct timespec mono;
+    struct timeval wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    gettimeofday(&wall, NULL);
+    double payload[2] = { mono.tv_sec + mono.tv_nsec / 1e9, wall.tv_sec + wall.tv_usec / 1e6 };
+    struct rec_header h = { REC_TICK, sizeof(payload) };
+    fwrite(&h, sizeof(h), 1, record_fp);
+    fwrite(payload, sizeof(payload), 1, record_fp);
+}
+
+static void record_file(const char *path, const char *data, size_t n) {
+    unsigned short len = (unsigned short)strlen(path);
+    struct rec_header h = { REC_FILE, (unsigned int)(sizeof(len) + len + n) };
+    fwrite(&h, sizeof(h), 1, record_fp);
+    fwrite(&len, sizeof(len), 1, record_fp);
+    fwrite(path, 1, len, record_fp);
+    fwrite(data, 1, n, record_fp);
+}
+
+void record_close() {
+    if (!record_fp) return;
+    if (fclose(record_fp) != 0) write_log("Warning: recording may be incomplete: %s", strerror(errno));
+    record_fp = NULL;
+}
+
+int replay_open(const char *path, int fast) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < strlen(REC_MAGIC)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    replay_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (replay_map == MAP_FAILED) return -1;
+    if (memcmp(replay_map, REC_MAGIC, strlen(REC_MAGIC)) != 0) {
+        munmap((void *)replay_map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    madvise((void *)replay_map, st.st_size, MADV_SEQUENTIAL);
+    replay_size = st.st_size;
+    replay_pos = strlen(REC_MAGIC);
+    replay_active = 1;
+    replay_fast = fast;
+    return 0;
+}
+
+/*
+ * Loads the next recorded tick. Returns 0 at the end of the recording; a
+ * record cut short by a crash while recording also ends it, and so does a
+ * record whose payload is too small for what it claims to hold.
+ */
+// stops the replay at a malformed record instead of reading past it
+static void replay_damaged() {
+    write_log("Warning: recording is damaged at offset %zu, ending the replay", replay_pos);
+    replay_pos = replay_size;
+}
+
+int replay_next_tick() {
+    struct rec_header h;
+    replay_nfiles = 0;
+    int have_tick = 0;
+    while (replay_pos + sizeof(h) <= replay_size) {
+        memcpy(&h, replay_map + replay_pos, sizeof(h));
+        const char *payload = replay_map + replay_pos + sizeof(h);
+        if (replay_pos + sizeof(h) + h.bytes > replay_size) break;
+        if (h.type == REC_TICK) {
+            if (have_tick) break;  // the start of the tick after this one
+            double t[2];
+            if (h.bytes < sizeof(t)) {
+                replay_damaged();
+                break;
+            }
+            memcpy(t, payload, sizeof(t));
+            replay_prev_mono = replay_ticks ? replay_mono : t[0];
+            replay_mono = t[0];
+            replay_wall = t[1];
+            have_tick = 1;
+        } else if (h.type == REC_FILE && have_tick && replay_nfiles < REPLAY_MAX_FILES) {
+            unsigned short path_len;
+            if (h.bytes < sizeof(path_len)) {
+                replay_damaged();
+                break;
+            }
+            memcpy(&path_len, payload, sizeof(path_len));
+            if (path_len > h.bytes - sizeof(path_len)) {
+                replay_damaged();
+                break;
+            }
+            struct replay_file *f = &replay_files[replay_nfiles++];
+            f->path_len = path_len;
+            f->path = payload + sizeof(f->path_len);
+            f->data = f->path + f->path_len;
+            f->bytes = h.bytes - sizeof(f->path_len) - f->path_len;
+        }
+        replay_pos += sizeof(h) + h.bytes;
+    }
+    if (have_tick) replay_ticks++;
+    return have_tick;
+}
+
+// serves a read from the current tick; ENOENT if the file was not read when recording
+static ssize_t replay_read(const char *path, char *buf, size_t size) {
+    size_t len = strlen(path);
+    for (int i = 0; i < replay_nfiles; ++i) {
+        const struct replay_file *f = &replay_files[i];
+        if (f->path_len != len || memcmp(f->path, path, len) != 0) continue;
+        size_t n = f->bytes < size - 1 ? f->bytes : size - 1;
+        memcpy(buf, f->data, n);
+        buf[n] = '\0';
+        return (ssize_t)n;
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+// time to wait before the next tick: the recorded interval at 1x, none when fast
+long replay_delay_us() {
+    if (replay_fast || replay_ticks < 2) return replay_fast ? 0 : DELAY_US;
+    return (long)((replay_mono - replay_prev_mono) * 1e6);
+}
+
+// recorded wall clock time of the current tick, for the UI
+double replay_time() {
+    return replay_wall;
+}
+
+void replay_close() {
+    if (!replay_active) return;
+    munmap((void *)replay_map, replay_size);
+    replay_active = 0;
+}
+#else
+int record_open(const char *path) {
+    errno = ENOSYS;
+    return -1;
+}
+void record_tick() {}
+void record_close() {}
+int replay_open(const char *path, int fast) {
+    errno = ENOSYS;
+    return -1;
+}
+int replay_next_tick() { return 0; }
+long replay_delay_us() { return DELAY_US; }
+double replay_time() { return 0.0; }
+void replay_close() {}
+#endif
+
+/*
+ * Reads a file that is sampled every tick: from the recording during a
+ * replay, otherwise through the I/O engine, adding it to the recording
+ * when one is being made.
+ */
+ssize_t tick_read(int *fd, const char *path, char *buf, size_t size) {
+#if ENABLE_REPLAY
+    if (replay_active) return replay_read(path, buf, size);
+    ssize_t n = tick_read_live(fd, path, buf, size);
+    if (n >= 0 && record_fp) record_file(path, buf, (size_t)n);
+    return n;
+#else
+    return tick_read_live(fd, path, buf, size);
+#endif
+}
+
+// CLOCK_MONOTONIC for rate calculations; the recorded time during a replay
+void sample_clock(struct timespec *ts) {
+#if ENABLE_REPLAY
+    if (replay_active) {
+        ts->tv_sec = (time_t)replay_mono;
+        ts->tv_nsec = (long)((replay_mono - (double)ts->tv_sec) * 1e9);
+        return;
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+// wall clock time of the sample, for timestamps; the recorded time during a replay
+void sample_wall(struct timeval *tv) {
+#if ENABLE_REPLAY
+    if (replay_active && replay_ticks) {
+        tv->tv_sec = (time_t)replay_wall;
+        tv->tv_usec = (long)((replay_wall - (double)tv->tv_sec) * 1e6);
+        return;
+    }
+#endif
+    gettimeofday(tv, NULL);
+}
+
+// Parses an unsigned decimal after optional spaces; returns the position after it.
+const char *parse_ull(const char *p, unsigned long long *v) {
+    while (*p == ' ') p++;
+    unsigned long long x = 0;
+    while (*p >= '0' && *p <= '9') x = x * 10 + (unsigned long long)(*p++ - '0');
+    *v = x;
+    return p;
+}
+
+/*
+ * Reads /proc/stat and extracts the aggregate and per-core CPU time counters. If it fails, sets ok=0.
+ * times holds CPU_TIME_FIELDS counters per row: row 0 is the aggregate "cpu" line and
+ * row c + 1 is cpuN with N == c. *ncores is one past the highest CPU seen.
+ * Fields a kernel does not provide are left at 0.
+ * counters receives the STAT_COUNTERS scheduler values from the lines after the cpu lines.
+ * seen[N] is set for every cpuN line; offline CPUs have no line and keep stale rows.
+ */
+void get_cpu_times(unsigned long long *times, unsigned long long *counters, unsigned char *seen, int *ncores, int *ok) {
+    static int fd = -1;
+    static char buf[PROC_STAT_BUF_BYTES];
+    *ok = 0;
+    ssize_t len = tick_read(&fd, "/proc/stat", buf, sizeof(buf));
+    if (len <= 0) {
+        write_log("Warning: Failed to read /proc/stat: %s", strerror(errno));
+        return;
+    }
+    static int warned_truncated;
+    if ((size_t)len == sizeof(buf) - 1 && !warned_truncated) {
+        write_log("Warning: /proc/stat is larger than PROC_STAT_BUF_BYTES, scheduler counters may be missing");
+        warned_truncated = 1;
+    }
+    if (strncmp(buf, "cpu ", 4) != 0) {
+        write_log("Warning: Unexpected /proc/stat format");
+        return;
+    }
+
+    // per-core lines follow the aggregate line and stop at the first non-cpu line
+    *ncores = 0;
+    memset(seen, 0, MAX_CPUS);
+    const char *p = buf;
+    while (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+        p += 3;
+        unsigned long long *row = times;
+        if (*p != ' ') {
+            unsigned long long cpu;
+            p = parse_ull(p, &cpu);
+            if (cpu >= MAX_CPUS) {
+                p = strchr(p, '\n');
+                if (!p) break;
+                p++;
+                continue;
+            }
+            row = times + (cpu + 1) * CPU_TIME_FIELDS;
+            seen[cpu] = 1;
+            if ((int)cpu + 1 > *ncores) *ncores = (int)cpu + 1;
+        }
+        for (int f = 0; f < CPU_TIME_FIELDS; ++f) {
+            if (*p == '\n' || *p == '\0') {
+                row[f] = 0;
+                continue;
+            }
+            p = parse_ull(p, &row[f]);
+        }
+        p = strchr(p, '\n');
+        if (!p) break;
+        p++;
+    }
+
+    // the remaining lines are "name value..."; intr carries one column per IRQ
+    // after its total, so only the total is parsed and the rest skipped
+    memset(counters, 0, STAT_COUNTERS * sizeof(*counters));
+    while (p && *p) {
+        int f = -1;
+        size_t skip = 0;
+        switch (*p) {
+        case 'c': if (strncmp(p, "ctxt ", 5) == 0) { f = ST_CTXT; skip = 5; } break;
+        case 'i': if (strncmp(p, "intr ", 5) == 0) { f = ST_INTR; skip = 5; } break;
+        case 'p':
+            if (strncmp(p, "processes ", 10) == 0) { f = ST_PROCESSES; skip = 10; }
+            else if (strncmp(p, "procs_running ", 14) == 0) { f = ST_PROCS_RUNNING; skip = 14; }
+            else if (strncmp(p, "procs_blocked ", 14) == 0) { f = ST_PROCS_BLOCKED; skip = 14; }
+            break;
+        }
+        if (f >= 0) p = parse_ull(p + skip, &counters[f]);
+        p = strchr(p, '\n');
+        if (p) p++;
+    }
+    *ok = 1;
+}
+
+// Idle (idle + iowait) and total time of one row; guest time is already inside user/nice.
+void cpu_row_sums(const unsigned long long *row, unsigned long long *idle, unsigned long long *total) {
+    *idle = row[CT_IDLE] + row[CT_IOWAIT];
+    *total = row[CT_USER] + row[CT_NICE] + row[CT_SYSTEM] + row[CT_IDLE] + row[CT_IOWAIT]
+           + row[CT_IRQ] + row[CT_SOFTIRQ] + row[CT_STEAL];
+}
+
+/*
+ * Turns two snapshots of rows x CPU_TIME_FIELDS counters into the percentage
+ * of each row's elapsed time spent in each state. The counter deltas are taken
+ * in one flat pass over the packed arrays, which the compiler vectorizes.
+ */
+void calculate_cpu_breakdown(const unsigned long long *prev, const unsigned long long *times, int rows, float *pct) {
+    static unsigned long long delta[(MAX_CPUS + 1) * CPU_TIME_FIELDS];
+    int n = rows * CPU_TIME_FIELDS;
+    for (int i = 0; i < n; ++i) delta[i] = times[i] - prev[i];
+    for (int r = 0; r < rows; ++r) {
+        const unsigned long long *d = delta + r * CPU_TIME_FIELDS;
+        float *out = pct + r * CPU_TIME_FIELDS;
+        unsigned long long idle, total;
+        cpu_row_sums(d, &idle, &total);
+        // a counter that went backwards (CPU went offline and came back) has no usable delta
+        if (total == 0 || total > (1ULL << 62)) {
+            memset(out, 0, CPU_TIME_FIELDS * sizeof(*out));
+            continue;
+        }
+        float scale = 100.0f / (float)total;
+        for (int f = 0; f < CPU_TIME_FIELDS; ++f) out[f] = (float)d[f] * scale;
+    }
+}
+
+/*
+ * Turns the /proc/stat scheduler counters into rates and reads per-CPU
+ * run-queue delay from /proc/schedstat ("cpuN" lines: field 8 is the total
+ * time tasks waited to run in ns, field 9 the number of timeslices run).
+ */
+void get_sched_stats(const unsigned long long *counters, struct sched_sample *sched) {
+    static unsigned long long prev[STAT_COUNTERS];
+    static unsigned long long prev_wait[MAX_CPUS], prev_slices[MAX_CPUS];
+    static struct timespec prev_ts;
+    static int fd = -1;
+    static char buf[PROC_STAT_BUF_BYTES];
+    struct timespec now;
+    sample_clock(&now);
+    double secs = (now.tv_sec - prev_ts.tv_sec) + (now.tv_nsec - prev_ts.tv_nsec) / 1e9;
+    int have_prev = prev_ts.tv_sec != 0 && secs > 0.0;
+
+    sched->procs_running = counters[ST_PROCS_RUNNING];
+    sched->procs_blocked = counters[ST_PROCS_BLOCKED];
+    if (have_prev) {
+        sched->ctxt_rate = counters[ST_CTXT] >= prev[ST_CTXT] ? (counters[ST_CTXT] - prev[ST_CTXT]) / secs : 0.0;
+        sched->intr_rate = counters[ST_INTR] >= prev[ST_INTR] ? (counters[ST_INTR] - prev[ST_INTR]) / secs : 0.0;
+        sched->fork_rate = counters[ST_PROCESSES] >= prev[ST_PROCESSES] ? (counters[ST_PROCESSES] - prev[ST_PROCESSES]) / secs : 0.0;
+    }
+    memcpy(prev, counters, sizeof(prev));
+
+    unsigned long long wait_sum = 0, slice_sum = 0;
+    static int warned;
+    if (tick_read(&fd, "/proc/schedstat", buf, sizeof(buf)) <= 0) {
+        // absent when the kernel is built without CONFIG_SCHEDSTATS
+        if (!warned) write_log("Warning: Failed to read /proc/schedstat: %s, run-queue delay not available", strerror(errno));
+        warned = 1;
+    } else {
+        for (const char *p = buf; p && *p; ) {
+            if (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+                unsigned long long cpu, v[9];
+                p = parse_ull(p + 3, &cpu);
+                for (int f = 0; f < 9; ++f) p = parse_ull(p, &v[f]);
+                if (cpu < MAX_CPUS) {
+                    unsigned long long wait = v[7], slices = v[8];
+                    double delay = 0.0;
+                    if (have_prev && wait >= prev_wait[cpu] && slices > prev_slices[cpu]) {
+                        delay = (wait - prev_wait[cpu]) / 1e6 / (double)(slices - prev_slices[cpu]);
+                        wait_sum += wait - prev_wait[cpu];
+                        slice_sum += slices - prev_slices[cpu];
+                    }
+                    sched->core_runq_delay_ms[cpu] = delay;
+                    prev_wait[cpu] = wait;
+                    prev_slices[cpu] = slices;
+                }
+            }
+            p = strchr(p, '\n');
+            if (p) p++;
+        }
+    }
+    sched->runq_delay_ms = slice_sum ? wait_sum / 1e6 / (double)slice_sum : 0.0;
+    prev_ts = now;
+}
+
+/*
+ * Returns CPU usage percent. If ok==0 (cannot compute), returns 0.0.
+ * Handles first iteration where prev_total == 0.
+ */
+double calculate_cpu_usage(unsigned long long prev_idle, unsigned long long prev_total, unsigned long long idle, unsigned long long total, int ok) {
+    if (!ok) return 0.0;
+    if (total <= prev_total || prev_total == 0) {
+        // can't compute meaningful delta yet
+        return 0.0;
+    }
+    unsigned long long idle_diff = idle - prev_idle;
+    unsigned long long total_diff = total - prev_total;
+    if (total_diff == 0) return 0.0;
+    double usage = 100.0 * (1.0 - ((double)idle_diff / (double)total_diff));
+    if (usage < 0.0) usage = 0.0;
+    if (usage > 100.0) usage = 100.0;
+    return usage;
+}
+
+void get_system_info(double *loadavg1, double *loadavg5, double *loadavg15, double *uptime, int *ok) {
+    static int loadavg_fd = -1, uptime_fd = -1;
+    static char buf[256];
+    *ok = 0;
+    if (tick_read(&loadavg_fd, "/proc/loadavg", buf, sizeof(buf)) <= 0) {
+        write_log("Warning: Failed to read /proc/loadavg: %s", strerror(errno));
+    } else if (sscanf(buf, "%lf %lf %lf", loadavg1, loadavg5, loadavg15) < 1) {
+        write_log("Warning: /proc/loadavg unexpected format");
+    }
+    if (tick_read(&uptime_fd, "/proc/uptime", buf, sizeof(buf)) <= 0) {
+        write_log("Warning: Failed to read /proc/uptime: %s", strerror(errno));
+        return;
+    }
+    if (sscanf(buf, "%lf", uptime) != 1) {
+        write_log("Warning: /proc/uptime unexpected format");
+        return;
+    }
+    *ok = 1;
+}
+
+static unsigned int key_hash(unsigned int seed, const char *key, size_t len) {
+    unsigned int h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; ++i) h = (h ^ (unsigned char)key[i]) * 16777619u;
+    return h >> (32 - KEY_TABLE_BITS);
+}
+
+void key_table_build(struct key_table *kt, const char *const *keys, int nkeys) {
+    kt->keys = keys;
+    for (kt->seed = 0;; ++kt->seed) {
+        memset(kt->field, -1, sizeof(kt->field));
+        int i;
+        for (i = 0; i < nkeys; ++i) {
+            unsigned int h = key_hash(kt->seed, keys[i], strlen(keys[i]));
+            if (kt->field[h] >= 0) break;
+            kt->field[h] = (signed char)i;
+        }
+        if (i == nkeys) return;
+    }
+}
+
+int key_table_find(const struct key_table *kt, const char *key, size_t len) {
+    int f = kt->field[key_hash(kt->seed, key, len)];
+    if (f < 0 || strncmp(kt->keys[f], key, len) != 0 || kt->keys[f][len] != '\0') return -1;
+    return f;
+}
+
+/*
+ * Reads /proc/meminfo and /proc/vmstat into mem. vmstat counters are turned
+ * into per-second rates against the previous call. If meminfo fails, sets ok=0.
+ */
+void get_mem_info(struct mem_sample *mem, int *ok) {
+    static int meminfo_fd = -1, vmstat_fd = -1;
+    static char buf[16 * 1024];
+    static struct key_table meminfo_table, vmstat_table;
+    static unsigned long long prev_vm[VMSTAT_FIELDS];
+    static struct timespec prev_ts;
+    if (!meminfo_table.keys) {
+        key_table_build(&meminfo_table, meminfo_keys, MEMINFO_FIELDS);
+        key_table_build(&vmstat_table, vmstat_keys, VMSTAT_FIELDS);
+    }
+    *ok = 0;
+
+    // "Key:     value kB" per line
+    if (tick_read(&meminfo_fd, "/proc/meminfo", buf, sizeof(buf)) <= 0) {
+        write_log("Warning: Failed to read /proc/meminfo: %s", strerror(errno));
+        return;
+    }
+    int have_available = 0;
+    for (const char *p = buf; *p; ) {
+        const char *colon = strchr(p, ':');
+        if (!colon) break;
+        int f = key_table_find(&meminfo_table, p, colon - p);
+        const char *q = colon + 1;
+        if (f >= 0) q = parse_ull(q, &mem->meminfo[f]);
+        if (f == MI_MEMAVAILABLE) have_available = 1;
+        p = strchr(q, '\n');
+        if (!p) break;
+        p++;
+    }
+    // kernels before 3.14 and some containers have no MemAvailable; estimate it the old way
+    if (!have_available)
+        mem->meminfo[MI_MEMAVAILABLE] = mem->meminfo[MI_MEMFREE] + mem->meminfo[MI_BUFFERS] + mem->meminfo[MI_CACHED];
+    unsigned long long total = mem->meminfo[MI_MEMTOTAL], swap = mem->meminfo[MI_SWAPTOTAL];
+    unsigned long long avail = mem->meminfo[MI_MEMAVAILABLE] < total ? mem->meminfo[MI_MEMAVAILABLE] : total;
+    mem->used_pct = total ? 100.0 * (double)(total - avail) / total : 0.0;
+    mem->swap_used_pct = swap ? 100.0 * (double)(swap - mem->meminfo[MI_SWAPFREE]) / swap : 0.0;
+    *ok = 1;
+
+    // "key value" per line; several pgscan/pgsteal variants exist, we only want the ones listed
+    if (tick_read(&vmstat_fd, "/proc/vmstat", buf, sizeof(buf)) <= 0) return;
+    unsigned long long vm[VMSTAT_FIELDS] = {0};
+    for (const char *p = buf; *p; ) {
+        const char *sp = strchr(p, ' ');
+        if (!sp) break;
+        int f = key_table_find(&vmstat_table, p, sp - p);
+        const char *q = sp;
+        if (f >= 0) q = parse_ull(q, &vm[f]);
+        p = strchr(q, '\n');
+        if (!p) break;
+        p++;
+    }
+    struct timespec now;
+    sample_clock(&now);
+    double elapsed = (now.tv_sec - prev_ts.tv_sec) + (now.tv_nsec - prev_ts.tv_nsec) / 1e9;
+    int have_prev = prev_ts.tv_sec != 0 && elapsed > 0.0;
+    for (int f = 0; f < VMSTAT_FIELDS; ++f) {
+        mem->vm_rate[f] = (have_prev && vm[f] >= prev_vm[f]) ? (vm[f] - prev_vm[f]) / elapsed : 0.0;
+        prev_vm[f] = vm[f];
+    }
+    prev_ts = now;
+}
+
+/*
+ * Whether a device newly seen in /proc/diskstats should be tracked. Called
+ * once per device, not per sample.
+ */
+static int disk_wanted(const char *name) {
+    const char *list = DISK_DEVICES;
+    if (list[0]) {
+        size_t len = strlen(name);
+        for (const char *p = list; *p; ) {
+            const char *end = strchr(p, ',');
+            size_t n = end ? (size_t)(end - p) : strlen(p);
+            if (n == len && strncmp(p, name, n) == 0) return 1;
+            if (!end) break;
+            p = end + 1;
+        }
+        return 0;
+    }
+    if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0) return 0;
+    // whole disks have a /sys/block entry, partitions do not
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/block/%s", name);
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+/*
+ * Devices seen in /proc/diskstats, hashed on major:minor with linear probing.
+ * Every read stamps the devices it lists with the read's generation; devices
+ * missing from a read are dropped and the index is rebuilt, so loop/dm churn
+ * cannot fill it up.
+ */
+#define DISK_HASH_SIZE 4096        // devices listed at once, partitions included (power of two)
+static unsigned int disk_hash_dev[DISK_HASH_SIZE]; // (major << 20 | minor) + 1, 0 = empty
+static short disk_hash_idx[DISK_HASH_SIZE];        // index into disks/prev, -1 = not tracked
+static unsigned int disk_hash_gen[DISK_HASH_SIZE]; // last read that listed the device
+
+// slot holding dev, or the empty slot where it goes; -1 if the table is full
+static int disk_slot(unsigned int dev) {
+    unsigned int h = (dev * 2654435761u) >> 20;
+    for (int probes = 0; probes < DISK_HASH_SIZE; ++probes, h = (h + 1) & (DISK_HASH_SIZE - 1)) {
+        if (disk_hash_dev[h] == 0 || disk_hash_dev[h] == dev) return (int)h;
+    }
+    return -1;
+}
+
+/*
+ * Reads /proc/diskstats and computes per-device rates for the configured
+ * devices. Devices are found through a fixed hash on major:minor, so each
+ * line costs two integer parses and the lines of devices we do not track are
+ * skipped without parsing the rest. If it fails, sets ok=0.
+ */
+void get_disk_stats(struct disk_rate *disks, int *ndisks, int *ok) {
+    // diskstats fields after the name, in order
+    enum { DS_READS, DS_READS_MERGED, DS_SECTORS_READ, DS_MS_READING, DS_WRITES, DS_WRITES_MERGED,
+           DS_SECTORS_WRITTEN, DS_MS_WRITING, DS_IN_PROGRESS, DS_MS_IO, DS_WEIGHTED_MS_IO, DS_FIELDS };
+    static int fd = -1;
+    static char buf[DISKSTATS_BUF_BYTES];
+    static unsigned long long prev[MAX_DISKS][DS_FIELDS];
+    static unsigned char primed[MAX_DISKS]; // prev holds a snapshot of the device in the slot
+    static unsigned int disk_dev[MAX_DISKS];
+    static unsigned int gen = 0;
+    static int tracked = 0, truncated = 0, table_full = 0;
+    static struct timespec prev_ts;
+    *ok = 0;
+    if (tick_read(&fd, "/proc/diskstats", buf, sizeof(buf)) <= 0) {
+        write_log("Warning: Failed to read /proc/diskstats: %s", strerror(errno));
+        return;
+    }
+    struct timespec now;
+    sample_clock(&now);
+    double elapsed_ms = (now.tv_sec - prev_ts.tv_sec) * 1e3 + (now.tv_nsec - prev_ts.tv_nsec) / 1e6;
+    int have_prev = prev_ts.tv_sec != 0 && elapsed_ms > 0.0;
+    gen++;
+
+    for (const char *p = buf; *p; ) {
+        unsigned long long major, minor;
+        p = parse_ull(p, &major);
+        p = parse_ull(p, &minor);
+        unsigned int dev = (unsigned int)((major << 20) | minor) + 1;
+        int h = disk_slot(dev);
+
+        while (*p == ' ') p++;
+        const char *name = p;
+        while (*p && *p != ' ' && *p != '\n') p++;
+        size_t name_len = p - name;
+
+        if (h < 0) {
+            if (!table_full) write_log("Warning: more than %d block devices, ignoring the rest", DISK_HASH_SIZE);
+            table_full = 1;
+        } else if (!disk_hash_dev[h]) {
+            // first sighting: decide once whether to track it
+            char nm[32];
+            if (name_len >= sizeof(nm)) name_len = sizeof(nm) - 1;
+            memcpy(nm, name, name_len);
+            nm[name_len] = '\0';
+            disk_hash_dev[h] = dev;
+            disk_hash_idx[h] = -1;
+            if (disk_wanted(nm)) {
+                if (tracked < MAX_DISKS) {
+                    disk_hash_idx[h] = (short)tracked;
+                    disk_dev[tracked] = dev;
+                    primed[tracked] = 0;
+                    memset(&disks[tracked], 0, sizeof(disks[tracked]));
+                    memcpy(disks[tracked].name, nm, name_len + 1);
+                    tracked++;
+                } else if (!truncated) {
+                    write_log("Warning: more than MAX_DISKS (%d) devices, %s and later ones are not tracked", MAX_DISKS, nm);
+                    truncated = 1;
+                }
+            }
+        }
+        if (h >= 0) disk_hash_gen[h] = gen;
+        int idx = h >= 0 ? disk_hash_idx[h] : -1;
+        if (idx >= 0) {
+            unsigned long long v[DS_FIELDS];
+            for (int f = 0; f < DS_FIELDS; ++f) p = parse_ull(p, &v[f]);
+            const unsigned long long *o = prev[idx];
+            struct disk_rate *d = &disks[idx];
+            if (have_prev && primed[idx] && v[DS_READS] >= o[DS_READS] && v[DS_WRITES] >= o[DS_WRITES]) {
+                double ios = (double)(v[DS_READS] - o[DS_READS]) + (double)(v[DS_WRITES] - o[DS_WRITES]);
+                double secs = elapsed_ms / 1e3;
+                d->reads = (v[DS_READS] - o[DS_READS]) / secs;
+                d->writes = (v[DS_WRITES] - o[DS_WRITES]) / secs;
+                d->read_kb = (v[DS_SECTORS_READ] - o[DS_SECTORS_READ]) / 2.0 / secs;
+                d->write_kb = (v[DS_SECTORS_WRITTEN] - o[DS_SECTORS_WRITTEN]) / 2.0 / secs;
+                d->await_ms = ios > 0 ? ((v[DS_MS_READING] - o[DS_MS_READING]) + (v[DS_MS_WRITING] - o[DS_MS_WRITING])) / ios : 0.0;
+                d->queue_depth = (v[DS_WEIGHTED_MS_IO] - o[DS_WEIGHTED_MS_IO]) / elapsed_ms;
+                d->util = 100.0 * (v[DS_MS_IO] - o[DS_MS_IO]) / elapsed_ms;
+                if (d->util > 100.0) d->util = 100.0;
+            }
+            memcpy(prev[idx], v, sizeof(v));
+            primed[idx] = 1;
+        }
+        p = strchr(p, '\n');
+        if (!p) break;
+        p++;
+    }
+
+    // drop devices this read did not list, keeping the tracked ones in order
+    int gone = 0;
+    for (int h = 0; h < DISK_HASH_SIZE; ++h) {
+        if (!disk_hash_dev[h] || disk_hash_gen[h] == gen) continue;
+        int idx = disk_hash_idx[h];
+        if (idx >= 0) {
+            write_log("Disk %s removed", disks[idx].name);
+            disk_dev[idx] = 0;
+        }
+        disk_hash_dev[h] = 0;
+        gone++;
+    }
+    if (gone) {
+        int kept = 0;
+        for (int i = 0; i < tracked; ++i) {
+            if (!disk_dev[i]) continue;
+            if (kept != i) {
+                disks[kept] = disks[i];
+                memcpy(prev[kept], prev[i], sizeof(prev[i]));
+                primed[kept] = primed[i];
+                disk_dev[kept] = disk_dev[i];
+            }
+            kept++;
+        }
+        for (int i = kept; i < tracked; ++i) memset(&disks[i], 0, sizeof(disks[i]));
+        if (kept < tracked) truncated = 0;
+        tracked = kept;
+        // rebuild the index without the removed devices
+        static unsigned int live_dev[DISK_HASH_SIZE];
+        int nlive = 0;
+        for (int h = 0; h < DISK_HASH_SIZE; ++h) {
+            if (disk_hash_dev[h]) live_dev[nlive++] = disk_hash_dev[h];
+        }
+        memset(disk_hash_dev, 0, sizeof(disk_hash_dev));
+        for (int i = 0; i < nlive; ++i) {
+            int h = disk_slot(live_dev[i]);
+            disk_hash_dev[h] = live_dev[i];
+            disk_hash_idx[h] = -1;
+            disk_hash_gen[h] = gen;
+        }
+        for (int i = 0; i < tracked; ++i) disk_hash_idx[disk_slot(disk_dev[i])] = (short)i;
+        table_full = 0;
+    }
+    prev_ts = now;
+    *ndisks = tracked;
+    *ok = 1;
+}
+
+/*
+ * Reads /proc/net/dev and computes per-interface rates. Interfaces keep their
+ * slot while they exist; a slot is found by first checking the one that
+ * matched at the same line last time. Interfaces missing from a read (veth
+ * pairs of containers that are gone) lose their slot. If it fails, sets ok=0.
+ */
+void get_net_stats(struct net_rate *nets, int *nnets, int *ok) {
+    // /proc/net/dev columns after "name:"
+    enum { ND_RX_BYTES, ND_RX_PACKETS, ND_RX_ERRS, ND_RX_DROP, ND_RX_FIFO, ND_RX_FRAME, ND_RX_COMPRESSED, ND_RX_MULTICAST,
+           ND_TX_BYTES, ND_TX_PACKETS, ND_TX_ERRS, ND_TX_DROP, ND_FIELDS };
+    static int fd = -1;
+    static char buf[32 * 1024];
+    static unsigned long long prev[MAX_NETS][ND_FIELDS];
+    static int line_slot[MAX_NETS * 2];  // slot matched at each line last time, -1 if none
+    static unsigned char primed[MAX_NETS]; // prev holds a snapshot of the interface in the slot
+    unsigned char seen[MAX_NETS] = {0};
+    static int tracked = 0, truncated = 0;
+    static struct timespec prev_ts;
+    *ok = 0;
+    if (tick_read(&fd, "/proc/net/dev", buf, sizeof(buf)) <= 0) {
+        write_log("Warning: Failed to read /proc/net/dev: %s", strerror(errno));
+        return;
+    }
+    struct timespec now;
+    sample_clock(&now);
+    double secs = (now.tv_sec - prev_ts.tv_sec) + (now.tv_nsec - prev_ts.tv_nsec) / 1e9;
+    int have_prev = prev_ts.tv_sec != 0 && secs > 0.0;
+
+    // skip the two header lines
+    const char *p = strchr(buf, '\n');
+    if (p) p = strchr(p + 1, '\n');
+    int line = 0;
+    while (p && *++p) {
+        while (*p == ' ') p++;
+        const char *colon = strchr(p, ':');
+        if (!colon) break;
+        size_t len = colon - p;
+        if (len >= sizeof(nets[0].name)) len = sizeof(nets[0].name) - 1;
+        int slot = line < MAX_NETS * 2 && tracked ? line_slot[line] : -1;
+        if (slot < 0 || slot >= tracked || strncmp(nets[slot].name, p, len) != 0 || nets[slot].name[len] != '\0') {
+            slot = -1;
+            for (int i = 0; i < tracked; ++i) {
+                if (strncmp(nets[i].name, p, len) == 0 && nets[i].name[len] == '\0') { slot = i; break; }
+            }
+            if (slot < 0 && !(NET_SKIP_LOOPBACK && len == 2 && strncmp(p, "lo", 2) == 0)) {
+                if (tracked < MAX_NETS) {
+                    slot = tracked++;
+                    memset(&nets[slot], 0, sizeof(nets[slot]));
+                    memcpy(nets[slot].name, p, len);
+                    nets[slot].name[len] = '\0';
+                    primed[slot] = 0;
+                } else if (!truncated) {
+                    write_log("Warning: more than MAX_NETS (%d) interfaces, %.*s and later ones are not tracked", MAX_NETS,
+                              (int)len, p);
+                    truncated = 1;
+                }
+            }
+        }
+        if (line < MAX_NETS * 2) line_slot[line] = slot;
+        line++;
+        p = colon + 1;
+        if (slot >= 0) {
+            unsigned long long v[ND_FIELDS];
+            for (int f = 0; f < ND_FIELDS; ++f) p = parse_ull(p, &v[f]);
+            const unsigned long long *o = prev[slot];
+            struct net_rate *n = &nets[slot];
+            if (have_prev && primed[slot] && v[ND_RX_BYTES] >= o[ND_RX_BYTES] && v[ND_TX_BYTES] >= o[ND_TX_BYTES]) {
+                n->rx_bytes = (v[ND_RX_BYTES] - o[ND_RX_BYTES]) / secs;
+                n->tx_bytes = (v[ND_TX_BYTES] - o[ND_TX_BYTES]) / secs;
+                n->rx_packets = (v[ND_RX_PACKETS] - o[ND_RX_PACKETS]) / secs;
+                n->tx_packets = (v[ND_TX_PACKETS] - o[ND_TX_PACKETS]) / secs;
+                n->rx_drops = (v[ND_RX_DROP] - o[ND_RX_DROP]) / secs;
+                n->tx_drops = (v[ND_TX_DROP] - o[ND_TX_DROP]) / secs;
+                n->rx_errors = (v[ND_RX_ERRS] - o[ND_RX_ERRS]) / secs;
+                n->tx_errors = (v[ND_TX_ERRS] - o[ND_TX_ERRS]) / secs;
+            }
+            memcpy(prev[slot], v, sizeof(v));
+            primed[slot] = 1;
+            seen[slot] = 1;
+        }
+        p = strchr(p, '\n');
+    }
+    // free the slots of interfaces this read did not list, keeping the rest in order
+    int kept = 0;
+    for (int i = 0; i < tracked; ++i) {
+        if (!seen[i]) continue;
+        if (kept != i) {
+            nets[kept] = nets[i];
+            memcpy(prev[kept], prev[i], sizeof(prev[i]));
+            primed[kept] = primed[i];
+        }
+        kept++;
+    }
+    if (kept < tracked) {
+        for (int i = kept; i < tracked; ++i) memset(&nets[i], 0, sizeof(nets[i]));
+        tracked = kept;            // line_slot entries are checked by name, so stale ones just miss
+    }
+    prev_ts = now;
+    *nnets = tracked;
+    *ok = 1;
+}
+
+// reads one unsigned number from a sysfs file kept open in fd
+int read_sysfs_ull(int fd, unsigned long long *v) {
+    char buf[32];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    parse_ull(buf, v);
+    return 1;
+}
+
+/*
+ * Samples CPU clock frequency, thermal_throttle counters and thermal zone
+ * temperatures from sysfs. Files are opened once (new CPUs are probed as they
+ * appear) and re-read with pread; a file that is missing at probe time is
+ * never retried, so VMs without cpufreq pay nothing per cycle.
+ * core_usage is this cycle's per-core usage, used for the weighted figure;
+ * CPUs not set in online are skipped.
+ */
+void get_freq_stats(struct freq_sample *fs, const double *core_usage, const unsigned char *online, int ncores) {
+    static int probed_cpus = 0;
+    static int freq_fd[MAX_CPUS], throttle_fd[MAX_CPUS];
+    static double max_mhz[MAX_CPUS];
+    static unsigned long long prev_throttle[MAX_CPUS];
+    static int zones_probed = 0, nzones = 0;
+    static int zone_fd[MAX_THERMAL_ZONES];
+    char path[128];
+    unsigned long long v;
+
+    for (; probed_cpus < ncores && probed_cpus < MAX_CPUS; ++probed_cpus) {
+        int c = probed_cpus;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", c);
+        freq_fd[c] = open(path, O_RDONLY | O_CLOEXEC);
+        max_mhz[c] = 0.0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", c);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (read_sysfs_ull(fd, &v)) max_mhz[c] = v / 1000.0;
+            close(fd);
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/thermal_throttle/core_throttle_count", c);
+        throttle_fd[c] = open(path, O_RDONLY | O_CLOEXEC);
+        if (throttle_fd[c] >= 0 && !read_sysfs_ull(throttle_fd[c], &prev_throttle[c])) prev_throttle[c] = 0;
+    }
+
+    if (!zones_probed) {
+        zones_probed = 1;
+        for (int z = 0; z < MAX_THERMAL_ZONES && nzones < MAX_THERMAL_ZONES; ++z) {
+            snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp", z);
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            int n = nzones++;
+            zone_fd[n] = fd;
+            snprintf(fs->zone_type[n], sizeof(fs->zone_type[n]), "zone%d", z);
+            char buf[64];
+            snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/type", z);
+            int tfd = -1;
+            if (pread_file(&tfd, path, buf, sizeof(buf)) > 0) {
+                buf[strcspn(buf, "\n")] = '\0';
+                snprintf(fs->zone_type[n], sizeof(fs->zone_type[n]), "%.19s", buf);
+            }
+            if (tfd >= 0) close(tfd);
+            // the lowest passive trip point is where the kernel starts throttling
+            fs->zone_trip_c[n] = 0.0;
+            for (int t = 0; t < 16; ++t) {
+                int ffd = -1;
+                snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/trip_point_%d_type", z, t);
+                if (pread_file(&ffd, path, buf, sizeof(buf)) <= 0) break;
+                close(ffd);
+                if (strncmp(buf, "passive", 7) != 0) continue;
+                ffd = -1;
+                snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/trip_point_%d_temp", z, t);
+                if (pread_file(&ffd, path, buf, sizeof(buf)) > 0) {
+                    parse_ull(buf, &v);
+                    if (v > 0 && (fs->zone_trip_c[n] == 0.0 || v / 1000.0 < fs->zone_trip_c[n])) fs->zone_trip_c[n] = v / 1000.0;
+                }
+                if (ffd >= 0) close(ffd);
+            }
+        }
+    }
+
+    double mhz_sum = 0.0, max_sum = 0.0, weighted_sum = 0.0;
+    int nonline = 0;
+    fs->ncpus = 0;
+    fs->throttle_events = 0;
+    for (int c = 0; c < ncores && c < MAX_CPUS; ++c) {
+        double scale = 1.0;
+        fs->cur_mhz[c] = 0.0;
+        fs->max_mhz[c] = max_mhz[c];
+        if (!online[c]) continue;
+        nonline++;
+        if (freq_fd[c] >= 0 && read_sysfs_ull(freq_fd[c], &v)) {
+            fs->cur_mhz[c] = v / 1000.0;
+            mhz_sum += fs->cur_mhz[c];
+            max_sum += max_mhz[c];
+            fs->ncpus++;
+            if (max_mhz[c] > 0.0) scale = fs->cur_mhz[c] / max_mhz[c];
+            if (scale > 1.0) scale = 1.0; // turbo above the nominal maximum still counts as full speed
+        }
+        weighted_sum += core_usage[c] * scale;
+        if (throttle_fd[c] >= 0 && read_sysfs_ull(throttle_fd[c], &v)) {
+            if (v > prev_throttle[c]) fs->throttle_events += v - prev_throttle[c];
+            prev_throttle[c] = v;
+        }
+    }
+    fs->avg_mhz = fs->ncpus ? mhz_sum / fs->ncpus : 0.0;
+    fs->avg_max_mhz = fs->ncpus ? max_sum / fs->ncpus : 0.0;
+    fs->weighted_usage = nonline > 0 ? weighted_sum / nonline : 0.0;
+
+    fs->nzones = nzones;
+    fs->max_temp_c = 0.0;
+    int hot = 0;
+    for (int z = 0; z < nzones; ++z) {
+        fs->zone_temp_c[z] = read_sysfs_ull(zone_fd[z], &v) ? (long long)v / 1000.0 : 0.0;
+        if (fs->zone_temp_c[z] > fs->max_temp_c) fs->max_temp_c = fs->zone_temp_c[z];
+        if (fs->zone_trip_c[z] > 0.0 && fs->zone_temp_c[z] >= fs->zone_trip_c[z]) hot = 1;
+    }
+    fs->throttled = fs->throttle_events > 0 || hot;
+}
+
+#if TRACK_PERF
+static long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/*
+ * Opens the counter group for one CPU: the first event leads and the others
+ * join its group, so one read() of the leader returns all of them with a
+ * common time_enabled/time_running. Returns 0, or -1 with errno set.
+ */
+static int perf_open_cpu(int cpu) {
+    struct perf_event_attr attr;
+    for (int e = 0; e < PERF_EVENTS; ++e) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        const struct perf_event_spec *spec = perf_mode == PERF_MODE_HW ? &perf_hw_events[e] : &perf_sw_events[e];
+        if (perf_mode == PERF_MODE_HW && e == PE_LLC_MISSES && perf_use_llc_generic) spec = &perf_llc_generic;
+        attr.type = spec->type;
+        attr.config = spec->config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = e == 0;    // the group starts when the leader is enabled
+        int group = e == 0 ? -1 : perf_fd[cpu][0];
+        int fd = (int)perf_event_open(&attr, -1, cpu, group, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            int err = errno;
+            for (int k = 0; k < e; ++k) close(perf_fd[cpu][k]);
+            perf_fd[cpu][0] = -1;
+            errno = err;
+            return -1;
+        }
+        perf_fd[cpu][e] = fd;
+    }
+    ioctl(perf_fd[cpu][0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    memset(perf_prev[cpu], 0, sizeof(perf_prev[cpu]));
+    return 0;
+}
+
+static void perf_close_cpu(int cpu) {
+    if (perf_fd[cpu][0] < 0) return;
+    for (int e = 0; e < PERF_EVENTS; ++e) close(perf_fd[cpu][e]);
+    perf_fd[cpu][0] = -1;
+}
+
+/*
+ * Picks the counter source on first use: the hardware PMU, or software events
+ * when PERF_SOFTWARE_EVENTS is set or the PMU cannot be opened (most VMs and
+ * containers). A PMU without the LL cache read-miss event counts LLC misses
+ * with the generic cache-misses event. With neither source, perf sampling is
+ * switched off for the run.
+ */
+static void perf_init() {
+    for (int c = 0; c < MAX_CPUS; ++c) perf_fd[c][0] = -1;
+    perf_mode = PERF_SOFTWARE_EVENTS ? PERF_MODE_SW : PERF_MODE_HW;
+    if (perf_open_cpu(0) == 0) {
+        perf_close_cpu(0);
+        return;
+    }
+    if (perf_mode == PERF_MODE_HW) {
+        perf_use_llc_generic = 1;
+        if (perf_open_cpu(0) == 0) {
+            perf_close_cpu(0);
+            write_log("Warning: no LL cache read-miss event, LLC MPKI uses generic cache misses");
+            return;
+        }
+        perf_use_llc_generic = 0;
+        write_log("Warning: hardware performance counters unavailable (%s), using software events", strerror(errno));
+        perf_mode = PERF_MODE_SW;
+        if (perf_open_cpu(0) == 0) {
+            perf_close_cpu(0);
+            return;
+        }
+    }
+    write_log("Warning: perf_event_open failed (%s), performance counters disabled", strerror(errno));
+    perf_mode = PERF_MODE_OFF;
+}
+
+/*
+ * Reads every online CPU's counter group and turns the deltas into per-second
+ * rates, scaled by time_enabled/time_running when the kernel multiplexed the
+ * group. With hardware events this also gives IPC and misses per 1000
+ * instructions. Groups are opened for CPUs as they come online and closed when
+ * a read fails because the CPU went away. A CPU whose group cannot be opened
+ * (EMFILE on a big host) is skipped until it goes offline and back.
+ */
+void get_perf_stats(struct perf_sample *ps, const unsigned char *online, int ncores) {
+    static int initialized = 0;
+    static struct timespec prev_ts;
+    if (!initialized) {
+        perf_init();
+        initialized = 1;
+    }
+    memset(ps, 0, sizeof(*ps));
+    ps->mode = perf_mode;
+    if (perf_mode == PERF_MODE_OFF) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double secs = (now.tv_sec - prev_ts.tv_sec) + (now.tv_nsec - prev_ts.tv_nsec) / 1e9;
+    prev_ts = now;
+    double total[PERF_EVENTS] = {0};
+    for (int c = 0; c < ncores && c < MAX_CPUS; ++c) {
+        if (!online[c]) {
+            perf_close_cpu(c);
+            perf_failed[c] = 0;
+            continue;
+        }
+        if (perf_failed[c]) continue;
+        if (perf_fd[c][0] < 0 && perf_open_cpu(c) != 0) {
+            write_log("Warning: perf counters unavailable on CPU %d (%s), not retrying", c, strerror(errno));
+            perf_failed[c] = 1;
+            continue;
+        }
+        // nr, time_enabled, time_running, then one value per event
+        unsigned long long buf[3 + PERF_EVENTS];
+        if (read(perf_fd[c][0], buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[0] != PERF_EVENTS) {
+            perf_close_cpu(c);
+            continue;
+        }
+        unsigned long long enabled = buf[1], running = buf[2];
+        unsigned long long *prev = perf_prev[c];
+        // prev[0..1] hold time_enabled/time_running, prev[2..] the raw counts
+        if (prev[0] != 0 && secs > 0.0 && enabled > prev[0]) {
+            double d_running = (double)(running - prev[1]);
+            double scale = d_running > 0.0 ? (enabled - prev[0]) / d_running : 0.0;
+            for (int e = 0; e < PERF_EVENTS; ++e) {
+                double d = (double)(buf[3 + e] - prev[2 + e]) * scale;
+                ps->rate[c][e] = d / secs;
+                total[e] += d;
+            }
+            ps->ncpus++;
+            const double *r = ps->rate[c];
+            if (perf_mode == PERF_MODE_HW && r[PE_INSTRUCTIONS] > 0.0) {
+                ps->ipc[c] = r[PE_CYCLES] > 0.0 ? r[PE_INSTRUCTIONS] / r[PE_CYCLES] : 0.0;
+                ps->llc_mpki[c] = r[PE_LLC_MISSES] * 1000.0 / r[PE_INSTRUCTIONS];
+                ps->branch_mpki[c] = r[PE_BRANCH_MISSES] * 1000.0 / r[PE_INSTRUCTIONS];
+            }
+        }
+        prev[0] = enabled;
+        prev[1] = running;
+        for (int e = 0; e < PERF_EVENTS; ++e) prev[2 + e] = buf[3 + e];
+    }
+    if (ps->ncpus > 0 && secs > 0.0) {
+        for (int e = 0; e < PERF_EVENTS; ++e) ps->total_rate[e] = total[e] / secs;
+        if (perf_mode == PERF_MODE_HW && total[PE_INSTRUCTIONS] > 0.0) {
+            ps->total_ipc = total[PE_CYCLES] > 0.0 ? total[PE_INSTRUCTIONS] / total[PE_CYCLES] : 0.0;
+            ps->total_llc_mpki = total[PE_LLC_MISSES] * 1000.0 / total[PE_INSTRUCTIONS];
+            ps->total_branch_mpki = total[PE_BRANCH_MISSES] * 1000.0 / total[PE_INSTRUCTIONS];
+        }
+    }
+}
+
+void perf_close() {
+    for (int c = 0; c < MAX_CPUS && perf_mode != PERF_MODE_OFF; ++c) perf_close_cpu(c);
+}
+
+// one-line summary for the UI and log
+const char *perf_summary(const struct perf_sample *ps) {
+    static char buf[256];
+    const double *t = ps->total_rate;
+    if (ps->mode == PERF_MODE_HW) {
+        snprintf(buf, sizeof(buf), "IPC %.2f | LLC MPKI %.2f | Branch MPKI %.2f | Cycles %.2fG/s | Instructions %.2fG/s",
+                 ps->total_ipc, ps->total_llc_mpki, ps->total_branch_mpki, t[PE_CYCLES] / 1e9, t[PE_INSTRUCTIONS] / 1e9);
+    } else if (ps->mode == PERF_MODE_SW) {
+        snprintf(buf, sizeof(buf), "software events | cpu-clock %.0f ms/s | ctx switches %.0f/s | page faults %.0f/s | migrations %.0f/s",
+                 t[PE_CYCLES] / 1e6, t[PE_INSTRUCTIONS], t[PE_LLC_MISSES], t[PE_BRANCH_MISSES]);
+    } else {
+        snprintf(buf, sizeof(buf), "unavailable");
+    }
+    return buf;
+}
+#else
+void get_perf_stats(struct perf_sample *ps, const unsigned char *online, int ncores) { memset(ps, 0, sizeof(*ps)); }
+void perf_close() {}
+const char *perf_summary(const struct perf_sample *ps) { return "disabled"; }
+#endif
+
+#if PROFILE_ON_ALERT
+/*
+ * On-CPU stack profiler started by a CPU alert: cpu-clock sampling with
+ * callchains on every online CPU for PROFILE_SECONDS. Each tick drains the
+ * per-CPU rings into a trie of frames (root, then process, then outermost
+ * frame down to the leaf), so repeated stacks cost no memory. When the time
+ * is up the trie is written as folded stacks, one "comm;frame;...;leaf count"
+ * line per distinct stack, ready for flamegraph.pl or speedscope.
+ * Overhead is bounded by the fixed sampling rate and duration, the node pool,
+ * and the cooldown between two profiles.
+ */
+struct profile_node {
+    unsigned long long ip;         // frame address; for process nodes an index into profile_comm
+    unsigned int child, sibling;   // first child and next sibling, 0 for none (node 0 is the root)
+    unsigned int count;            // samples whose stack ends here
+};
+static struct profile_node profile_nodes[PROFILE_MAX_NODES];
+static unsigned int profile_nnodes;
+static int profile_pid[PROFILE_MAX_PIDS];
+static char profile_comm[PROFILE_MAX_PIDS][16];
+static int profile_npids;
+static int profile_fd[MAX_CPUS];
+static void *profile_ring[MAX_CPUS];
+static size_t profile_ring_bytes;
+static int profile_active = 0;
+static char profile_reason[32];
+static struct timespec profile_started, profile_ended;
+static unsigned long long profile_samples, profile_lost, profile_dropped, profile_idle;
+
+// returns the child of parent with this ip, adding it when insert is set; 0 when absent or the pool is full
+static unsigned int profile_child(unsigned int parent, unsigned long long ip, int insert) {
+    unsigned int *link = &profile_nodes[parent].child;
+    for (unsigned int n = *link; n; n = profile_nodes[n].sibling) {
+        if (profile_nodes[n].ip == ip) return n;
+    }
+    if (!insert || profile_nnodes >= PROFILE_MAX_NODES) return 0;
+    unsigned int n = profile_nnodes++;
+    profile_nodes[n].ip = ip;
+    profile_nodes[n].child = 0;
+    profile_nodes[n].count = 0;
+    profile_nodes[n].sibling = *link;
+    *link = n;
+    return n;
+}
+
+// process index for pid, reading its comm the first time it is sampled
+static int profile_process(int pid) {
+    for (int i = profile_npids - 1; i >= 0; --i) {
+        if (profile_pid[i] == pid) return i;
+    }
+    if (profile_npids >= PROFILE_MAX_PIDS) return -1;
+    int i = profile_npids++;
+    char path[64], buf[32];
+    int fd = -1;
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    ssize_t n = pread_file(&fd, path, buf, sizeof(buf));
+    if (fd >= 0) close(fd);
+    while (n > 0 && buf[n - 1] == '\n') buf[--n] = '\0';
+    if (n > 0) snprintf(profile_comm[i], sizeof(profile_comm[i]), "%.15s", buf);
+    else snprintf(profile_comm[i], sizeof(profile_comm[i]), "pid-%d", pid);
+    profile_pid[i] = pid;
+    return i;
+}
+
+// adds one leaf-first callchain to the trie, outermost frame first
+static void profile_add(int pid, const unsigned long long *ips, unsigned long long nr) {
+    profile_samples++;
+    if (pid == 0) {
+        profile_idle++;            // the idle task; not useful in an on-CPU profile
+        return;
+    }
+    int p = profile_process(pid);
+    unsigned int node = p < 0 ? 0 : profile_child(0, (unsigned long long)p, 1);
+    if (!node) {
+        profile_dropped++;
+        return;
+    }
+    for (unsigned long long i = nr; i-- > 0;) {
+        if (ips[i] >= PERF_CONTEXT_MAX) continue; // PERF_CONTEXT_KERNEL/USER markers
+        unsigned int next = profile_child(node, ips[i], 1);
+        if (!next) {
+            profile_dropped++;     // pool full: charge the sample to the deepest frame we have
+            break;
+        }
+        node = next;
+    }
+    profile_nodes[node].count++;
+}
+
+// consumes every complete record in one CPU's ring
+static void profile_drain(int cpu) {
+    struct perf_event_mmap_page *meta = profile_ring[cpu];
+    const unsigned char *data = (const unsigned char *)profile_ring[cpu] + sysconf(_SC_PAGESIZE);
+    size_t mask = profile_ring_bytes - 1;
+    unsigned long long head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    unsigned long long tail = meta->data_tail;
+    static unsigned long long rec[8 + PROFILE_MAX_DEPTH + 64]; // one record, unwrapped
+    while (tail < head) {
+        struct perf_event_header hdr;
+        for (size_t b = 0; b < sizeof(hdr); ++b) ((unsigned char *)&hdr)[b] = data[(tail + b) & mask];
+        if (hdr.size < sizeof(hdr) || tail + hdr.size > head) break;
+        if (hdr.size <= sizeof(rec)) {
+            size_t off = tail & mask, first = profile_ring_bytes - off;
+            if (first >= hdr.size) memcpy(rec, data + off, hdr.size);
+            else {
+                memcpy(rec, data + off, first);
+                memcpy((unsigned char *)rec + first, data, hdr.size - first);
+            }
+            // PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN: header, pid/tid, nr, ips[nr]
+            if (hdr.type == PERF_RECORD_SAMPLE && hdr.size >= 24) {
+                int pid = (int)(rec[1] & 0xffffffffu);
+                unsigned long long nr = rec[2];
+                if (24 + nr * 8 <= hdr.size) profile_add(pid, rec + 3, nr);
+            } else if (hdr.type == PERF_RECORD_LOST && hdr.size >= 24) {
+                profile_lost += rec[2];
+            }
+        } else {
+            profile_dropped++;
+        }
+        tail += hdr.size;
+    }
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void profile_stop_sampling() {
+    for (int c = 0; c < MAX_CPUS; ++c) {
+        if (profile_fd[c] < 0) continue;
+        ioctl(profile_fd[c], PERF_EVENT_IOC_DISABLE, 0);
+        profile_drain(c);
+        munmap(profile_ring[c], profile_ring_bytes + sysconf(_SC_PAGESIZE));
+        close(profile_fd[c]);
+        profile_fd[c] = -1;
+    }
+}
+
+/*
+ * Starts a profile on every online CPU unless one is running or the last one
+ * ended less than PROFILE_COOLDOWN_S ago. reason is recorded in the log.
+ */
+void profile_start(const char *reason, const unsigned char *online, int ncores) {
+    static int initialized = 0, disabled = 0;
+    if (!initialized) {
+        for (int c = 0; c < MAX_CPUS; ++c) profile_fd[c] = -1;
+        initialized = 1;
+    }
+    if (profile_active || disabled) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (profile_ended.tv_sec != 0 && now.tv_sec - profile_ended.tv_sec < PROFILE_COOLDOWN_S) return;
+
+    long page = sysconf(_SC_PAGESIZE);
+    profile_ring_bytes = (size_t)page * PROFILE_RING_PAGES;
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK; // works without a PMU, unlike cycles
+    attr.freq = 1;
+    attr.sample_freq = PROFILE_FREQ;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+    attr.sample_max_stack = PROFILE_MAX_DEPTH;
+    attr.disabled = 1;
+    int opened = 0, err = 0;
+    for (int c = 0; c < ncores && c < MAX_CPUS; ++c) {
+        if (!online[c]) continue;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, -1, c, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        void *ring = mmap(NULL, profile_ring_bytes + page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ring == MAP_FAILED) {
+            err = errno;
+            close(fd);
+            continue;
+        }
+        profile_fd[c] = fd;
+        profile_ring[c] = ring;
+        opened++;
+    }
+    if (opened == 0) {
+        // most likely perf_event_paranoid or a missing capability; do not retry every alert
+        write_log("Warning: alert profiler unavailable (%s), disabled", strerror(err));
+        disabled = 1;
+        return;
+    }
+
+    profile_nnodes = 1;
+    memset(&profile_nodes[0], 0, sizeof(profile_nodes[0]));
+    profile_npids = 0;
+    profile_samples = profile_lost = profile_dropped = profile_idle = 0;
+    snprintf(profile_reason, sizeof(profile_reason), "%s", reason);
+    for (int c = 0; c < MAX_CPUS; ++c) {
+        if (profile_fd[c] >= 0) ioctl(profile_fd[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    profile_started = now;
+    profile_active = 1;
+    write_log("Profile: sampling stacks on %d CPUs at %d Hz for %d s (%s alert)", opened, PROFILE_FREQ,
+              PROFILE_SECONDS, reason);
+}
+
+// kernel text symbols from /proc/kallsyms, sorted by address; loaded only to write a profile
+struct ksym {
+    unsigned long long addr;
+    const char *name;
+};
+static struct ksym *ksyms;
+static size_t nksyms;
+static char *ksym_names;
+
+static int ksym_cmp(const void *a, const void *b) {
+    unsigned long long x = ((const struct ksym *)a)->addr, y = ((const struct ksym *)b)->addr;
+    return x < y ? -1 : x > y;
+}
+
+static void ksyms_load() {
+    FILE *fp = fopen("/proc/kallsyms", "r");
+    if (!fp) return;
+    size_t cap = 0, names_cap = 0, names_len = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long long addr;
+        char type, name[256];
+        if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3 || addr == 0) continue;
+        if (type != 't' && type != 'T') continue;
+        size_t len = strlen(name) + 1;
+        if (nksyms == cap) {
+            cap = cap ? cap * 2 : 65536;
+            struct ksym *grown = realloc(ksyms, cap * sizeof(*ksyms));
+            if (!grown) break;
+            ksyms = grown;
+        }
+        if (names_len + len > names_cap) {
+            names_cap = names_cap ? names_cap * 2 : 4 * 1024 * 1024;
+            char *grown = realloc(ksym_names, names_cap);
+            if (!grown) break;
+            ksym_names = grown;
+        }
+        memcpy(ksym_names + names_len, name, len);
+        ksyms[nksyms].addr = addr;
+        ksyms[nksyms++].name = (const char *)names_len; // offset until the blob stops moving
+        names_len += len;
+    }
+    fclose(fp);
+    for (size_t i = 0; i < nksyms; ++i) ksyms[i].name = ksym_names + (size_t)ksyms[i].name;
+    qsort(ksyms, nksyms, sizeof(*ksyms), ksym_cmp);
+}
+
+static void ksyms_free() {
+    free(ksyms);
+    free(ksym_names);
+    ksyms = NULL;
+    ksym_names = NULL;
+    nksyms = 0;
+}
+
+// one process's executable mappings from /proc/<pid>/maps, for user frames
+struct umap {
+    unsigned long long start, end, offset;
+    char name[64];
+};
+static struct umap profile_maps[PROFILE_MAX_MAPS];
+static int profile_nmaps;
+
+static void profile_load_maps(int pid) {
+    char path[64], line[512];
+    profile_nmaps = 0;
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+    while (profile_nmaps < PROFILE_MAX_MAPS && fgets(line, sizeof(line), fp)) {
+        struct umap *m = &profile_maps[profile_nmaps];
+        char perms[8], file[400] = "";
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %399s", &m->start, &m->end, perms, &m->offset, file) < 4) continue;
+        if (perms[2] != 'x') continue;
+        const char *base = strrchr(file, '/');
+        snprintf(m->name, sizeof(m->name), "%.63s", base ? base + 1 : file[0] ? file : "[anon]");
+        profile_nmaps++;
+    }
+    fclose(fp);
+}
+
+// writes a frame name: kernel symbol, module+offset for user code, or the raw address
+static void profile_frame(FILE *out, unsigned long long ip) {
+    if (ip >= 0x8000000000000000ULL) {
+        size_t lo = 0, hi = nksyms;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (ksyms[mid].addr <= ip) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo > 0) fprintf(out, "%s_[k]", ksyms[lo - 1].name);
+        else fprintf(out, "0x%llx_[k]", ip);
+        return;
+    }
+    for (int i = 0; i < profile_nmaps; ++i) {
+        const struct umap *m = &profile_maps[i];
+        if (ip >= m->start && ip < m->end) {
+            fprintf(out, "%s+0x%llx", m->name, ip - m->start + m->offset);
+            return;
+        }
+    }
+    fprintf(out, "0x%llx", ip);
+}
+
+// depth-first walk printing the path to every node that ends a stack
+static unsigned long long profile_write_folded(FILE *out) {
+    static unsigned int path[PROFILE_MAX_DEPTH + 2];
+    unsigned long long stacks = 0;
+    for (unsigned int p = profile_nodes[0].child; p; p = profile_nodes[p].sibling) {
+        int idx = (int)profile_nodes[p].ip;
+        profile_load_maps(profile_pid[idx]);
+        int depth = 0;
+        path[depth++] = p;
+        unsigned int node = profile_nodes[p].child;
+        if (profile_nodes[p].count) {
+            fprintf(out, "%s %u\n", profile_comm[idx], profile_nodes[p].count);
+            stacks++;
+        }
+        while (depth > 0) {
+            if (node) {
+                path[depth++] = node;
+                if (profile_nodes[node].count) {
+                    fputs(profile_comm[idx], out);
+                    for (int d = 1; d < depth; ++d) {
+                        fputc(';', out);
+                        profile_frame(out, profile_nodes[path[d]].ip);
+                    }
+                    fprintf(out, " %u\n", profile_nodes[node].count);
+                    stacks++;
+                }
+                node = depth < PROFILE_MAX_DEPTH + 2 ? profile_nodes[node].child : 0;
+            } else {
+                // no more children here: move on to the next sibling of the last node on the path
+                node = --depth > 0 ? profile_nodes[path[depth]].sibling : 0;
+            }
+        }
+    }
+    return stacks;
+}
+
+/*
+ * Called once per tick: drains the rings of a running profile, and when
+ * PROFILE_SECONDS have passed stops it and writes
+ * <log name>-profile-<time>.folded next to the log.
+ */
+void profile_tick() {
+    if (!profile_active) return;
+    for (int c = 0; c < MAX_CPUS; ++c) {
+        if (profile_fd[c] >= 0) profile_drain(c);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (keep_running && now.tv_sec - profile_started.tv_sec < PROFILE_SECONDS) return;
+
+    profile_stop_sampling();
+    profile_active = 0;
+    profile_ended = now;
+
+    char path[512], stamp[32];
+    time_t t = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+    const char *ext = strrchr(log_path, '.');
+    int base_len = ext && !strchr(ext, '/') ? (int)(ext - log_path) : (int)strlen(log_path);
+    snprintf(path, sizeof(path), "%.*s-profile-%s.folded", base_len, log_path, stamp);
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        write_log("Warning: could not write profile '%s': %s", path, strerror(errno));
+        return;
+    }
+    ksyms_load();
+    unsigned long long stacks = profile_write_folded(out);
+    ksyms_free();
+    fclose(out);
+    write_log("Profile: wrote %llu stacks from %llu samples (%llu idle, %llu lost, %llu dropped, %u nodes) to %s",
+              stacks, profile_samples, profile_idle, profile_lost, profile_dropped, profile_nnodes, path);
+}
+
+void profile_close() {
+    if (profile_active) profile_stop_sampling();
+    profile_active = 0;
+}
+#else
+void profile_start(const char *reason, const unsigned char *online, int ncores) {}
+void profile_tick() {}
+void profile_close() {}
+#endif
+
+void stats_add(struct stream_stats *st, double x) {
+    if (sketch_log_gamma == 0.0) sketch_log_gamma = log((1.0 + SKETCH_ACCURACY) / (1.0 - SKETCH_ACCURACY));
+    st->ewma = st->count ? st->ewma + STATS_EWMA_ALPHA * (x - st->ewma) : x;
+    st->count++;
+
+    // sliding window: replace the oldest value and adjust the running sums
+    if (st->wcount == STATS_WINDOW) {
+        double old = st->window[st->wpos];
+        st->wsum -= old;
+        st->wsumsq -= old * old;
+    } else {
+        st->wcount++;
+    }
+    st->window[st->wpos] = (float)x;
+    st->wsum += x;
+    st->wsumsq += x * x;
+    if (++st->wpos == STATS_WINDOW) {
+        // recompute once per lap so rounding error in the running sums cannot build up
+        st->wpos = 0;
+        st->wsum = st->wsumsq = 0.0;
+        for (int i = 0; i < st->wcount; ++i) {
+            st->wsum += st->window[i];
+            st->wsumsq += (double)st->window[i] * st->window[i];
+        }
+    }
+
+    if (x < SKETCH_MIN) {
+        st->zero_count++;
+        return;
+    }
+    int b = (int)ceil(log(x / SKETCH_MIN) / sketch_log_gamma);
+    if (b < 0) b = 0;
+    if (b >= SKETCH_BUCKETS) b = SKETCH_BUCKETS - 1;
+    st->buckets[b]++;
+}
+
+double stats_mean(const struct stream_stats *st) {
+    return st->wcount ? st->wsum / st->wcount : 0.0;
+}
+
+double stats_stddev(const struct stream_stats *st) {
+    if (st->wcount < 2) return 0.0;
+    double mean = st->wsum / st->wcount;
+    double var = st->wsumsq / st->wcount - mean * mean;
+    return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+/*
+ * Percentile from the sketch, within SKETCH_ACCURACY of the true value.
+ */
+double stats_quantile(const struct stream_stats *st, double q) {
+    if (st->count == 0) return 0.0;
+    unsigned long long rank = (unsigned long long)(q * (st->count - 1));
+    unsigned long long seen = st->zero_count;
+    if (rank < seen) return 0.0;
+    for (int b = 0; b < SKETCH_BUCKETS; ++b) {
+        seen += st->buckets[b];
+        if (rank < seen) {
+            // bucket b covers (SKETCH_MIN * gamma^(b-1), SKETCH_MIN * gamma^b]
+            double v = SKETCH_MIN * 2.0 * exp(b * sketch_log_gamma) / (1.0 + exp(sketch_log_gamma));
+            return v > 100.0 ? 100.0 : v;
+        }
+    }
+    return 100.0;
+}
+
+void send_udp_alert(const char *message) {
+#if SEND_ALERTS
+    if (udp_sock < 0) return;
+    size_t len = strlen(message);
+    ssize_t sent = sendto(udp_sock, message, len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+    if (sent < 0) {
+        write_log("Warning: UDP send failed: %s", strerror(errno));
+    } else {
+        write_log("Sent UDP alert (%zd bytes): %s", (ssize_t)sent, message);
+    }
+#endif
+}
+
+void alert_reset() {
+    alert_text[0] = '\0';
+}
+
+/*
+ * Logs and forwards one alert as "<timestamp> ALERT <KIND> <value><unit> load a/b/c"
+ * and adds it to the line shown in the UI.
+ */
+void raise_alert(const char *kind, double value, const char *unit, double threshold, const struct cpu_sample *cur) {
+    size_t len = strlen(alert_text);
+    snprintf(alert_text + len, sizeof(alert_text) - len, "%s%s %.2f%s (>= %.1f%s)",
+             len ? "  " : "", kind, value, unit, threshold, unit);
+    // send UDP alert (non-blocking)
+    char alert_msg[512];
+    snprintf(alert_msg, sizeof(alert_msg), "%s ALERT %s %.2f%s load %.2f/%.2f/%.2f",
+             timestamp_now(), kind, value, unit, cur->loadavg1, cur->loadavg5, cur->loadavg15);
+    write_log("ALERT triggered: %s", alert_msg);
+    send_udp_alert(alert_msg);
+}
+
+const char* timestamp_now() {
+    static char buf[64];
+    struct timeval tv;
+    sample_wall(&tv);
+    // localtime_r: glibc's localtime() re-checks the time zone file on every call
+    struct tm tm;
+    localtime_r(&tv.tv_sec, &tm);
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03ld",
+             tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, tv.tv_usec/1000);
+    return buf;
+}
+
+#if ENABLE_METRICS_HTTP
+void metrics_open() {
+    for (int i = 0; i < METRICS_MAX_CLIENTS; ++i) metrics_clients[i].fd = -1;
+    metrics_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (metrics_sock < 0) {
+        fprintf(stderr, "Warning: could not create metrics socket: %s\n", strerror(errno));
+        return;
+    }
+    int one = 1;
+    setsockopt(metrics_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(METRICS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(metrics_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(metrics_sock, 64) != 0) {
+        fprintf(stderr, "Warning: could not listen on metrics port %d: %s\n", METRICS_PORT, strerror(errno));
+        close(metrics_sock);
+        metrics_sock = -1;
+        return;
+    }
+    write_log("Serving metrics on http://0.0.0.0:%d/metrics", METRICS_PORT);
+}
+
+static void metrics_drop_client(struct metrics_client *c) {
+    if (c->buf >= 0) metrics_refs[c->buf]--;
+    close(c->fd);
+    c->fd = -1;
+    c->buf = -1;
+}
+
+void metrics_close() {
+    for (int i = 0; i < METRICS_MAX_CLIENTS; ++i) {
+        if (metrics_clients[i].fd >= 0) metrics_drop_client(&metrics_clients[i]);
+    }
+    if (metrics_sock >= 0) close(metrics_sock);
+    metrics_sock = -1;
+}
+
+/*
+ * Renders the full HTTP response for the current sample into the back buffer
+ * and flips it to the front. The body is written first at a fixed offset and
+ * the header is then placed directly in front of it, so the response is one
+ * contiguous block.
+ */
+void metrics_render(const struct cpu_sample *cur) {
+    if (metrics_sock < 0) return;
+    int back = metrics_front == 0 ? 1 : 0;
+    // a client still sending this buffer from two samples ago is too slow to keep
+    if (metrics_refs[back] > 0) {
+        for (int i = 0; i < METRICS_MAX_CLIENTS; ++i) {
+            if (metrics_clients[i].fd >= 0 && metrics_clients[i].buf == back) metrics_drop_client(&metrics_clients[i]);
+        }
+    }
+
+    const size_t hdr_reserve = 256;
+    char *body = metrics_buf[back] + hdr_reserve;
+    size_t cap = METRICS_BUF_BYTES - hdr_reserve, n = 0;
+#define EMIT(...) do { if (n < cap) n += snprintf(body + n, cap - n, __VA_ARGS__); } while (0)
+    EMIT("# HELP cpu_monitor_usage_percent Aggregate CPU usage over the last sample interval.\n"
+         "# TYPE cpu_monitor_usage_percent gauge\n"
+         "cpu_monitor_usage_percent %.2f\n", cur->usage);
+    EMIT("# HELP cpu_monitor_core_usage_percent Per-core CPU usage over the last sample interval.\n"
+         "# TYPE cpu_monitor_core_usage_percent gauge\n");
+    for (int c = 0; c < cur->ncores; ++c) {
+        if (cur->core_online[c]) EMIT("cpu_monitor_core_usage_percent{cpu=\"%d\"} %.2f\n", c, cur->core_usage[c]);
+    }
+    EMIT("# HELP cpu_monitor_cpu_time_percent Share of the last sample interval spent in each CPU state.\n"
+         "# TYPE cpu_monitor_cpu_time_percent gauge\n");
+    for (int r = 0; r <= cur->ncores; ++r) {
+        char cpu[16];
+        if (r == 0) snprintf(cpu, sizeof(cpu), "all");
+        else snprintf(cpu, sizeof(cpu), "%d", r - 1);
+        for (int f = 0; f < CPU_TIME_FIELDS; ++f) {
+            EMIT("cpu_monitor_cpu_time_percent{cpu=\"%s\",mode=\"%s\"} %.2f\n", cpu, cpu_time_names[f], cur->breakdown[r][f]);
+        }
+    }
+    EMIT("# HELP cpu_monitor_max_usage_percent Highest aggregate CPU usage observed.\n"
+         "# TYPE cpu_monitor_max_usage_percent gauge\n"
+         "cpu_monitor_max_usage_percent %.2f\n", cur->max_usage);
+    EMIT("# HELP cpu_monitor_min_usage_percent Lowest aggregate CPU usage observed.\n"
+         "# TYPE cpu_monitor_min_usage_percent gauge\n"
+         "cpu_monitor_min_usage_percent %.2f\n", cur->min_usage);
+    EMIT("# HELP cpu_monitor_load_average System load average.\n"
+         "# TYPE cpu_monitor_load_average gauge\n"
+         "cpu_monitor_load_average{period=\"1m\"} %.2f\n"
+         "cpu_monitor_load_average{period=\"5m\"} %.2f\n"
+         "cpu_monitor_load_average{period=\"15m\"} %.2f\n", cur->loadavg1, cur->loadavg5, cur->loadavg15);
+    EMIT("# HELP cpu_monitor_uptime_seconds System uptime.\n"
+         "# TYPE cpu_monitor_uptime_seconds gauge\n"
+         "cpu_monitor_uptime_seconds %.2f\n", cur->uptime);
+    static const char *const net_metrics[8] = {
+        "receive_bytes", "transmit_bytes", "receive_packets", "transmit_packets",
+        "receive_drops", "transmit_drops", "receive_errors", "transmit_errors"
+    };
+    for (int m = 0; m < 8 && cur->nnets > 0; ++m) {
+        EMIT("# HELP cpu_monitor_net_%s_per_second Network interface rate from /proc/net/dev.\n"
+             "# TYPE cpu_monitor_net_%s_per_second gauge\n", net_metrics[m], net_metrics[m]);
+        for (int i = 0; i < cur->nnets; ++i) {
+            const struct net_rate *nr = &cur->nets[i];
+            double v[8] = { nr->rx_bytes, nr->tx_bytes, nr->rx_packets, nr->tx_packets,
+                            nr->rx_drops, nr->tx_drops, nr->rx_errors, nr->tx_errors };
+            EMIT("cpu_monitor_net_%s_per_second{iface=\"%s\"} %.2f\n", net_metrics[m], nr->name, v[m]);
+        }
+    }
+    EMIT("# HELP cpu_monitor_procs_running Runnable tasks.\n"
+         "# TYPE cpu_monitor_procs_running gauge\n"
+         "cpu_monitor_procs_running %llu\n"
+         "# HELP cpu_monitor_procs_blocked Tasks blocked on I/O.\n"
+         "# TYPE cpu_monitor_procs_blocked gauge\n"
+         "cpu_monitor_procs_blocked %llu\n", cur->sched.procs_running, cur->sched.procs_blocked);
+    EMIT("# HELP cpu_monitor_context_switches_per_second Context switch rate.\n"
+         "# TYPE cpu_monitor_context_switches_per_second gauge\n"
+         "cpu_monitor_context_switches_per_second %.0f\n"
+         "# HELP cpu_monitor_interrupts_per_second Interrupt rate.\n"
+         "# TYPE cpu_monitor_interrupts_per_second gauge\n"
+         "cpu_monitor_interrupts_per_second %.0f\n"
+         "# HELP cpu_monitor_forks_per_second Process creation rate.\n"
+         "# TYPE cpu_monitor_forks_per_second gauge\n"
+         "cpu_monitor_forks_per_second %.2f\n", cur->sched.ctxt_rate, cur->sched.intr_rate, cur->sched.fork_rate);
+    EMIT("# HELP cpu_monitor_runqueue_delay_ms Average wait on a run queue per timeslice.\n"
+         "# TYPE cpu_monitor_runqueue_delay_ms gauge\n"
+         "cpu_monitor_runqueue_delay_ms{cpu=\"all\"} %.3f\n", cur->sched.runq_delay_ms);
+    for (int c = 0; c < cur->ncores; ++c) {
+        if (cur->core_online[c]) EMIT("cpu_monitor_runqueue_delay_ms{cpu=\"%d\"} %.3f\n", c, cur->sched.core_runq_delay_ms[c]);
+    }
+    EMIT("# HELP cpu_monitor_physical_core_usage_percent Usage per physical core, mean of its SMT threads.\n"
+         "# TYPE cpu_monitor_physical_core_usage_percent gauge\n");
+    for (int k = 0; k < topo.ncores; ++k) EMIT("cpu_monitor_physical_core_usage_percent{core=\"%d\"} %.2f\n", k, cur->topo.core_usage[k]);
+    EMIT("# HELP cpu_monitor_socket_usage_percent Usage per socket.\n"
+         "# TYPE cpu_monitor_socket_usage_percent gauge\n");
+    for (int k = 0; k < topo.nsockets; ++k) EMIT("cpu_monitor_socket_usage_percent{socket=\"%d\"} %.2f\n", topo.socket_id[k], cur->topo.socket_usage[k]);
+    EMIT("# HELP cpu_monitor_numa_node_usage_percent Usage per NUMA node.\n"
+         "# TYPE cpu_monitor_numa_node_usage_percent gauge\n");
+    for (int k = 0; k < topo.nnodes; ++k) EMIT("cpu_monitor_numa_node_usage_percent{node=\"%d\"} %.2f\n", topo.node_id[k], cur->topo.node_usage[k]);
+    EMIT("# HELP cpu_monitor_numa_imbalance_percent Usage spread between the busiest and idlest NUMA node.\n"
+         "# TYPE cpu_monitor_numa_imbalance_percent gauge\n"
+         "cpu_monitor_numa_imbalance_percent %.2f\n", cur->topo.node_imbalance);
+    if (cur->freq.ncpus > 0) {
+        EMIT("# HELP cpu_monitor_cpu_frequency_mhz Current clock frequency per CPU.\n"
+             "# TYPE cpu_monitor_cpu_frequency_mhz gauge\n");
+        for (int c = 0; c < cur->ncores; ++c) {
+            if (cur->core_online[c]) EMIT("cpu_monitor_cpu_frequency_mhz{cpu=\"%d\"} %.0f\n", c, cur->freq.cur_mhz[c]);
+        }
+    }
+    EMIT("# HELP cpu_monitor_frequency_weighted_usage_percent Per-core usage scaled by current/maximum frequency, averaged.\n"
+         "# TYPE cpu_monitor_frequency_weighted_usage_percent gauge\n"
+         "cpu_monitor_frequency_weighted_usage_percent %.2f\n"
+         "# HELP cpu_monitor_throttled Whether CPUs were thermally throttled this interval.\n"
+         "# TYPE cpu_monitor_throttled gauge\n"
+         "cpu_monitor_throttled %d\n", cur->freq.weighted_usage, cur->freq.throttled);
+    if (cur->freq.nzones > 0) {
+        EMIT("# HELP cpu_monitor_thermal_zone_celsius Thermal zone temperature.\n"
+             "# TYPE cpu_monitor_thermal_zone_celsius gauge\n");
+        for (int z = 0; z < cur->freq.nzones; ++z) {
+            EMIT("cpu_monitor_thermal_zone_celsius{zone=\"%d\",type=\"%s\"} %.1f\n", z, cur->freq.zone_type[z], cur->freq.zone_temp_c[z]);
+        }
+    }
+    if (cur->perf.mode == PERF_MODE_HW && cur->perf.ncpus > 0) {
+        EMIT("# HELP cpu_monitor_ipc Instructions per cycle.\n"
+             "# TYPE cpu_monitor_ipc gauge\n"
+             "cpu_monitor_ipc{cpu=\"all\"} %.3f\n", cur->perf.total_ipc);
+        for (int c = 0; c < cur->ncores; ++c) {
+            if (cur->core_online[c]) EMIT("cpu_monitor_ipc{cpu=\"%d\"} %.3f\n", c, cur->perf.ipc[c]);
+        }
+        EMIT("# HELP cpu_monitor_llc_mpki Last-level cache misses per 1000 instructions.\n"
+             "# TYPE cpu_monitor_llc_mpki gauge\n"
+             "cpu_monitor_llc_mpki{cpu=\"all\"} %.3f\n", cur->perf.total_llc_mpki);
+        for (int c = 0; c < cur->ncores; ++c) {
+            if (cur->core_online[c]) EMIT("cpu_monitor_llc_mpki{cpu=\"%d\"} %.3f\n", c, cur->perf.llc_mpki[c]);
+        }
+        EMIT("# HELP cpu_monitor_branch_mpki Branch misses per 1000 instructions.\n"
+             "# TYPE cpu_monitor_branch_mpki gauge\n"
+             "cpu_monitor_branch_mpki{cpu=\"all\"} %.3f\n", cur->perf.total_branch_mpki);
+        for (int c = 0; c < cur->ncores; ++c) {
+            if (cur->core_online[c]) EMIT("cpu_monitor_branch_mpki{cpu=\"%d\"} %.3f\n", c, cur->perf.branch_mpki[c]);
+        }
+    } else if (cur->perf.mode == PERF_MODE_SW && cur->perf.ncpus > 0) {
+        static const char *sw_names[PERF_EVENTS] = { "cpu_clock_ns", "context_switches", "page_faults", "cpu_migrations" };
+        EMIT("# HELP cpu_monitor_perf_software_events_per_second Software perf events, used when the PMU is unavailable.\n"
+             "# TYPE cpu_monitor_perf_software_events_per_second gauge\n");
+        for (int e = 0; e < PERF_EVENTS; ++e) {
+            EMIT("cpu_monitor_perf_software_events_per_second{event=\"%s\"} %.0f\n", sw_names[e], cur->perf.total_rate[e]);
+        }
+    }
+#if TRACK_INTERRUPTS
+    EMIT("# HELP cpu_monitor_cpu_interrupts_per_second Hardware interrupts handled per CPU.\n"
+         "# TYPE cpu_monitor_cpu_interrupts_per_second gauge\n");
+    for (int c = 0; c < irq_hw.ncols; ++c) EMIT("cpu_monitor_cpu_interrupts_per_second{cpu=\"%d\"} %.0f\n", irq_hw.col_cpu[c], irq_hw.col_rate[c]);
+    EMIT("# HELP cpu_monitor_cpu_softirqs_per_second Softirqs handled per CPU.\n"
+         "# TYPE cpu_monitor_cpu_softirqs_per_second gauge\n");
+    for (int c = 0; c < irq_soft.ncols; ++c) EMIT("cpu_monitor_cpu_softirqs_per_second{cpu=\"%d\"} %.0f\n", irq_soft.col_cpu[c], irq_soft.col_rate[c]);
+    EMIT("# HELP cpu_monitor_softirqs_per_second Softirqs per type, all CPUs.\n"
+         "# TYPE cpu_monitor_softirqs_per_second gauge\n");
+    for (int r = 0; r < irq_soft.nrows; ++r) EMIT("cpu_monitor_softirqs_per_second{type=\"%s\"} %.0f\n", irq_soft.name[r], irq_soft.row_rate[r]);
+    EMIT("# HELP cpu_monitor_softirq_top_cpu_share_percent Share of each softirq type handled by its busiest CPU.\n"
+         "# TYPE cpu_monitor_softirq_top_cpu_share_percent gauge\n");
+    for (int r = 0; r < irq_soft.nrows; ++r) EMIT("cpu_monitor_softirq_top_cpu_share_percent{type=\"%s\"} %.1f\n", irq_soft.name[r], irq_row_share(&irq_soft, r));
+#endif
+    EMIT("# HELP cpu_monitor_alert Whether aggregate usage is at or above the alert threshold.\n"
+         "# TYPE cpu_monitor_alert gauge\n"
+         "cpu_monitor_alert %d\n", cur->alert);
+    EMIT("# HELP cpu_monitor_samples_total Samples taken since start.\n"
+         "# TYPE cpu_monitor_samples_total counter\n"
+         "cpu_monitor_samples_total %lu\n", cur->cycle + 1);
+#undef EMIT
+    if (n >= cap) n = cap - 1; // truncated; still a well-formed response
+
+    char hdr[256];
+    int hlen = snprintf(hdr, sizeof(hdr),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n", n);
+    metrics_off[back] = hdr_reserve - hlen;
+    memcpy(metrics_buf[back] + metrics_off[back], hdr, hlen);
+    metrics_len[back] = hlen + n;
+    metrics_front = back;
+}
+
+static void metrics_accept(void *arg, short revents) {
+    for (;;) {
+        int fd = accept4(metrics_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        struct metrics_client *slot = NULL;
+        for (int i = 0; i < METRICS_MAX_CLIENTS; ++i) {
+            if (metrics_clients[i].fd < 0) { slot = &metrics_clients[i]; break; }
+        }
+        if (!slot) {
+            close(fd);
+            continue;
+        }
+        slot->fd = fd;
+        slot->buf = -1;
+        slot->sent = 0;
+        slot->req_len = 0;
+    }
+}
+
+// Sends what the socket will take; drops the client once the response is out.
+static void metrics_send(struct metrics_client *c) {
+    const char *base = metrics_buf[c->buf] + metrics_off[c->buf];
+    size_t len = metrics_len[c->buf];
+    ssize_t w = send(c->fd, base + c->sent, len - c->sent, MSG_NOSIGNAL);
+    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (w <= 0 || (c->sent += w) == len) metrics_drop_client(c);
+}
+
+static void metrics_read(struct metrics_client *c) {
+    ssize_t r = read(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (r <= 0) {
+        metrics_drop_client(c);
+        return;
+    }
+    c->req_len += r;
+    c->req[c->req_len] = '\0';
+    if (!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n")) {
+        if (c->req_len == sizeof(c->req) - 1) metrics_drop_client(c);
+        return;
+    }
+    if (metrics_front < 0 || (strncmp(c->req, "GET /metrics ", 13) != 0 && strncmp(c->req, "GET / ", 6) != 0)) {
+        static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        ssize_t ignored = send(c->fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+        (void)ignored;
+        metrics_drop_client(c);
+        return;
+    }
+    c->buf = metrics_front;
+    c->sent = 0;
+    metrics_refs[c->buf]++;
+    metrics_send(c);
+}
+static void metrics_client_ready(void *arg, short revents) {
+    struct metrics_client *c = arg;
+    if (c->fd < 0) return;
+    if (c->buf >= 0) metrics_send(c);
+    else metrics_read(c);
+}
+
+void metrics_poll_fds() {
+    if (metrics_sock < 0) return;
+    add_poll_fd(metrics_sock, POLLIN, metrics_accept, NULL);
+    for (int i = 0; i < METRICS_MAX_CLIENTS; ++i) {
+        struct metrics_client *c = &metrics_clients[i];
+        if (c->fd >= 0) add_poll_fd(c->fd, c->buf >= 0 ? POLLOUT : POLLIN, metrics_client_ready, c);
+    }
+}
+#else
+void metrics_open() {}
+void metrics_close() {}
+void metrics_render(const struct cpu_sample *cur) {}
+void metrics_poll_fds() {}
+#endif
+
+#if PUBLISH_SHM
+/*
+ * Claims an existing ring whose writer has died, by swapping its writer_pid
+ * for ours, so of several monitors starting at once only one takes it over.
+ * A ring without its magic is still being set up by another monitor, so it is
+ * waited for, never taken. Returns the ring's fd, or -1 after a warning.
+ */
+static int shm_claim_stale() {
+    for (int tries = 0; tries < SHM_SETUP_WAIT_TRIES; ++tries) {
+        if (tries) usleep(10000);
+        int fd = shm_open(CPU_SHM_NAME, O_RDWR, 0);
+        if (fd < 0) {
+            // its owner removed it in the meantime
+            if (errno == ENOENT) fd = shm_open(CPU_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (fd >= 0 || errno != EEXIST) return fd;
+            continue;
+        }
+        struct stat st;
+        struct cpu_shm_header *h = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*h))
+            h = mmap(NULL, sizeof(*h), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (h == MAP_FAILED || __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != CPU_SHM_MAGIC) {
+            if (h != MAP_FAILED) munmap(h, sizeof(*h));
+            close(fd);
+            continue;
+        }
+        uint64_t pid = __atomic_load_n(&h->writer_pid, __ATOMIC_ACQUIRE);
+        int live = pid > 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+        int won = !live && __atomic_compare_exchange_n(&h->writer_pid, &pid, (uint64_t)getpid(), 0,
+                                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        munmap(h, sizeof(*h));
+        if (won) return fd;
+        close(fd);
+        fprintf(stderr, "Warning: shared memory '%s' is in use by pid %d, not publishing samples\n", CPU_SHM_NAME, (int)pid);
+        errno = EEXIST;
+        return -1;
+    }
+    fprintf(stderr, "Warning: shared memory '%s' was never set up by its creator; remove /dev/shm%s to publish samples\n",
+            CPU_SHM_NAME, CPU_SHM_NAME);
+    errno = EEXIST;
+    return -1;
+}
+
+/*
+ * Creates the ring exclusively, so a second monitor cannot reset and share
+ * the ring of a live one. A ring left behind by a monitor that died is
+ * taken over in place.
+ */
+void shm_publish_open() {
+    int fd = shm_open(CPU_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        fd = shm_claim_stale();
+        if (fd < 0 && errno == EEXIST) return; // already warned
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Warning: could not create shared memory '%s': %s\n", CPU_SHM_NAME, strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, sizeof(struct cpu_shm_header)) != 0) {
+        fprintf(stderr, "Warning: could not size shared memory: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    void *p = mmap(NULL, sizeof(struct cpu_shm_header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Warning: could not map shared memory: %s\n", strerror(errno));
+        return;
+    }
+    shm_hdr = p;
+    // a taken-over ring is reset too; readers see it as not ready until the magic is back
+    __atomic_store_n(&shm_hdr->magic, 0, __ATOMIC_RELEASE);
+    memset(shm_hdr, 0, sizeof(*shm_hdr));
+    shm_hdr->version = CPU_SHM_VERSION;
+    shm_hdr->slots = CPU_SHM_SLOTS;
+    shm_hdr->max_cpus = CPU_SHM_MAX_CPUS;
+    shm_hdr->writer_pid = getpid();
+    // readers check the magic, so it goes in last
+    __atomic_store_n(&shm_hdr->magic, CPU_SHM_MAGIC, __ATOMIC_RELEASE);
+    write_log("Publishing samples to shared memory %s", CPU_SHM_NAME);
+}
+
+/*
+ * Writes the sample into the next ring slot under its seqlock, then advances
+ * head. Readers that race with the write see an odd or changed seq and retry.
+ */
+void shm_publish(const struct cpu_sample *cur) {
+    if (!shm_hdr) return;
+    uint64_t idx = shm_hdr->head;
+    struct cpu_shm_sample *slot = &shm_hdr->ring[idx % CPU_SHM_SLOTS];
+    uint64_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct timeval tv;
+    sample_wall(&tv);
+    slot->index = idx;
+    slot->timestamp = tv.tv_sec + tv.tv_usec / 1e6;
+    slot->usage = cur->usage;
+    slot->max_usage = cur->max_usage;
+    slot->min_usage = cur->min_usage;
+    slot->loadavg1 = cur->loadavg1;
+    slot->loadavg5 = cur->loadavg5;
+    slot->loadavg15 = cur->loadavg15;
+    slot->uptime = cur->uptime;
+    slot->ncores = cur->ncores;
+    slot->alert = cur->alert;
+    for (int f = 0; f < CPU_TIME_FIELDS; ++f) slot->breakdown[f] = cur->breakdown[0][f];
+    slot->nnets = cur->nnets < CPU_SHM_MAX_NETS ? cur->nnets : CPU_SHM_MAX_NETS;
+    for (uint32_t n = 0; n < slot->nnets; ++n) {
+        const struct net_rate *nr = &cur->nets[n];
+        struct cpu_shm_net *sn = &slot->nets[n];
+        memcpy(sn->name, nr->name, sizeof(sn->name));
+        sn->rx_bytes = nr->rx_bytes;
+        sn->tx_bytes = nr->tx_bytes;
+        sn->rx_packets = nr->rx_packets;
+        sn->tx_packets = nr->tx_packets;
+        sn->rx_drops = nr->rx_drops;
+        sn->tx_drops = nr->tx_drops;
+        sn->rx_errors = nr->rx_errors;
+        sn->tx_errors = nr->tx_errors;
+    }
+    for (int c = 0; c < cur->ncores; ++c) slot->core_usage[c] = cur->core_online[c] ? (float)cur->core_usage[c] : -1.0f;
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm_hdr->head, idx + 1, __ATOMIC_RELEASE);
+}
+
+void shm_publish_close() {
+    if (!shm_hdr) return;
+    munmap(shm_hdr, sizeof(*shm_hdr));
+    shm_hdr = NULL;
+    shm_unlink(CPU_SHM_NAME);
+}
+#else
+void shm_publish_open() {}
+void shm_publish(const struct cpu_sample *cur) {}
+void shm_publish_close() {}
+#endif
+
+void history_append(const struct cpu_sample *cur) {
+    struct timeval tv;
+    sample_wall(&tv);
+    unsigned long long slot = history_count % HISTORY_LEN;
+    struct history_entry *h = &history[slot];
+    h->ts = tv.tv_sec + tv.tv_usec / 1e6;
+    h->usage = (float)cur->usage;
+    h->loadavg1 = (float)cur->loadavg1;
+    h->loadavg5 = (float)cur->loadavg5;
+    h->loadavg15 = (float)cur->loadavg15;
+    h->ncores = (unsigned short)cur->ncores;
+    h->alert = (unsigned char)cur->alert;
+    memcpy(h->breakdown, cur->breakdown[0], sizeof(h->breakdown));
+    for (int c = 0; c < cur->ncores; ++c) {
+        history_core[slot][c] = cur->core_online[c] ? (unsigned short)(cur->core_usage[c] * 100.0 + 0.5) : HISTORY_CORE_OFFLINE;
+    }
+    history_count++;
+}
+
+// Oldest sample number still held in the history ring.
+static unsigned long long history_first() {
+    return history_count > HISTORY_LEN ? history_count - HISTORY_LEN : 0;
+}
+
+// First sample number with ts >= t (history_count if none).
+static unsigned long long history_lower_bound(double t) {
+    unsigned long long lo = history_first(), hi = history_count;
+    while (lo < hi) {
+        unsigned long long mid = lo + (hi - lo) / 2;
+        if (history[mid % HISTORY_LEN].ts < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+#if ENABLE_JOURNAL
+/*
+ * Write-ahead sample journal. JOURNAL_FILE is preallocated once to a header
+ * and JOURNAL_RECORDS fixed-size records; sample seq goes to slot
+ * seq % JOURNAL_RECORDS, so the file is a ring that never grows. Each record
+ * carries a CRC32, so a record torn by a crash fails the check and is
+ * skipped. Records are written with pwrite() every sample, which survives the
+ * monitor being killed, and fdatasync() runs every JOURNAL_SYNC_MS to group
+ * many samples into one flush, which bounds what a power loss can take.
+ */
+#define JOURNAL_MAGIC 0x4C4E524Au  // "JRNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_BYTES 4096
+struct journal_header {
+    unsigned int magic, version;
+    unsigned int record_bytes, records;
+    unsigned int max_cpus, time_fields;
+};
+struct journal_record {
+    unsigned int magic;
+    unsigned int crc;              // crc32 of everything after this field
+    unsigned long long seq;        // 1-based; 0 marks a slot never written
+    struct history_entry h;
+    double max_usage, min_usage;
+    unsigned long long alert_samples;
+    double alert_since;
+    unsigned short core[MAX_CPUS]; // hundredths of a percent, HISTORY_CORE_OFFLINE for offline CPUs
+};
+static int journal_fd = -1;
+static unsigned long long journal_seq = 0; // last seq written
+static struct timespec journal_last_sync;
+static int journal_dirty = 0;
+
+static unsigned int journal_crc(const struct journal_record *r) {
+    const unsigned char *p = (const unsigned char *)&r->seq;
+    return (unsigned int)crc32(0L, p, (unsigned int)(sizeof(*r) - offsetof(struct journal_record, seq)));
+}
+
+// creates or resets the journal to an empty preallocated ring
+static int journal_create(int fd) {
+    struct journal_header hdr = { JOURNAL_MAGIC, JOURNAL_VERSION, sizeof(struct journal_record), JOURNAL_RECORDS,
+                                  MAX_CPUS, CPU_TIME_FIELDS };
+    off_t bytes = JOURNAL_HEADER_BYTES + (off_t)JOURNAL_RECORDS * sizeof(struct journal_record);
+    // zero length first so stale records from an older layout cannot pass as valid
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0) return -1;
+    int rc = posix_fallocate(fd, 0, bytes);
+    if (rc != 0 && rc != EOPNOTSUPP) {
+        errno = rc;
+        return -1;
+    }
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) return -1;
+    return fdatasync(fd);
+}
+
+/*
+ * Maps the journal and loads the newest run of consecutive valid records
+ * into the history ring and the statistics, then restores max/min and the
+ * alert counters in cur from the last one. Returns the records recovered.
+ */
+static unsigned long long journal_recover(struct cpu_sample *cur) {
+    off_t bytes = JOURNAL_HEADER_BYTES + (off_t)JOURNAL_RECORDS * sizeof(struct journal_record);
+    const unsigned char *map = mmap(NULL, bytes, PROT_READ, MAP_SHARED, journal_fd, 0);
+    if (map == MAP_FAILED) return 0;
+    madvise((void *)map, bytes, MADV_SEQUENTIAL);
+    const struct journal_record *recs = (const struct journal_record *)(map + JOURNAL_HEADER_BYTES);
+
+    // the newest record is the valid one with the highest seq
+    unsigned long long last = 0;
+    for (unsigned int i = 0; i < JOURNAL_RECORDS; ++i) {
+        const struct journal_record *r = &recs[i];
+        if (r->magic == JOURNAL_MAGIC && r->seq > last && r->seq % JOURNAL_RECORDS == i && journal_crc(r) == r->crc) {
+            last = r->seq;
+        }
+    }
+    // walk back while the sequence is unbroken, then replay oldest first
+    unsigned long long first = last;
+    while (first > 1 && last - first + 1 < JOURNAL_RECORDS && last - first + 1 < HISTORY_LEN) {
+        const struct journal_record *r = &recs[(first - 1) % JOURNAL_RECORDS];
+        if (r->magic != JOURNAL_MAGIC || r->seq != first - 1 || journal_crc(r) != r->crc) break;
+        first--;
+    }
+    unsigned long long n = 0;
+    for (unsigned long long s = first; last && s <= last; ++s, ++n) {
+        const struct journal_record *r = &recs[s % JOURNAL_RECORDS];
+        unsigned long long slot = history_count % HISTORY_LEN;
+        history[slot] = r->h;
+        memcpy(history_core[slot], r->core, sizeof(history_core[slot]));
+        history_count++;
+        stats_add(&agg_stats, r->h.usage);
+        for (int c = 0; c < r->h.ncores && c < MAX_CPUS; ++c) {
+            if (r->core[c] != HISTORY_CORE_OFFLINE) stats_add(&core_stats[c], r->core[c] / 100.0);
+        }
+        if (s == last) {
+            cur->max_usage = r->max_usage;
+            cur->min_usage = r->min_usage;
+            cur->alert_samples = r->alert_samples;
+            cur->alert_since = r->alert_since;
+        }
+    }
+    munmap((void *)map, bytes);
+    journal_seq = last;
+    return n;
+}
+
+/*
+ * Opens JOURNAL_FILE, creating it if needed, and recovers what it holds.
+ * A journal written with a different layout is started over.
+ */
+void journal_open(struct cpu_sample *cur) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    journal_fd = open(JOURNAL_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (journal_fd < 0) {
+        write_log("Warning: could not open journal %s: %s", JOURNAL_FILE, strerror(errno));
+        return;
+    }
+    struct journal_header hdr;
+    struct stat st;
+    off_t bytes = JOURNAL_HEADER_BYTES + (off_t)JOURNAL_RECORDS * sizeof(struct journal_record);
+    int usable = fstat(journal_fd, &st) == 0 && st.st_size == bytes &&
+                 pread(journal_fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && hdr.magic == JOURNAL_MAGIC &&
+                 hdr.version == JOURNAL_VERSION && hdr.record_bytes == sizeof(struct journal_record) &&
+                 hdr.records == JOURNAL_RECORDS && hdr.max_cpus == MAX_CPUS && hdr.time_fields == CPU_TIME_FIELDS;
+    if (!usable) {
+        if (st.st_size > 0) write_log("Warning: journal %s has a different layout, starting a new one", JOURNAL_FILE);
+        if (journal_create(journal_fd) != 0) {
+            write_log("Warning: could not create journal %s: %s", JOURNAL_FILE, strerror(errno));
+            close(journal_fd);
+            journal_fd = -1;
+        }
+        return;
+    }
+    unsigned long long n = journal_recover(cur);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    journal_last_sync = t1;
+    if (n > 0) {
+        write_log("Journal: recovered %llu samples (seq %llu..%llu) in %.1f ms | Max: %.2f | Min: %.2f | Alert samples: %llu",
+                  n, journal_seq - n + 1, journal_seq,
+                  (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+                  cur->max_usage, cur->min_usage, cur->alert_samples);
+    }
+}
+
+// journals the sample history_append() just stored
+void journal_append(const struct cpu_sample *cur) {
+    if (journal_fd < 0 || history_count == 0) return;
+    static struct journal_record r;
+    unsigned long long slot = (history_count - 1) % HISTORY_LEN;
+    memset(&r, 0, sizeof(r));
+    r.magic = JOURNAL_MAGIC;
+    r.seq = ++journal_seq;
+    r.h = history[slot];
+    memcpy(r.core, history_core[slot], sizeof(r.core));
+    for (int c = cur->ncores; c < MAX_CPUS; ++c) r.core[c] = HISTORY_CORE_OFFLINE;
+    r.max_usage = cur->max_usage;
+    r.min_usage = cur->min_usage;
+    r.alert_samples = cur->alert_samples;
+    r.alert_since = cur->alert_since;
+    r.crc = journal_crc(&r);
+    off_t off = JOURNAL_HEADER_BYTES + (off_t)(r.seq % JOURNAL_RECORDS) * sizeof(r);
+    if (pwrite(journal_fd, &r, sizeof(r), off) != (ssize_t)sizeof(r)) {
+        write_log("Warning: journal write failed: %s, journaling stopped", strerror(errno));
+        close(journal_fd);
+        journal_fd = -1;
+        return;
+    }
+    journal_dirty = 1;
+
+    // group commit: one fdatasync covers every record since the last one
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (now.tv_sec - journal_last_sync.tv_sec) * 1000L + (now.tv_nsec - journal_last_sync.tv_nsec) / 1000000L;
+    if (ms >= JOURNAL_SYNC_MS) {
+        fdatasync(journal_fd);
+        journal_last_sync = now;
+        journal_dirty = 0;
+    }
+}
+
+void journal_close() {
+    if (journal_fd < 0) return;
+    if (journal_dirty) fdatasync(journal_fd);
+    close(journal_fd);
+    journal_fd = -1;
+}
+#else
+void journal_open(struct cpu_sample *cur) {}
+void journal_append(const struct cpu_sample *cur) {}
+void journal_close() {}
+#endif
+
+#if TRACK_PROCS
+static struct proc_entry *proc_slot(struct proc_entry *table, unsigned int epoch, int pid, int insert) {
+    unsigned int i = ((unsigned int)pid * 2654435761u) & (PROC_TABLE_SIZE - 1);
+    for (int probes = 0; probes < PROC_TABLE_SIZE; ++probes) {
+        struct proc_entry *e = &table[i];
+        if (e->epoch != epoch) return insert ? e : NULL;
+        if (e->pid == pid) return e;
+        i = (i + 1) & (PROC_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+// keeps the TOP_PROCS list sorted by cpu, hottest first
+static void top_procs_insert(int pid, const char *comm, double cpu) {
+    int pos = top_procs_count < TOP_PROCS ? top_procs_count : TOP_PROCS - 1;
+    if (top_procs_count == TOP_PROCS && cpu <= top_procs[pos].cpu) return;
+    while (pos > 0 && top_procs[pos - 1].cpu < cpu) {
+        top_procs[pos] = top_procs[pos - 1];
+        pos--;
+    }
+    top_procs[pos].pid = pid;
+    top_procs[pos].cpu = cpu;
+    memcpy(top_procs[pos].comm, comm, sizeof(top_procs[pos].comm));
+    if (top_procs_count < TOP_PROCS) top_procs_count++;
+}
+
+/*
+ * Scans /proc/<pid>/stat for every process and keeps the TOP_PROCS hottest
+ * by CPU time consumed since the previous scan.
+ */
+static void sample_processes_procfs() {
+    DIR *dir = opendir("/proc");
+    if (!dir) {
+        write_log("Warning: Failed to open /proc: %s", strerror(errno));
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - proc_last_scan.tv_sec) + (now.tv_nsec - proc_last_scan.tv_nsec) / 1e9;
+    double ticks_per_pct = elapsed * sysconf(_SC_CLK_TCK) / 100.0;
+    unsigned int prev_epoch = proc_epoch;
+    unsigned int epoch = ++proc_epoch;
+    struct proc_entry *prev = proc_tables[prev_epoch & 1], *curt = proc_tables[epoch & 1];
+    int have_prev = prev_epoch != 0 && elapsed > 0.0;
+
+    top_procs_count = 0;
+    procs_seen = 0;
+    struct dirent *de;
+    char path[64], buf[1024];
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] < '1' || de->d_name[0] > '9') continue;
+        int pid = atoi(de->d_name);
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue; // process exited
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n <= 0) continue;
+        buf[n] = '\0';
+
+        // comm is in parentheses and may itself contain spaces or ')'
+        char *lp = strchr(buf, '('), *rp = strrchr(buf, ')');
+        if (!lp || !rp || rp < lp) continue;
+        unsigned long long utime = 0, stime = 0;
+        if (sscanf(rp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) continue;
+
+        struct proc_entry *e = proc_slot(curt, epoch, pid, 1);
+        if (!e) continue; // table full
+        e->pid = pid;
+        e->epoch = epoch;
+        e->ticks = utime + stime;
+        size_t clen = rp - lp - 1;
+        if (clen >= sizeof(e->comm)) clen = sizeof(e->comm) - 1;
+        memcpy(e->comm, lp + 1, clen);
+        e->comm[clen] = '\0';
+        procs_seen++;
+
+        if (!have_prev) continue;
+        struct proc_entry *old = proc_slot(prev, prev_epoch, pid, 0);
+        if (!old || e->ticks < old->ticks) continue;
+        double cpu = (e->ticks - old->ticks) / ticks_per_pct;
+        if (cpu <= 0.0) continue;
+        top_procs_insert(pid, e->comm, cpu);
+    }
+    closedir(dir);
+    proc_last_scan = now;
+}
+
+#if PROC_EBPF
+/*
+ * eBPF source for per-process CPU time. A raw sched_switch tracepoint program
+ * charges the time since the previous switch on this CPU to the outgoing
+ * task's process (tgid) in a per-CPU hash, and records its comm in a second
+ * map, so processes that start and exit between two ticks are still counted.
+ * Built from raw bpf() syscalls and hand-assembled instructions; no libbpf.
+ */
+#define EBPF_INSN(c, d, s, o, i) ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define EBPF_CALL(fn) EBPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, fn)
+#define EBPF_MOV_REG(d, s) EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define EBPF_MOV_IMM(d, i) EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define EBPF_ADD_IMM(d, i) EBPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define EBPF_LDX(sz, d, s, o) EBPF_INSN(BPF_LDX | BPF_MEM | (sz), d, s, o, 0)
+#define EBPF_STX(sz, d, s, o) EBPF_INSN(BPF_STX | BPF_MEM | (sz), d, s, o, 0)
+#define EBPF_JEQ_IMM(d, i) EBPF_INSN(BPF_JMP | BPF_JEQ | BPF_K, d, 0, 0, i) // offset patched later
+
+static struct bpf_insn ebpf_prog[64];
+static int ebpf_len;
+static int ebpf_start_fd = -1, ebpf_ns_fd = -1, ebpf_comm_fd = -1, ebpf_prog_fd = -1, ebpf_link_fd = -1;
+static int ebpf_ncpus;             // possible CPUs, the width of a per-CPU value (not capped at MAX_CPUS)
+static int ebpf_batch = 1;         // 0 once the kernel rejects batch lookup-and-delete
+static unsigned int ebpf_keys[EBPF_DRAIN_CHUNK];
+static unsigned long long *ebpf_values; // EBPF_DRAIN_CHUNK * ebpf_ncpus, allocated once
+static char ebpf_comms[EBPF_DRAIN_CHUNK][16];
+static int ebpf_pids[EBPF_MAP_ENTRIES];
+static unsigned long long ebpf_ns[EBPF_MAP_ENTRIES];
+
+static int bpf_sys(int cmd, union bpf_attr *attr) {
+    return (int)syscall(SYS_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int ebpf_emit(struct bpf_insn insn) {
+    ebpf_prog[ebpf_len] = insn;
+    return ebpf_len++;
+}
+
+// 64-bit immediate load of a map fd, two instruction slots
+static void ebpf_emit_map(int reg, int fd) {
+    ebpf_emit(EBPF_INSN(BPF_LD | BPF_DW | BPF_IMM, reg, BPF_PSEUDO_MAP_FD, 0, fd));
+    ebpf_emit(EBPF_INSN(0, 0, 0, 0, 0));
+}
+
+static int ebpf_map_create(unsigned int type, unsigned int key_size, unsigned int value_size, unsigned int entries,
+                           unsigned int flags) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = entries;
+    attr.map_flags = flags;
+    return bpf_sys(BPF_MAP_CREATE, &attr);
+}
+
+static void ebpf_build() {
+    int to_out[8], nout = 0;
+    ebpf_len = 0;
+    // r7 = now; swap it with this CPU's previous switch time in start[0]
+    ebpf_emit(EBPF_CALL(BPF_FUNC_ktime_get_ns));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_7, BPF_REG_0));
+    ebpf_emit(EBPF_INSN(BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -4, 0));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_2, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_2, -4));
+    ebpf_emit_map(BPF_REG_1, ebpf_start_fd);
+    ebpf_emit(EBPF_CALL(BPF_FUNC_map_lookup_elem));
+    to_out[nout++] = ebpf_emit(EBPF_JEQ_IMM(BPF_REG_0, 0));
+    ebpf_emit(EBPF_LDX(BPF_DW, BPF_REG_8, BPF_REG_0, 0));
+    ebpf_emit(EBPF_STX(BPF_DW, BPF_REG_0, BPF_REG_7, 0));
+    to_out[nout++] = ebpf_emit(EBPF_JEQ_IMM(BPF_REG_8, 0)); // first switch seen on this CPU
+    ebpf_emit(EBPF_INSN(BPF_ALU64 | BPF_SUB | BPF_X, BPF_REG_7, BPF_REG_8, 0, 0));
+
+    // the tracepoint runs in the outgoing task; skip the idle task (pid 0), key by tgid
+    ebpf_emit(EBPF_CALL(BPF_FUNC_get_current_pid_tgid));
+    ebpf_emit(EBPF_INSN(BPF_ALU | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_0, 0, 0));
+    to_out[nout++] = ebpf_emit(EBPF_JEQ_IMM(BPF_REG_1, 0));
+    ebpf_emit(EBPF_INSN(BPF_ALU64 | BPF_RSH | BPF_K, BPF_REG_0, 0, 0, 32));
+    ebpf_emit(EBPF_STX(BPF_W, BPF_REG_10, BPF_REG_0, -8));
+
+    // ns[tgid] += delta on this CPU's copy; per-CPU values need no atomics
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_2, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_2, -8));
+    ebpf_emit_map(BPF_REG_1, ebpf_ns_fd);
+    ebpf_emit(EBPF_CALL(BPF_FUNC_map_lookup_elem));
+    int to_insert = ebpf_emit(EBPF_JEQ_IMM(BPF_REG_0, 0));
+    ebpf_emit(EBPF_LDX(BPF_DW, BPF_REG_1, BPF_REG_0, 0));
+    ebpf_emit(EBPF_INSN(BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_1, BPF_REG_7, 0, 0));
+    ebpf_emit(EBPF_STX(BPF_DW, BPF_REG_0, BPF_REG_1, 0));
+    to_out[nout++] = ebpf_emit(EBPF_INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0));
+
+    // first time this tick: insert ns[tgid] = delta and comm[tgid]
+    ebpf_prog[to_insert].off = ebpf_len - to_insert - 1;
+    ebpf_emit(EBPF_STX(BPF_DW, BPF_REG_10, BPF_REG_7, -16));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_2, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_2, -8));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_3, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_3, -16));
+    ebpf_emit(EBPF_MOV_IMM(BPF_REG_4, BPF_ANY));
+    ebpf_emit_map(BPF_REG_1, ebpf_ns_fd);
+    ebpf_emit(EBPF_CALL(BPF_FUNC_map_update_elem));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_1, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_1, -32));
+    ebpf_emit(EBPF_MOV_IMM(BPF_REG_2, 16));
+    ebpf_emit(EBPF_CALL(BPF_FUNC_get_current_comm));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_2, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_2, -8));
+    ebpf_emit(EBPF_MOV_REG(BPF_REG_3, BPF_REG_10));
+    ebpf_emit(EBPF_ADD_IMM(BPF_REG_3, -32));
+    ebpf_emit(EBPF_MOV_IMM(BPF_REG_4, BPF_ANY));
+    ebpf_emit_map(BPF_REG_1, ebpf_comm_fd);
+    ebpf_emit(EBPF_CALL(BPF_FUNC_map_update_elem));
+
+    for (int i = 0; i < nout; ++i) ebpf_prog[to_out[i]].off = ebpf_len - to_out[i] - 1;
+    ebpf_emit(EBPF_MOV_IMM(BPF_REG_0, 0));
+    ebpf_emit(EBPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+}
+
+void ebpf_close() {
+    int *fds[] = { &ebpf_link_fd, &ebpf_prog_fd, &ebpf_comm_fd, &ebpf_ns_fd, &ebpf_start_fd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+        if (*fds[i] >= 0) close(*fds[i]);
+        *fds[i] = -1;
+    }
+    free(ebpf_values);
+    ebpf_values = NULL;
+}
+
+/*
+ * Creates the maps, loads the program and attaches it to sched_switch.
+ * Returns 0, or -1 with errno set (typically EPERM without root/CAP_BPF).
+ */
+int ebpf_open() {
+    char buf[256];
+    int fd = -1;
+    // the kernel copies one value per possible CPU, so this must not stop at MAX_CPUS like parse_cpu_list()
+    ebpf_ncpus = 0;
+    if (pread_file(&fd, "/sys/devices/system/cpu/possible", buf, sizeof(buf)) > 0) {
+        const char *s = buf;
+        while (*s >= '0' && *s <= '9') {
+            unsigned long long lo, hi;
+            s = parse_ull(s, &lo);
+            hi = lo;
+            if (*s == '-') s = parse_ull(s + 1, &hi);
+            if (hi >= lo) ebpf_ncpus += (int)(hi - lo + 1);
+            if (*s == ',') s++;
+        }
+    }
+    if (fd >= 0) close(fd);
+    if (ebpf_ncpus <= 0) ebpf_ncpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (ebpf_ncpus <= 0) {
+        errno = ENODEV;            // cannot size the per-CPU values safely
+        return -1;
+    }
+    ebpf_values = malloc((size_t)EBPF_DRAIN_CHUNK * ebpf_ncpus * sizeof(unsigned long long));
+    if (!ebpf_values) return -1;
+
+    ebpf_start_fd = ebpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, 4, 8, 1, 0);
+    ebpf_ns_fd = ebpf_map_create(BPF_MAP_TYPE_PERCPU_HASH, 4, 8, EBPF_MAP_ENTRIES, BPF_F_NO_PREALLOC);
+    ebpf_comm_fd = ebpf_map_create(BPF_MAP_TYPE_HASH, 4, 16, EBPF_MAP_ENTRIES, BPF_F_NO_PREALLOC);
+    if (ebpf_start_fd < 0 || ebpf_ns_fd < 0 || ebpf_comm_fd < 0) goto fail;
+
+    ebpf_build();
+    static char verifier_log[16384];
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_RAW_TRACEPOINT;
+    attr.insns = (unsigned long)ebpf_prog;
+    attr.insn_cnt = ebpf_len;
+    attr.license = (unsigned long)"GPL";
+    attr.log_buf = (unsigned long)verifier_log;
+    attr.log_size = sizeof(verifier_log);
+    attr.log_level = 1;
+    ebpf_prog_fd = bpf_sys(BPF_PROG_LOAD, &attr);
+    if (ebpf_prog_fd < 0) {
+        int err = errno;
+        if (verifier_log[0]) write_log("Warning: eBPF verifier rejected the sched_switch program: %s", verifier_log);
+        errno = err;
+        goto fail;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.raw_tracepoint.name = (unsigned long)"sched_switch";
+    attr.raw_tracepoint.prog_fd = ebpf_prog_fd;
+    ebpf_link_fd = bpf_sys(BPF_RAW_TRACEPOINT_OPEN, &attr);
+    if (ebpf_link_fd < 0) goto fail;
+    return 0;
+
+fail:;
+    int err = errno;
+    ebpf_close();
+    errno = err;
+    return -1;
+}
+
+/*
+ * Removes up to EBPF_DRAIN_CHUNK entries from a map into ebpf_keys/values.
+ * Uses one BPF_MAP_LOOKUP_AND_DELETE_BATCH call per chunk, or a get-next-key,
+ * lookup and delete per entry on kernels without it. *token carries the
+ * batch position between calls (*started is 0 on the first). Returns the
+ * number of entries, 0 once the map is empty.
+ */
+static int ebpf_drain_chunk(int map_fd, void *values, size_t value_bytes, unsigned int *token, int *started) {
+    union bpf_attr attr;
+    if (ebpf_batch) {
+        if (*started < 0) return 0; // the previous call reached the end
+        memset(&attr, 0, sizeof(attr));
+        attr.batch.map_fd = map_fd;
+        attr.batch.in_batch = *started ? (unsigned long)token : 0;
+        attr.batch.out_batch = (unsigned long)token;
+        attr.batch.keys = (unsigned long)ebpf_keys;
+        attr.batch.values = (unsigned long)values;
+        attr.batch.count = EBPF_DRAIN_CHUNK;
+        int rc = bpf_sys(BPF_MAP_LOOKUP_AND_DELETE_BATCH, &attr);
+        if (rc == 0 || errno == ENOENT) {
+            *started = rc == 0 ? 1 : -1;
+            return (int)attr.batch.count;
+        }
+        if (*started || (errno != EINVAL && errno != ENOTSUP && errno != 524 /* ENOTSUPP */)) return 0;
+        ebpf_batch = 0;
+    }
+    int n = 0;
+    while (n < EBPF_DRAIN_CHUNK) {
+        // every entry read is deleted, so the first key is always the next one
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = map_fd;
+        attr.key = 0;
+        attr.next_key = (unsigned long)&ebpf_keys[n];
+        if (bpf_sys(BPF_MAP_GET_NEXT_KEY, &attr) != 0) break;
+        attr.key = (unsigned long)&ebpf_keys[n];
+        attr.value = (unsigned long)((char *)values + n * value_bytes);
+        int found = bpf_sys(BPF_MAP_LOOKUP_ELEM, &attr) == 0;
+        bpf_sys(BPF_MAP_DELETE_ELEM, &attr);
+        if (found) n++;
+    }
+    return n;
+}
+
+/*
+ * Drains both maps once per tick: per-CPU nanoseconds summed per process,
+ * then comms into this tick's proc table. A comm that lands in the next
+ * drain is found in the previous table then.
+ */
+static void sample_processes_ebpf() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - proc_last_scan.tv_sec) + (now.tv_nsec - proc_last_scan.tv_nsec) / 1e9;
+    unsigned int prev_epoch = proc_epoch;
+    unsigned int epoch = ++proc_epoch;
+    struct proc_entry *prev = proc_tables[prev_epoch & 1], *curt = proc_tables[epoch & 1];
+    int have_prev = prev_epoch != 0 && elapsed > 0.0;
+
+    int npids = 0, n, started = 0;
+    unsigned int token = 0;
+    while (npids < EBPF_MAP_ENTRIES &&
+           (n = ebpf_drain_chunk(ebpf_ns_fd, ebpf_values, ebpf_ncpus * sizeof(unsigned long long), &token, &started)) > 0) {
+        for (int i = 0; i < n && npids < EBPF_MAP_ENTRIES; ++i) {
+            const unsigned long long *v = ebpf_values + (size_t)i * ebpf_ncpus;
+            unsigned long long ns = 0;
+            for (int c = 0; c < ebpf_ncpus; ++c) ns += v[c];
+            ebpf_pids[npids] = (int)ebpf_keys[i];
+            ebpf_ns[npids++] = ns;
+        }
+    }
+    started = 0;
+    token = 0;
+    while ((n = ebpf_drain_chunk(ebpf_comm_fd, ebpf_comms, sizeof(ebpf_comms[0]), &token, &started)) > 0) {
+        for (int i = 0; i < n; ++i) {
+            struct proc_entry *e = proc_slot(curt, epoch, (int)ebpf_keys[i], 1);
+            if (!e) continue;
+            e->pid = (int)ebpf_keys[i];
+            e->epoch = epoch;
+            memcpy(e->comm, ebpf_comms[i], sizeof(e->comm));
+            e->comm[sizeof(e->comm) - 1] = '\0';
+        }
+    }
+
+    top_procs_count = 0;
+    procs_seen = npids;
+    for (int i = 0; have_prev && i < npids; ++i) {
+        double cpu = ebpf_ns[i] / (elapsed * 1e9) * 100.0;
+        if (cpu <= 0.0) continue;
+        const struct proc_entry *e = proc_slot(curt, epoch, ebpf_pids[i], 0);
+        if (!e) {
+            // comm not drained this tick: keep the previous one alive in this table
+            const struct proc_entry *old = proc_slot(prev, prev_epoch, ebpf_pids[i], 0);
+            struct proc_entry *ne = proc_slot(curt, epoch, ebpf_pids[i], 1);
+            if (ne) {
+                ne->pid = ebpf_pids[i];
+                ne->epoch = epoch;
+                snprintf(ne->comm, sizeof(ne->comm), "%s", old ? old->comm : "?");
+            }
+            e = ne;
+        }
+        top_procs_insert(ebpf_pids[i], e ? e->comm : "?", cpu);
+    }
+    proc_last_scan = now;
+}
+#else
+int ebpf_open() {
+    errno = ENOSYS;
+    return -1;
+}
+void ebpf_close() {}
+static void sample_processes_ebpf() {}
+#endif
+
+void sample_processes() {
+    if (proc_source == PROC_SOURCE_EBPF) sample_processes_ebpf();
+    else sample_processes_procfs();
+}
+
+/*
+ * -B N: starts N idle processes, then times one tick of each per-process
+ * source over a few ticks and prints the result. The extra processes share
+ * this process's memory (CLONE_VM) and only sleep, so they are cheap to make.
+ */
+static int bench_sleeper(void *arg) {
+    for (;;) pause();
+    return 0;
+}
+
+int bench_proc_sources(int npids) {
+    const size_t stack_bytes = 16 * 1024;
+    const int ticks = 5;
+    char *stacks = mmap(NULL, stack_bytes * (size_t)npids, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stacks == MAP_FAILED) {
+        fprintf(stderr, "Error: could not map %d stacks: %s\n", npids, strerror(errno));
+        return 1;
+    }
+    int *kids = calloc(npids, sizeof(int));
+    int started = 0;
+    for (; kids && started < npids; ++started) {
+        int pid = clone(bench_sleeper, stacks + stack_bytes * (started + 1), CLONE_VM | SIGCHLD, NULL);
+        if (pid < 0) {
+            fprintf(stderr, "Warning: started %d of %d processes: %s\n", started, npids, strerror(errno));
+            break;
+        }
+        kids[started] = pid;
+    }
+    printf("Started %d idle processes, %d ticks per source, tick %d ms\n", started, ticks, DELAY_US / 1000);
+
+    for (int source = PROC_SOURCE_PROCFS; source <= PROC_SOURCE_EBPF; ++source) {
+        if (source == PROC_SOURCE_EBPF && ebpf_open() != 0) {
+            printf("%-7s unavailable: %s\n", "ebpf", strerror(errno));
+            continue;
+        }
+        proc_source = source;
+        proc_epoch = 0;
+        sample_processes(); // baseline
+        double wall = 0.0, cpu = 0.0, worst = 0.0;
+        int seen = 0;
+        for (int t = 0; t < ticks; ++t) {
+            usleep(DELAY_US);
+            struct timespec w0, w1, c0, c1;
+            clock_gettime(CLOCK_MONOTONIC, &w0);
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c0);
+            sample_processes();
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c1);
+            clock_gettime(CLOCK_MONOTONIC, &w1);
+            double w = (w1.tv_sec - w0.tv_sec) * 1e3 + (w1.tv_nsec - w0.tv_nsec) / 1e6;
+            wall += w;
+            cpu += (c1.tv_sec - c0.tv_sec) * 1e3 + (c1.tv_nsec - c0.tv_nsec) / 1e6;
+            if (w > worst) worst = w;
+            seen = procs_seen;
+        }
+        printf("%-7s %8.3f ms/tick wall (worst %.3f)  %8.3f ms/tick CPU  %d processes reported\n",
+               source == PROC_SOURCE_EBPF ? "ebpf" : "procfs", wall / ticks, worst, cpu / ticks, seen);
+        if (source == PROC_SOURCE_EBPF) ebpf_close();
+    }
+
+    for (int i = 0; i < started; ++i) kill(kids[i], SIGKILL);
+    for (int i = 0; i < started; ++i) waitpid(kids[i], NULL, 0);
+    free(kids);
+    munmap(stacks, stack_bytes * (size_t)npids);
+    return 0;
+}
+#else
+void sample_processes() {}
+int ebpf_open() {
+    errno = ENOSYS;
+    return -1;
+}
+void ebpf_close() {}
+int bench_proc_sources(int npids) {
+    fprintf(stderr, "Error: process tracking is disabled (TRACK_PROCS)\n");
+    return 1;
+}
+#endif
+
+#if TRACK_THREADS
+/*
+ * Per-thread drill-down for the process given with -p. Every tick reads
+ * /proc/<pid>/task/<tid>/stat for each thread into one of two arenas (this
+ * tick and the previous one), sorted by TID, so deltas come from a merge of
+ * the two rather than a lookup per thread. Threads are then grouped by comm
+ * with any trailing pool number removed ("worker-12" and "worker-3" both
+ * count as "worker"), which is how thread pools usually name their threads.
+ * Nothing is allocated after the first tick.
+ */
+struct thread_entry {
+    int tid;
+    int processor;                 // CPU it last ran on
+    unsigned long long ticks;      // utime + stime
+    double cpu;                    // % of one CPU over the last interval
+    char comm[16];
+};
+struct thread_group {
+    char name[16];
+    unsigned int epoch;            // slot is in use this tick when it matches thread_epoch
+    int threads;
+    double cpu;
+    int hottest_tid, hottest_processor;
+    double hottest_cpu;
+};
+static int thread_pid = 0;         // 0 when no drill-down was asked for
+static char thread_proc_comm[16];
+static DIR *thread_dir;
+static struct thread_entry thread_arena[2][MAX_THREADS];
+static int thread_count[2];
+static unsigned int thread_epoch;
+static struct timespec thread_last_scan;
+static struct thread_group thread_groups[THREAD_GROUP_SLOTS];
+static int thread_group_used[THREAD_GROUP_SLOTS]; // slots in use this tick
+static int thread_ngroups;
+static struct thread_group *thread_top[THREAD_GROUPS_SHOWN];
+static int thread_ntop;
+static double thread_total_cpu;
+static int thread_truncated;       // more threads than MAX_THREADS
+
+// opens /proc/<pid>/task for the drill-down; returns 0, or -1 with errno set
+int threads_open(int pid) {
+    char path[64], buf[32];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    thread_dir = opendir(path);
+    if (!thread_dir) return -1;
+    int fd = -1;
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    ssize_t n = pread_file(&fd, path, buf, sizeof(buf));
+    if (fd >= 0) close(fd);
+    while (n > 0 && buf[n - 1] == '\n') buf[--n] = '\0';
+    snprintf(thread_proc_comm, sizeof(thread_proc_comm), "%.15s", n > 0 ? buf : "?");
+    thread_pid = pid;
+    return 0;
+}
+
+void threads_close() {
+    if (thread_dir) closedir(thread_dir);
+    thread_dir = NULL;
+}
+
+// group slot for a thread comm, keyed by the name without its trailing number
+static struct thread_group *thread_group_for(const char *comm) {
+    char name[16];
+    size_t len = strlen(comm);
+    while (len > 1 && comm[len - 1] >= '0' && comm[len - 1] <= '9') len--;
+    while (len > 1 && len < strlen(comm) && strchr("-_:#./ ", comm[len - 1])) len--;
+    memcpy(name, comm, len);
+    name[len] = '\0';
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    for (unsigned int probes = 0; probes < THREAD_GROUP_SLOTS; ++probes) {
+        struct thread_group *g = &thread_groups[(h + probes) & (THREAD_GROUP_SLOTS - 1)];
+        if (g->epoch != thread_epoch) {
+            memset(g, 0, sizeof(*g));
+            g->epoch = thread_epoch;
+            memcpy(g->name, name, len + 1);
+            thread_group_used[thread_ngroups++] = (int)(g - thread_groups);
+            return g;
+        }
+        if (strcmp(g->name, name) == 0) return g;
+    }
+    return NULL;
+}
+
+// reads one thread's stat; returns 0 if the thread is gone or the line is malformed
+static int thread_read_stat(int dir_fd, const char *tid, struct thread_entry *t) {
+    char path[48], buf[1024];
+    snprintf(path, sizeof(path), "%s/stat", tid);
+    int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    char *lp = strchr(buf, '('), *rp = strrchr(buf, ')');
+    if (!lp || !rp || rp < lp) return 0;
+    size_t clen = rp - lp - 1;
+    if (clen >= sizeof(t->comm)) clen = sizeof(t->comm) - 1;
+    memcpy(t->comm, lp + 1, clen);
+    t->comm[clen] = '\0';
+    // fields after comm start at 3 (state); utime and stime are 14 and 15, processor is 39
+    const char *p = rp + 2;
+    unsigned long long utime = 0, stime = 0, processor = 0;
+    for (int field = 3; field <= 39 && *p; ++field) {
+        if (field == 14) p = parse_ull(p, &utime);
+        else if (field == 15) p = parse_ull(p, &stime);
+        else if (field == 39) p = parse_ull(p, &processor);
+        else while (*p && *p != ' ') p++;
+        while (*p == ' ') p++;
+    }
+    t->tid = atoi(tid);
+    t->ticks = utime + stime;
+    t->processor = (int)processor;
+    t->cpu = 0.0;
+    return 1;
+}
+
+/*
+ * Scans the threads of the drill-down process and rebuilds the groups and
+ * the THREAD_GROUPS_SHOWN hottest of them. Returns 0 once the process is gone.
+ */
+int sample_threads() {
+    if (!thread_dir) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - thread_last_scan.tv_sec) + (now.tv_nsec - thread_last_scan.tv_nsec) / 1e9;
+    double ticks_per_pct = elapsed * sysconf(_SC_CLK_TCK) / 100.0;
+    int have_prev = thread_epoch != 0 && elapsed > 0.0;
+    const struct thread_entry *prev = thread_arena[thread_epoch & 1];
+    int nprev = thread_count[thread_epoch & 1];
+    thread_epoch++;
+    struct thread_entry *curt = thread_arena[thread_epoch & 1];
+
+    // TIDs come back from readdir in ascending order; the insertion step only runs when they do not
+    int n = 0;
+    thread_truncated = 0;
+    rewinddir(thread_dir);
+    struct dirent *de;
+    while ((de = readdir(thread_dir)) != NULL) {
+        if (de->d_name[0] < '1' || de->d_name[0] > '9') continue;
+        if (n == MAX_THREADS) {
+            thread_truncated = 1;
+            break;
+        }
+        struct thread_entry t;
+        if (!thread_read_stat(dirfd(thread_dir), de->d_name, &t)) continue;
+        int pos = n++;
+        while (pos > 0 && curt[pos - 1].tid > t.tid) {
+            curt[pos] = curt[pos - 1];
+            pos--;
+        }
+        curt[pos] = t;
+    }
+    thread_count[thread_epoch & 1] = n;
+    thread_last_scan = now;
+    if (n == 0) {
+        threads_close();
+        return 0;
+    }
+
+    thread_ngroups = 0;
+    thread_total_cpu = 0.0;
+    for (int i = 0, j = 0; i < n; ++i) {
+        struct thread_entry *t = &curt[i];
+        while (j < nprev && prev[j].tid < t->tid) j++;
+        if (have_prev && j < nprev && prev[j].tid == t->tid && t->ticks >= prev[j].ticks) {
+            t->cpu = (t->ticks - prev[j].ticks) / ticks_per_pct;
+        }
+        thread_total_cpu += t->cpu;
+        struct thread_group *g = thread_group_for(t->comm);
+        if (!g) continue;
+        g->threads++;
+        g->cpu += t->cpu;
+        if (g->threads == 1 || t->cpu > g->hottest_cpu) {
+            g->hottest_tid = t->tid;
+            g->hottest_cpu = t->cpu;
+            g->hottest_processor = t->processor;
+        }
+    }
+
+    thread_ntop = 0;
+    for (int k = 0; k < thread_ngroups; ++k) {
+        struct thread_group *g = &thread_groups[thread_group_used[k]];
+        int pos = thread_ntop < THREAD_GROUPS_SHOWN ? thread_ntop : THREAD_GROUPS_SHOWN - 1;
+        if (thread_ntop == THREAD_GROUPS_SHOWN && g->cpu <= thread_top[pos]->cpu) continue;
+        while (pos > 0 && thread_top[pos - 1]->cpu < g->cpu) {
+            thread_top[pos] = thread_top[pos - 1];
+            pos--;
+        }
+        thread_top[pos] = g;
+        if (thread_ntop < THREAD_GROUPS_SHOWN) thread_ntop++;
+    }
+    return 1;
+}
+
+// draws the drill-down table from row; returns the next free row
+int draw_threads(int row) {
+    if (!thread_pid) return row;
+    if (!thread_dir) {
+        mvprintw(row++, 0, "Threads of %d (%s): process exited", thread_pid, thread_proc_comm);
+        return row + 1;
+    }
+    mvprintw(row++, 0, "Threads of %d (%s): %d threads in %d groups, %.1f%% CPU%s", thread_pid, thread_proc_comm,
+             thread_count[thread_epoch & 1], thread_ngroups, thread_total_cpu, thread_truncated ? " (truncated)" : "");
+    mvprintw(row++, 0, "%-16s %7s %8s %8s   %s", "GROUP", "THREADS", "CPU%", "AVG%", "HOTTEST");
+    for (int i = 0; i < thread_ntop && row < LINES; ++i) {
+        const struct thread_group *g = thread_top[i];
+        mvprintw(row++, 0, "%-16s %7d %8.1f %8.2f   tid %d %.1f%% on cpu%d", g->name, g->threads, g->cpu,
+                 g->cpu / g->threads, g->hottest_tid, g->hottest_cpu, g->hottest_processor);
+    }
+    if (thread_ngroups > thread_ntop) mvprintw(row++, 0, "... %d more groups", thread_ngroups - thread_ntop);
+    return row + 1;
+}
+
+// the three hottest groups, for the log
+const char *threads_summary() {
+    static char buf[256];
+    size_t len = (size_t)snprintf(buf, sizeof(buf), "pid %d (%s) | %d threads | %.1f%%", thread_pid, thread_proc_comm,
+                                  thread_count[thread_epoch & 1], thread_total_cpu);
+    for (int i = 0; i < thread_ntop && i < 3 && len < sizeof(buf); ++i) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%s %.1f%% (%d)", i ? ", " : " | ", thread_top[i]->name,
+                        thread_top[i]->cpu, thread_top[i]->threads);
+    }
+    return buf;
+}
+#else
+int threads_open(int pid) {
+    errno = ENOSYS;
+    return -1;
+}
+void threads_close() {}
+int sample_threads() { return 0; }
+int draw_threads(int row) { return row; }
+const char *threads_summary() { return ""; }
+#endif
+
+#if HISTORY_GRAPH
+/*
+ * History graph panel: the aggregate usage as a GRAPH_HEIGHT-row area graph
+ * and one sparkline per core over the last GRAPH_MINUTES, from the history
+ * ring. Each column is the mean of GRAPH_BUCKET_SAMPLES samples. Every graph
+ * row is kept as the text drawn for it; when a column fills up the text moves
+ * left by one cell, and a new sample only rewrites the newest cell of each
+ * row, so a frame never goes back over the whole series.
+ */
+#define GRAPH_BUCKET_SAMPLES (GRAPH_MINUTES * 60 * (1000000 / DELAY_US) / GRAPH_WIDTH)
+struct graph_strip {
+    char text[GRAPH_WIDTH * 3 + 1]; // GRAPH_WIDTH cells of graph_cell_bytes
+};
+// an empty cell as wide as a block in UTF-8 (U+2800, the blank braille pattern), so every cell is 3 bytes
+#define GRAPH_BLANK_UTF8 "\xe2\xa0\x80"
+static struct graph_strip graph_agg[GRAPH_HEIGHT]; // top row first
+static struct graph_strip graph_core[GRAPH_CORES_SHOWN];
+static int graph_cell_bytes;       // 3 for a Unicode block, 1 for ASCII
+static int graph_shown = 1;        // toggled with 'g'
+static int graph_ncores;
+static unsigned long long graph_next; // next history sample to add
+static long long graph_bucket = -1;   // column the running sums belong to
+static double graph_sum, graph_core_sum[GRAPH_CORES_SHOWN];
+static int graph_n, graph_core_n[GRAPH_CORES_SHOWN];
+
+/*
+ * Writes the cell of value v (0..100, < 0 for no data) for row k, counted
+ * from the bottom, of a graph that is rows high. Each row covers eight
+ * levels, one per block height.
+ */
+static void graph_cell(char *dst, float v, int k, int rows) {
+    static const char *const blocks[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+    static const char ramp[] = "_.-:=+*#";
+    int eighths = v < 0.0f ? -1 : (int)(v * rows * 8 / 100.0f + 0.5f) - k * 8;
+    if (eighths > 8) eighths = 8;
+    if (eighths == 0 && k == 0) eighths = 1; // idle still shows on the base line
+    if (eighths <= 0) memcpy(dst, graph_cell_bytes == 3 ? GRAPH_BLANK_UTF8 : " ", graph_cell_bytes);
+    else if (graph_cell_bytes == 3) memcpy(dst, blocks[eighths - 1], 3);
+    else *dst = ramp[eighths - 1];
+}
+
+static void graph_shift(struct graph_strip *s, int cells) {
+    size_t width = (size_t)GRAPH_WIDTH * graph_cell_bytes, move = (size_t)cells * graph_cell_bytes;
+    if (move > width) move = width;
+    memmove(s->text, s->text + move, width - move);
+    for (size_t i = width - move; i < width; i += graph_cell_bytes) graph_cell(s->text + i, -1.0f, 0, 1);
+}
+
+// rewrites the newest cell of every row from the running sums
+static void graph_set_last() {
+    size_t last = (size_t)(GRAPH_WIDTH - 1) * graph_cell_bytes;
+    float v = graph_n ? (float)(graph_sum / graph_n) : -1.0f;
+    for (int r = 0; r < GRAPH_HEIGHT; ++r) graph_cell(graph_agg[r].text + last, v, GRAPH_HEIGHT - 1 - r, GRAPH_HEIGHT);
+    for (int c = 0; c < graph_ncores; ++c) {
+        v = graph_core_n[c] ? (float)(graph_core_sum[c] / graph_core_n[c]) : -1.0f;
+        graph_cell(graph_core[c].text + last, v, 0, 1);
+    }
+}
+
+/*
+ * Adds the samples appended to the history since the last call. The first
+ * call fills the graph from whatever the history already holds, including
+ * samples recovered from the journal.
+ */
+void graph_update() {
+    if (graph_cell_bytes == 0) {
+        graph_cell_bytes = ui_utf8 ? 3 : 1;
+        for (int r = 0; r < GRAPH_HEIGHT; ++r) graph_shift(&graph_agg[r], GRAPH_WIDTH);
+        for (int c = 0; c < GRAPH_CORES_SHOWN; ++c) graph_shift(&graph_core[c], GRAPH_WIDTH);
+        unsigned long long span = (unsigned long long)GRAPH_WIDTH * GRAPH_BUCKET_SAMPLES;
+        graph_next = history_count > span ? history_count - span : 0;
+        graph_next -= graph_next % GRAPH_BUCKET_SAMPLES;
+        if (graph_next < history_first()) graph_next = history_first();
+    }
+    if (graph_next >= history_count) return;
+    for (; graph_next < history_count; ++graph_next) {
+        long long bucket = (long long)(graph_next / GRAPH_BUCKET_SAMPLES);
+        if (bucket != graph_bucket) {
+            if (graph_bucket >= 0) {
+                int cells = bucket - graph_bucket > GRAPH_WIDTH ? GRAPH_WIDTH : (int)(bucket - graph_bucket);
+                for (int r = 0; r < GRAPH_HEIGHT; ++r) graph_shift(&graph_agg[r], cells);
+                for (int c = 0; c < graph_ncores; ++c) graph_shift(&graph_core[c], cells);
+            }
+            graph_bucket = bucket;
+            graph_sum = 0.0;
+            graph_n = 0;
+            memset(graph_core_sum, 0, sizeof(graph_core_sum));
+            memset(graph_core_n, 0, sizeof(graph_core_n));
+        }
+        const struct history_entry *h = &history[graph_next % HISTORY_LEN];
+        graph_sum += h->usage;
+        graph_n++;
+        int ncores = h->ncores < GRAPH_CORES_SHOWN ? h->ncores : GRAPH_CORES_SHOWN;
+        if (ncores > graph_ncores) graph_ncores = ncores;
+        for (int c = 0; c < ncores; ++c) {
+            unsigned short u = history_core[graph_next % HISTORY_LEN][c];
+            if (u == HISTORY_CORE_OFFLINE) continue;
+            graph_core_sum[c] += u / 100.0;
+            graph_core_n[c]++;
+        }
+        // a bucket that is complete, or the newest one, is written to the newest cell
+        if ((graph_next + 1) % GRAPH_BUCKET_SAMPLES == 0 || graph_next + 1 == history_count) graph_set_last();
+    }
+}
+
+void graph_toggle() {
+    graph_shown = !graph_shown;
+}
+
+// draws the panel from row on; returns the first row after it
+int draw_history_graph(int row, int ncores) {
+    if (!graph_shown || graph_cell_bytes == 0) return row;
+    mvprintw(row++, 0, "History: last %d min, %d s per column ('g' hides)", GRAPH_MINUTES,
+             GRAPH_BUCKET_SAMPLES * DELAY_US / 1000000);
+    for (int r = 0; r < GRAPH_HEIGHT && row < LINES; ++r) {
+        if (r == 0) mvprintw(row, 0, "100%% ");
+        else if (r == GRAPH_HEIGHT - 1) mvprintw(row, 0, "  0%% ");
+        mvaddstr(row++, 5, graph_agg[r].text);
+    }
+    for (int c = 0; c < graph_ncores && row < LINES; ++c) {
+        mvprintw(row, 0, "cpu%-2d", c);
+        mvaddstr(row++, 5, graph_core[c].text);
+    }
+    if (ncores > graph_ncores && row < LINES) mvprintw(row++, 0, "... %d more cores", ncores - graph_ncores);
+    return row + 1;
+}
+#else
+void graph_update() {}
+void graph_toggle() {}
+int draw_history_graph(int row, int ncores) { return row; }
+#endif
+
+#if TRACK_INTERRUPTS
+/*
+ * Reads one of the per-CPU interrupt files into m. The header line maps
+ * columns to CPU numbers; each row is "name:" followed by one count per column
+ * (some rows such as ERR and MIS have a single count). A row keeps its index
+ * while its name is unchanged, otherwise it starts over without a rate.
+ * Returns 0 if the file could not be read.
+ */
+int get_irq_matrix(struct irq_matrix *m) {
+    if (pread_file(&m->fd, m->path, irq_buf, sizeof(irq_buf)) <= 0) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double secs = (now.tv_sec - m->prev_ts.tv_sec) + (now.tv_nsec - m->prev_ts.tv_nsec) / 1e9;
+    int have_prev = m->prev_ts.tv_sec != 0 && secs > 0.0;
+
+    // header: "CPU0 CPU1 ...", offline CPUs have no column
+    const char *p = irq_buf;
+    int ncols = 0;
+    while (*p && *p != '\n') {
+        while (*p == ' ') p++;
+        if (strncmp(p, "CPU", 3) != 0) break;
+        unsigned long long cpu;
+        p = parse_ull(p + 3, &cpu);
+        if (ncols < MAX_CPUS) {
+            if (ncols < m->ncols && m->col_cpu[ncols] != (int)cpu) have_prev = 0;
+            m->col_cpu[ncols++] = (int)cpu;
+        }
+    }
+    if (ncols != m->ncols) have_prev = 0;
+    m->ncols = ncols;
+    memset(m->col_rate, 0, sizeof(m->col_rate));
+    m->total_rate = 0.0;
+
+    int r = 0;
+    p = strchr(p, '\n');
+    while (p && *++p && r < m->max_rows) {
+        while (*p == ' ') p++;
+        const char *colon = strchr(p, ':');
+        if (!colon) break;
+        size_t klen = colon - p;
+        if (klen >= IRQ_NAME_LEN) klen = IRQ_NAME_LEN - 1;
+        char *name = m->name[r];
+        int fresh = r >= m->nrows || strncmp(name, p, klen) != 0 || (name[klen] != '\0' && name[klen] != ':');
+        if (fresh) {
+            memcpy(name, p, klen);
+            name[klen] = '\0';
+        }
+        p = colon + 1;
+
+        double row_rate = 0.0, top_rate = -1.0;
+        int top = 0;
+        for (int c = 0; c < ncols; ++c) {
+            unsigned long long v;
+            p = parse_ull(p, &v);
+            size_t i = (size_t)c * m->max_rows + r;
+            float rate = 0.0f;
+            if (have_prev && !fresh && v >= m->prev[i]) rate = (float)((v - m->prev[i]) / secs);
+            m->prev[i] = v;
+            m->rate[i] = rate;
+            row_rate += rate;
+            m->col_rate[c] += rate;
+            if (rate > top_rate) { top_rate = rate; top = c; }
+        }
+        m->row_rate[r] = row_rate;
+        m->row_top[r] = top;
+        m->total_rate += row_rate;
+
+        const char *eol = strchr(p, '\n');
+        // numbered IRQs end with the device name; append it once when the row is (re)named
+        if (fresh && name[0] >= '0' && name[0] <= '9') {
+            const char *end = eol ? eol : p + strlen(p);
+            while (end > p && end[-1] == ' ') end--;
+            const char *dev = end;
+            while (dev > p && dev[-1] != ' ') dev--;
+            if (dev < end) snprintf(name + klen, IRQ_NAME_LEN - klen, ":%.*s", (int)(end - dev), dev);
+        }
+        p = eol;
+        r++;
+    }
+    m->nrows = r;
+    m->prev_ts = now;
+    return 1;
+}
+
+void get_interrupts(int *ok) {
+    static int warned;
+    *ok = get_irq_matrix(&irq_hw) & get_irq_matrix(&irq_soft);
+    if (!*ok && !warned) {
+        write_log("Warning: Failed to read /proc/interrupts or /proc/softirqs: %s", strerror(errno));
+        warned = 1;
+    }
+}
+
+// % of a source's interrupts handled by its busiest CPU
+double irq_row_share(const struct irq_matrix *m, int r) {
+    if (m->row_rate[r] <= 0.0) return 0.0;
+    return m->rate[(size_t)m->row_top[r] * m->max_rows + r] * 100.0 / m->row_rate[r];
+}
+
+/*
+ * Raises an alert for each source busy enough to matter whose interrupts
+ * land mostly on one CPU, e.g. NET_RX softirq pinned to a single core. Used
+ * for softirqs only: hardware vectors such as MSI-X queues are pinned to one
+ * CPU on purpose, see check_irq_cpu_spread().
+ */
+void check_irq_balance(const struct irq_matrix *m, const char *prefix, const struct cpu_sample *cur) {
+    if (m->ncols < 2) return;
+    for (int r = 0; r < m->nrows; ++r) {
+        if (m->row_rate[r] < IRQ_IMBALANCE_MIN_RATE) continue;
+        double share = irq_row_share(m, r);
+        if (share >= IRQ_IMBALANCE_SHARE) {
+            char kind[48];
+            snprintf(kind, sizeof(kind), "%s:%s@cpu%d", prefix, m->name[r], m->col_cpu[m->row_top[r]]);
+            raise_alert(kind, share, "%", IRQ_IMBALANCE_SHARE, cur);
+        }
+    }
+}
+
+/*
+ * Raises an alert when one CPU takes IRQ_IMBALANCE_CPU_RATIO times the mean
+ * of all sources together, i.e. when the pinned vectors do not add up to an
+ * even spread (all queues of a NIC on one core, irqbalance not running).
+ */
+void check_irq_cpu_spread(const struct irq_matrix *m, const char *prefix, const struct cpu_sample *cur) {
+    if (m->ncols < 2 || m->total_rate < IRQ_IMBALANCE_MIN_RATE) return;
+    int top = 0;
+    for (int c = 1; c < m->ncols; ++c) {
+        if (m->col_rate[c] > m->col_rate[top]) top = c;
+    }
+    double ratio = m->col_rate[top] / (m->total_rate / m->ncols);
+    if (ratio >= IRQ_IMBALANCE_CPU_RATIO) {
+        char kind[48];
+        snprintf(kind, sizeof(kind), "%s@cpu%d", prefix, m->col_cpu[top]);
+        raise_alert(kind, ratio, "x", IRQ_IMBALANCE_CPU_RATIO, cur);
+    }
+}
+
+/*
+ * Draws the busiest sources of m as an IRQ x CPU heatmap starting at row and
+ * returns the next free row. Each cell is shaded relative to the hottest CPU
+ * of its own source, so a row of '@' on one column means a pinned source.
+ */
+int draw_irq_heatmap(const struct irq_matrix *m, const char *title, int row) {
+    static const char shades[] = " .:-=+*#%@";
+    const int label_w = 24, rate_w = 10;
+    int cols = m->ncols;
+    if (cols > COLS - label_w - rate_w - 2) cols = COLS - label_w - rate_w - 2;
+    if (cols <= 0 || row >= LINES) return row;
+
+    // pick the busiest sources with a partial selection sort over their indexes
+    int pick[IRQ_HEATMAP_ROWS], npick = 0;
+    for (int r = 0; r < m->nrows; ++r) {
+        if (m->row_rate[r] <= 0.0) continue;
+        int i;
+        if (npick < IRQ_HEATMAP_ROWS) i = npick++;
+        else if (m->row_rate[pick[IRQ_HEATMAP_ROWS - 1]] < m->row_rate[r]) i = IRQ_HEATMAP_ROWS - 1;
+        else continue;
+        for (; i > 0 && m->row_rate[pick[i - 1]] < m->row_rate[r]; --i) pick[i] = pick[i - 1];
+        pick[i] = r;
+    }
+
+    mvprintw(row, 0, "%-*s %*s ", label_w - 1, title, rate_w, "/s");
+    for (int c = 0; c < cols; ++c) addch('0' + m->col_cpu[c] % 10);
+    row++;
+    for (int k = 0; k < npick && row < LINES; ++k, ++row) {
+        int r = pick[k];
+        float top = m->rate[(size_t)m->row_top[r] * m->max_rows + r];
+        mvprintw(row, 0, "%-*.*s %*.0f ", label_w - 1, label_w - 1, m->name[r], rate_w, m->row_rate[r]);
+        for (int c = 0; c < cols; ++c) {
+            float v = m->rate[(size_t)c * m->max_rows + r];
+            int level = v > 0.0f && top > 0.0f ? 1 + (int)(v / top * 8.999f) : 0;
+            addch(shades[level]);
+        }
+    }
+    return row;
+}
+#else
+void get_interrupts(int *ok) { *ok = 0; }
+#endif
+
+#if ENABLE_QUERY_SOCKET
+void query_open() {
+    for (int i = 0; i < QUERY_MAX_CLIENTS; ++i) query_clients[i].fd = -1;
+    query_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (query_sock < 0) {
+        fprintf(stderr, "Warning: could not create query socket: %s\n", strerror(errno));
+        return;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", QUERY_SOCKET_PATH);
+    unlink(QUERY_SOCKET_PATH); // stale socket from a previous run
+    if (bind(query_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(query_sock, 16) != 0) {
+        fprintf(stderr, "Warning: could not listen on '%s': %s\n", QUERY_SOCKET_PATH, strerror(errno));
+        close(query_sock);
+        query_sock = -1;
+        return;
+    }
+    write_log("Answering queries on %s", QUERY_SOCKET_PATH);
+}
+
+static void query_drop_client(struct query_client *c) {
+    close(c->fd);
+    c->fd = -1;
+}
+
+void query_close() {
+    for (int i = 0; i < QUERY_MAX_CLIENTS; ++i) {
+        if (query_clients[i].fd >= 0) query_drop_client(&query_clients[i]);
+    }
+    if (query_sock >= 0) {
+        close(query_sock);
+        unlink(QUERY_SOCKET_PATH);
+    }
+    query_sock = -1;
+}
+
+// Appends formatted text to the client's response buffer; returns 0 if it does not fit.
+static int query_printf(struct query_client *c, const char *fmt, ...) {
+    size_t room = sizeof(c->out) - c->out_len;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(c->out + c->out_len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= room) return 0;
+    c->out_len += n;
+    return 1;
+}
+
+// Moves pending "range" rows into the response buffer until it is full.
+// The last step of a range (range_end - 1) is the terminating END line.
+static void query_fill_range(struct query_client *c) {
+    while (c->range_next + 1 < c->range_end) {
+        if (c->range_next < history_first()) {
+            c->range_next = history_first(); // overwritten while streaming
+            continue;
+        }
+        const struct history_entry *h = &history[c->range_next % HISTORY_LEN];
+        if (h->ts > c->range_t1) {
+            c->range_next = c->range_end - 1;
+            break;
+        }
+        if (!query_printf(c, "%.3f %.2f %.2f %.2f %.2f %d\n", h->ts, h->usage, h->loadavg1, h->loadavg5, h->loadavg15, h->alert)) return;
+        c->range_next++;
+    }
+    if (c->range_next < c->range_end && query_printf(c, "END\n")) c->range_next = c->range_end;
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static void query_percentiles(struct query_client *c, const char *args) {
+    double window = 60.0;
+    const char *w = strstr(args, "window=");
+    if (w) {
+        char *end;
+        window = strtod(w + 7, &end);
+        if (*end == 'm') window *= 60.0;
+        else if (*end == 'h') window *= 3600.0;
+        if (window <= 0.0) {
+            query_printf(c, "ERR bad window\nEND\n");
+            return;
+        }
+    }
+    if (history_count == 0) {
+        query_printf(c, "ERR no samples yet\nEND\n");
+        return;
+    }
+    double t_end = history[(history_count - 1) % HISTORY_LEN].ts;
+    size_t n = 0;
+    double sum = 0.0;
+    for (unsigned long long i = history_lower_bound(t_end - window); i < history_count; ++i) {
+        float u = history[i % HISTORY_LEN].usage;
+        query_scratch[n++] = u;
+        sum += u;
+    }
+    qsort(query_scratch, n, sizeof(query_scratch[0]), cmp_float);
+#define PCT(p) query_scratch[(size_t)((p) / 100.0 * (n - 1) + 0.5)]
+    query_printf(c, "window=%.0fs samples=%zu mean=%.2f min=%.2f p50=%.2f p90=%.2f p95=%.2f p99=%.2f max=%.2f\nEND\n",
+                 window, n, sum / n, query_scratch[0], PCT(50), PCT(90), PCT(95), PCT(99), query_scratch[n - 1]);
+#undef PCT
+}
+
+static void query_latest(struct query_client *c) {
+    if (history_count == 0) {
+        query_printf(c, "ERR no samples yet\nEND\n");
+        return;
+    }
+    unsigned long long slot = (history_count - 1) % HISTORY_LEN;
+    const struct history_entry *h = &history[slot];
+    query_printf(c, "ts=%.3f cpu=%.2f load=%.2f/%.2f/%.2f alert=%d",
+                 h->ts, h->usage, h->loadavg1, h->loadavg5, h->loadavg15, h->alert);
+    for (int f = 0; f < CPU_TIME_FIELDS; ++f) query_printf(c, " %s=%.2f", cpu_time_names[f], h->breakdown[f]);
+    query_printf(c, " cores=");
+    for (int i = 0; i < h->ncores; ++i) {
+        if (history_core[slot][i] == HISTORY_CORE_OFFLINE) query_printf(c, i ? ",-" : "-");
+        else query_printf(c, i ? ",%.2f" : "%.2f", history_core[slot][i] / 100.0);
+    }
+    query_printf(c, "\nEND\n");
+}
+
+static void query_top_procs(struct query_client *c) {
+#if TRACK_PROCS
+    query_printf(c, "source=%s processes=%d\n", proc_source == PROC_SOURCE_EBPF ? "ebpf" : "procfs", procs_seen);
+    for (int i = 0; i < top_procs_count; ++i) {
+        query_printf(c, "%d %s %.2f\n", top_procs[i].pid, top_procs[i].comm, top_procs[i].cpu);
+    }
+    query_printf(c, "END\n");
+#else
+    query_printf(c, "ERR process tracking disabled (TRACK_PROCS)\nEND\n");
+#endif
+}
+
+static void query_net(struct query_client *c) {
+    if (!last_sample) {
+        query_printf(c, "ERR no samples yet\nEND\n");
+        return;
+    }
+    for (int n = 0; n < last_sample->nnets; ++n) {
+        const struct net_rate *nr = &last_sample->nets[n];
+        query_printf(c, "%s rx_bytes=%.0f tx_bytes=%.0f rx_packets=%.0f tx_packets=%.0f rx_drops=%.0f tx_drops=%.0f"
+                     " rx_errors=%.0f tx_errors=%.0f\n", nr->name, nr->rx_bytes, nr->tx_bytes, nr->rx_packets,
+                     nr->tx_packets, nr->rx_drops, nr->tx_drops, nr->rx_errors, nr->tx_errors);
+    }
+    query_printf(c, "END\n");
+}
+
+/*
+ * Commands, one per line; every response ends with a line "END":
+ *   latest                    most recent sample with per-core usage
+ *   range <t0> <t1>           "ts cpu load1 load5 load15 alert" rows, epoch seconds
+ *   percentiles [window=60s]  usage distribution over the trailing window (s, m or h)
+ *   top-procs                 hottest processes over the last interval
+ *   net                       per-interface rates from the last sample
+ */
+static void query_dispatch(struct query_client *c, char *line) {
+    while (*line == ' ') line++;
+    if (strcmp(line, "latest") == 0) {
+        query_latest(c);
+    } else if (strncmp(line, "range", 5) == 0) {
+        double t0, t1;
+        if (sscanf(line + 5, "%lf %lf", &t0, &t1) != 2 || t1 < t0) {
+            query_printf(c, "ERR usage: range <t0> <t1>\nEND\n");
+            return;
+        }
+        c->range_next = history_lower_bound(t0);
+        c->range_end = history_count + 1;
+        c->range_t1 = t1;
+        query_fill_range(c);
+    } else if (strncmp(line, "percentiles", 11) == 0) {
+        query_percentiles(c, line + 11);
+    } else if (strcmp(line, "top-procs") == 0) {
+        query_top_procs(c);
+    } else if (strcmp(line, "net") == 0) {
+        query_net(c);
+    } else {
+        query_printf(c, "ERR unknown command (latest, range, percentiles, top-procs, net)\nEND\n");
+    }
+}
+
+// Runs buffered commands as long as no response is still being sent.
+static void query_process_input(struct query_client *c) {
+    while (c->out_len == 0 && c->range_next >= c->range_end) {
+        char *nl = memchr(c->in, '\n', c->in_len);
+        if (!nl) {
+            if (c->in_len == sizeof(c->in)) query_drop_client(c); // line too long
+            return;
+        }
+        *nl = '\0';
+        if (nl > c->in && nl[-1] == '\r') nl[-1] = '\0';
+        query_dispatch(c, c->in);
+        size_t used = nl + 1 - c->in;
+        memmove(c->in, nl + 1, c->in_len - used);
+        c->in_len -= used;
+    }
+}
+
+static void query_client_ready(void *arg, short revents) {
+    struct query_client *c = arg;
+    if (c->fd < 0) return;
+    if (revents & POLLOUT) {
+        ssize_t w = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            query_drop_client(c);
+            return;
+        }
+        if (w > 0) c->out_sent += w;
+        if (c->out_sent == c->out_len) {
+            c->out_len = c->out_sent = 0;
+            if (c->range_next < c->range_end) query_fill_range(c);
+            else query_process_input(c);
+        }
+        return;
+    }
+    ssize_t r = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (r <= 0) {
+        query_drop_client(c);
+        return;
+    }
+    c->in_len += r;
+    query_process_input(c);
+}
+
+static void query_accept(void *arg, short revents) {
+    for (;;) {
+        int fd = accept4(query_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        struct query_client *slot = NULL;
+        for (int i = 0; i < QUERY_MAX_CLIENTS; ++i) {
+            if (query_clients[i].fd < 0) { slot = &query_clients[i]; break; }
+        }
+        if (!slot) {
+            close(fd);
+            continue;
+        }
+        slot->fd = fd;
+        slot->in_len = slot->out_len = slot->out_sent = 0;
+        slot->range_next = slot->range_end = 0;
+    }
+}
+
+void query_poll_fds() {
+    if (query_sock < 0) return;
+    add_poll_fd(query_sock, POLLIN, query_accept, NULL);
+    for (int i = 0; i < QUERY_MAX_CLIENTS; ++i) {
+        struct query_client *c = &query_clients[i];
+        if (c->fd >= 0) add_poll_fd(c->fd, c->out_len > c->out_sent ? POLLOUT : POLLIN, query_client_ready, c);
+    }
+}
+#else
+void query_open() {}
+void query_close() {}
+void query_poll_fds() {}
+#endif
+
+/*
+ * Sleeps for usec while serving any network clients that become ready.
+ * Each subsystem adds its descriptors through add_poll_fd() with a handler
+ * that is called when the descriptor has events.
+ */
+static struct pollfd poll_fds[MAX_POLL_FDS];
+static poll_handler poll_handlers[MAX_POLL_FDS];
+static void *poll_args[MAX_POLL_FDS];
+static int poll_nfds;
+
+void add_poll_fd(int fd, short events, poll_handler handler, void *arg) {
+    if (fd < 0 || poll_nfds >= MAX_POLL_FDS) return;
+    poll_fds[poll_nfds].fd = fd;
+    poll_fds[poll_nfds].events = events;
+    poll_fds[poll_nfds].revents = 0;
+    poll_handlers[poll_nfds] = handler;
+    poll_args[poll_nfds++] = arg;
+}
+
+void wait_for_events(long usec) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long remaining = usec;
+    while (keep_running && remaining > 0) {
+        poll_nfds = 0;
+        metrics_poll_fds();
+        query_poll_fds();
+        if (poll_nfds == 0) {
+            usleep(remaining);
+            return;
+        }
+        int rc = poll(poll_fds, poll_nfds, (int)((remaining + 999) / 1000));
+        if (rc < 0 && errno != EINTR) {
+            usleep(remaining);
+            return;
+        }
+        // handlers may close descriptors; each one re-checks its own state
+        for (int i = 0; rc > 0 && i < poll_nfds; ++i) {
+            if (poll_fds[i].revents) poll_handlers[i](poll_args[i], poll_fds[i].revents);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = usec - ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000);
+    }
+}
+
+/*
+ * -I N: runs N ticks of the per-tick /proc readers and log writes with each
+ * I/O engine and prints system calls and time per tick. System calls are
+ * counted with the raw_syscalls:sys_enter tracepoint when perf can open it,
+ * otherwise from the read/write counters in /proc/self/io.
+ */
+static int bench_syscall_counter() {
+    static const char *const id_paths[] = { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                                            "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" };
+    for (size_t i = 0; i < sizeof(id_paths) / sizeof(id_paths[0]); ++i) {
+        int id = read_sysfs_int(id_paths[i], -1);
+        if (id < 0) continue;
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.config = (unsigned long long)id;
+        attr.disabled = 1;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd >= 0) return fd;
+    }
+    return -1;
+}
+
+static unsigned long long bench_proc_io_calls() {
+    char buf[512];
+    int fd = -1;
+    unsigned long long r = 0, w = 0;
+    if (pread_file(&fd, "/proc/self/io", buf, sizeof(buf)) > 0) {
+        const char *p = strstr(buf, "syscr:");
+        if (p) parse_ull(p + 6, &r);
+        p = strstr(buf, "syscw:");
+        if (p) parse_ull(p + 6, &w);
+    }
+    if (fd >= 0) close(fd);
+    return r + w;
+}
+
+int bench_io_engines(int ticks) {
+    static unsigned long long times[(MAX_CPUS + 1) * CPU_TIME_FIELDS], counters[STAT_COUNTERS];
+    static unsigned char seen[MAX_CPUS];
+    static struct sched_sample sched;
+    static struct mem_sample mem;
+    static struct disk_rate disks[MAX_DISKS];
+    static struct net_rate nets[MAX_NETS];
+    int ncores, ndisks, nnets, ok;
+    double l1, l5, l15, up;
+    const int log_lines = 10;      // about what one monitor tick writes
+    int counter = bench_syscall_counter();
+    printf("%d ticks, %d log lines per tick, counting %s\n", ticks, log_lines,
+           counter >= 0 ? "all system calls (raw_syscalls tracepoint)" : "read/write system calls only (/proc/self/io)");
+    // the bench lines go to a scratch directory, not into the live log or anything it rotates
+    char scratch[] = "/tmp/cpu_monitor-bench-XXXXXX";
+    static char bench_log[64];
+    if (!mkdtemp(scratch)) {
+        fprintf(stderr, "Error: cannot create a scratch directory for the benchmark log: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(bench_log, sizeof(bench_log), "%s/bench.log", scratch);
+    log_path = bench_log;
+    open_log();
+
+    for (int engine = IO_ENGINE_PREAD; engine <= IO_ENGINE_URING; ++engine) {
+        if (engine == IO_ENGINE_URING && uring_open() != 0) {
+            printf("%-6s unavailable: %s\n", "uring", strerror(errno));
+            continue;
+        }
+        unsigned long long calls = 0, io0 = 0;
+        double wall = 0.0;
+        for (int t = -2; t < ticks; ++t) { // two warm-up ticks open files and register them
+            struct timespec t0, t1;
+            if (t == 0) {
+                if (counter >= 0) {
+                    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+                    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+                } else {
+                    io0 = bench_proc_io_calls();
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            uring_tick();
+            get_cpu_times(times, counters, seen, &ncores, &ok);
+            get_sched_stats(counters, &sched);
+            get_system_info(&l1, &l5, &l15, &up, &ok);
+            get_mem_info(&mem, &ok);
+            get_disk_stats(disks, &ndisks, &ok);
+            get_net_stats(nets, &nnets, &ok);
+            for (int l = 0; l < log_lines; ++l) write_log("Bench: tick %d line %d load %.2f", t, l, l1);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (t >= 0) wall += (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+            if (t == ticks - 1) {
+                if (counter >= 0) {
+                    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(counter, &calls, sizeof(calls)) != (ssize_t)sizeof(calls)) calls = 0;
+                } else {
+                    calls = bench_proc_io_calls() - io0 - 1; // less the read of /proc/self/io itself
+                }
+            }
+        }
+        printf("%-6s %8.1f syscalls/tick %10.1f us/tick\n", engine == IO_ENGINE_URING ? "uring" : "pread",
+               (double)calls / ticks, wall / ticks);
+        if (engine == IO_ENGINE_URING) uring_close();
+    }
+    if (counter >= 0) close(counter);
+    close_log();
+    DIR *dir = opendir(scratch);
+    struct dirent *de;
+    char path[400];
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%.300s", scratch, de->d_name);
+        unlink(path);
+    }
+    if (dir) closedir(dir);
+    rmdir(scratch);
+    return 0;
+}
+
+/*
+ * Writes n values in 0..100 as a sparkline of n characters: Unicode block
+ * elements on a UTF-8 terminal, otherwise an ASCII ramp. Negative values
+ * (no sample) are blanks. Returns the bytes written, excluding the NUL.
+ */
+int sparkline(char *out, size_t size, const float *vals, int n) {
+    static const char *const blocks[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+    static const char ramp[] = "_.-:=+*#";
+    size_t len = 0;
+    for (int i = 0; i < n; ++i) {
+        float v = vals[i];
+        int level = v >= 100.0f ? 7 : (int)(v * 8.0f / 100.0f);
+        if (len + 4 > size) break;
+        if (v < 0.0f) out[len++] = ' ';
+        else if (ui_utf8) {
+            memcpy(out + len, blocks[level], 3);
+            len += 3;
+        } else out[len++] = ramp[level];
+    }
+    if (size > 0) out[len] = '\0';
+    return (int)len;
+}
+
+#if ENABLE_FLEET
+/*
+ * Fleet view. A monitor started with -u HOST[:PORT] sends one line per sample,
+ * "FLEET <host> <usage> <load1> <mem%> <ncores> <alert>", to a viewer started
+ * with -f. The viewer keeps every host with a short usage history and draws a
+ * sortable, scrollable table. Only the rows on screen are formatted, and a row
+ * whose text is the same as in the previous frame is not sent to ncurses.
+ */
+struct fleet_host {
+    char name[64];
+    float usage, load1, mem_pct;
+    int ncores, alert;
+    double last_seen;              // monotonic seconds
+    float spark[FLEET_SPARK_LEN];  // usage history, oldest at spark_pos
+    int spark_pos;
+    int stale;                     // counted in fleet_stale; set by fleet_sweep, cleared by a sample
+};
+enum { FLEET_SORT_CPU, FLEET_SORT_LOAD, FLEET_SORT_MEM, FLEET_SORT_NAME, FLEET_SORT_SEEN, FLEET_SORTS };
+static const char *fleet_sort_names[FLEET_SORTS] = {"cpu", "load", "mem", "name", "last seen"};
+static struct fleet_host *fleet_hosts;
+static int fleet_nhosts;
+static int fleet_index[FLEET_MAX_HOSTS * 2]; // host + 1, 0 = empty
+static int fleet_order[FLEET_MAX_HOSTS];     // host indexes in display order
+static int fleet_sort = FLEET_SORT_CPU, fleet_reverse = 0;
+static int fleet_order_dirty = 0;            // sort column, order or host set changed since the last sort
+static int fleet_alerting, fleet_stale;      // kept up to date as samples arrive, not counted per frame
+static unsigned long long fleet_msgs, fleet_bad, fleet_dropped;
+static char (*fleet_drawn)[FLEET_LINE_BYTES]; // text of each screen row as last drawn
+static int fleet_drawn_rows;
+static int fleet_tx = -1;
+static struct sockaddr_in fleet_addr;
+static char fleet_hostname[64];
+static int fleet_tx_failed = 0;
+
+int fleet_send_open(const char *target) {
+    char host[256];
+    int port = FLEET_PORT;
+    snprintf(host, sizeof(host), "%s", target);
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = atoi(colon + 1);
+    }
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (port <= 0 || port > 65535 || getaddrinfo(host, NULL, &hints, &res) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&fleet_addr, res->ai_addr, sizeof(fleet_addr));
+    fleet_addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    fleet_tx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fleet_tx < 0) return -1;
+    if (gethostname(fleet_hostname, sizeof(fleet_hostname)) != 0) snprintf(fleet_hostname, sizeof(fleet_hostname), "unknown");
+    fleet_hostname[sizeof(fleet_hostname) - 1] = '\0';
+    for (char *c = fleet_hostname; *c; ++c) {
+        if (*c == ' ') *c = '_';
+    }
+    return 0;
+}
+
+void fleet_send(const struct cpu_sample *cur) {
+    if (fleet_tx < 0 || !cur->valid) return;
+    char msg[160];
+    int len = snprintf(msg, sizeof(msg), "FLEET %s %.2f %.2f %.2f %d %d\n", fleet_hostname, cur->usage, cur->loadavg1,
+                       cur->mem.used_pct, cur->ncores, cur->alert);
+    if (sendto(fleet_tx, msg, len, 0, (struct sockaddr *)&fleet_addr, sizeof(fleet_addr)) < 0) {
+        if (!fleet_tx_failed) write_log("Warning: fleet send failed: %s", strerror(errno));
+        fleet_tx_failed = 1;
+    } else {
+        fleet_tx_failed = 0;
+    }
+}
+
+void fleet_send_close() {
+    if (fleet_tx >= 0) close(fleet_tx);
+    fleet_tx = -1;
+}
+
+static struct fleet_host *fleet_lookup(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const char *c = name; *c; ++c) h = (h ^ (unsigned char)*c) * 16777619u;
+    uint32_t mask = FLEET_MAX_HOSTS * 2 - 1;
+    for (uint32_t slot = h & mask;; slot = (slot + 1) & mask) {
+        int i = fleet_index[slot];
+        if (i == 0) {
+            if (fleet_nhosts == FLEET_MAX_HOSTS) return NULL;
+            struct fleet_host *host = &fleet_hosts[fleet_nhosts];
+            memset(host, 0, sizeof(*host));
+            snprintf(host->name, sizeof(host->name), "%s", name);
+            for (int s = 0; s < FLEET_SPARK_LEN; ++s) host->spark[s] = -1.0f;
+            fleet_order[fleet_nhosts] = fleet_nhosts;
+            fleet_index[slot] = ++fleet_nhosts;
+            fleet_order_dirty = 1;
+            return host;
+        }
+        if (strcmp(fleet_hosts[i - 1].name, name) == 0) return &fleet_hosts[i - 1];
+    }
+}
+
+// drains every datagram waiting on the socket, in batches of FLEET_RECV_BATCH
+static void fleet_receive(int sock) {
+    static char bufs[FLEET_RECV_BATCH][256];
+    static struct iovec iov[FLEET_RECV_BATCH];
+    static struct mmsghdr msgs[FLEET_RECV_BATCH];
+    for (;;) {
+        for (int i = 0; i < FLEET_RECV_BATCH; ++i) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]) - 1;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(sock, msgs, FLEET_RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) return;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (int i = 0; i < n; ++i) {
+            char name[64];
+            float usage, load1, mem;
+            int ncores, alert;
+            bufs[i][msgs[i].msg_len] = '\0';
+            if (sscanf(bufs[i], "FLEET %63s %f %f %f %d %d", name, &usage, &load1, &mem, &ncores, &alert) != 6) {
+                fleet_bad++;
+                continue;
+            }
+            struct fleet_host *host = fleet_lookup(name);
+            if (!host) {
+                fleet_dropped++;
+                continue;
+            }
+            fleet_alerting += (alert != 0) - (host->alert && !host->stale);
+            if (host->stale) fleet_stale--;
+            host->stale = 0;
+            host->usage = usage;
+            host->load1 = load1;
+            host->mem_pct = mem;
+            host->ncores = ncores;
+            host->alert = alert != 0;
+            host->last_seen = now.tv_sec + now.tv_nsec / 1e9;
+            host->spark[host->spark_pos] = usage;
+            host->spark_pos = (host->spark_pos + 1) % FLEET_SPARK_LEN;
+            fleet_msgs++;
+        }
+        if (n < FLEET_RECV_BATCH) return;
+    }
+}
+
+static int fleet_compare(const void *a, const void *b) {
+    const struct fleet_host *x = &fleet_hosts[*(const int *)a], *y = &fleet_hosts[*(const int *)b];
+    int c;
+    switch (fleet_sort) {
+    case FLEET_SORT_LOAD: c = (x->load1 < y->load1) - (x->load1 > y->load1); break;
+    case FLEET_SORT_MEM: c = (x->mem_pct < y->mem_pct) - (x->mem_pct > y->mem_pct); break;
+    case FLEET_SORT_SEEN: c = (x->last_seen < y->last_seen) - (x->last_seen > y->last_seen); break;
+    case FLEET_SORT_NAME: c = 0; break;
+    default: c = (x->usage < y->usage) - (x->usage > y->usage); break;
+    }
+    if (c == 0) c = strcmp(x->name, y->name); // stable order for equal keys, so rows do not jump
+    return fleet_reverse ? -c : c;
+}
+
+// cuts a UTF-8 line after cols screen columns, so a long row never wraps onto the next
+static void fit_columns(char *line, int cols) {
+    int col = 0;
+    for (char *c = line; *c; ++c) {
+        if (((unsigned char)*c & 0xC0) == 0x80) continue; // continuation byte of the same character
+        if (col++ == cols) {
+            *c = '\0';
+            return;
+        }
+    }
+}
+
+// formats one table row; only called for rows that are on screen
+static void fleet_format_row(char *line, size_t size, const struct fleet_host *host, double now) {
+    float hist[FLEET_SPARK_LEN];
+    for (int s = 0; s < FLEET_SPARK_LEN; ++s) hist[s] = host->spark[(host->spark_pos + s) % FLEET_SPARK_LEN];
+    char spark[FLEET_SPARK_LEN * 3 + 1];
+    sparkline(spark, sizeof(spark), hist, FLEET_SPARK_LEN);
+    double age = now - host->last_seen;
+    snprintf(line, size, "%-24.24s %6.1f%% %s %6.2f %5.1f%% %5d %6.0fs %s", host->name, host->usage, spark,
+             host->load1, host->mem_pct, host->ncores, age, age > FLEET_STALE_S ? "STALE" : host->alert ? "ALERT" : "");
+}
+
+// marks hosts that went silent; hosts come back from STALE in fleet_receive()
+static void fleet_sweep(double now) {
+    for (int i = 0; i < fleet_nhosts; ++i) {
+        struct fleet_host *host = &fleet_hosts[i];
+        if (host->stale || now - host->last_seen <= FLEET_STALE_S) continue;
+        host->stale = 1;
+        fleet_stale++;
+        if (host->alert) fleet_alerting--;
+    }
+}
+
+/*
+ * Redraws the screen. The whole table is re-sorted and swept for stale hosts
+ * only when the sort column, its direction or the set of hosts changes, and
+ * otherwise every FLEET_SORT_MS, so most frames cost only the screen height.
+ * Returns the number of rows sent to ncurses.
+ */
+static int fleet_draw(int top, double now, double rx_rate, double frame_ms) {
+    static double next_sort = 0.0;
+    int rows = LINES - 4;
+    if (rows < 1) rows = 1;
+    if (fleet_drawn_rows != LINES) {
+        free(fleet_drawn);
+        fleet_drawn = calloc(LINES, sizeof(*fleet_drawn));
+        fleet_drawn_rows = fleet_drawn ? LINES : 0;
+        clear();
+    }
+    if (fleet_order_dirty || now >= next_sort) {
+        fleet_sweep(now);
+        qsort(fleet_order, fleet_nhosts, sizeof(int), fleet_compare);
+        fleet_order_dirty = 0;
+        next_sort = now + FLEET_SORT_MS / 1e3;
+    }
+
+    char line[FLEET_LINE_BYTES];
+    int drawn = 0;
+    for (int r = 0; r < LINES; ++r) {
+        int idx = top + r - 3;
+        if (r == 0) {
+            snprintf(line, sizeof(line), "Fleet: %d hosts, %d alerting, %d stale | %.0f samples/s | sort: %s%s | frame %.2f ms",
+                     fleet_nhosts, fleet_alerting, fleet_stale, rx_rate, fleet_sort_names[fleet_sort], fleet_reverse ? " (reversed)" : "",
+                     frame_ms);
+        } else if (r == 1) {
+            snprintf(line, sizeof(line), "Rows %d-%d of %d | Up/Down/PgUp/PgDn/Home/End scroll, s: sort column, r: reverse, q: quit",
+                     fleet_nhosts ? top + 1 : 0, top + rows < fleet_nhosts ? top + rows : fleet_nhosts, fleet_nhosts);
+        } else if (r == 2) {
+            snprintf(line, sizeof(line), "%-24s %7s %-*s %6s %6s %5s %7s", "HOST", "CPU", FLEET_SPARK_LEN, "HISTORY", "LOAD1",
+                     "MEM", "CORES", "SEEN");
+        } else if (r == LINES - 1 || idx >= fleet_nhosts) {
+            line[0] = '\0';
+        } else {
+            fleet_format_row(line, sizeof(line), &fleet_hosts[fleet_order[idx]], now);
+        }
+        fit_columns(line, COLS);
+        if (fleet_drawn && strcmp(line, fleet_drawn[r]) == 0) continue;
+        int bold = r == 2 || strstr(line, " ALERT") != NULL;
+        if (bold) attron(A_BOLD);
+        mvaddstr(r, 0, line);
+        clrtoeol();
+        if (bold) attroff(A_BOLD);
+        if (fleet_drawn) snprintf(fleet_drawn[r], FLEET_LINE_BYTES, "%s", line);
+        drawn++;
+    }
+    refresh();
+    return drawn;
+}
+
+/*
+ * Starts a child that sends samples for n synthetic hosts every FLEET_FRAME_MS
+ * to the viewer on this machine, to try the view at fleet scale.
+ */
+static pid_t fleet_load_start(int port, int n) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    signal(SIGINT, SIG_IGN);       // the viewer stops this child with SIGTERM, or it dies with the viewer
+    signal(SIGTERM, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to = {0};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    float *usage = calloc(n, sizeof(float));
+    static char bufs[FLEET_RECV_BATCH][160];
+    struct iovec iov[FLEET_RECV_BATCH];
+    struct mmsghdr msgs[FLEET_RECV_BATCH];
+    unsigned int seed = (unsigned int)getpid();
+    for (int i = 0; i < n; ++i) usage[i] = (float)(rand_r(&seed) % 100);
+    for (;;) {
+        for (int i = 0; i < n;) {
+            int batch = 0;
+            for (; batch < FLEET_RECV_BATCH && i < n; ++batch, ++i) {
+                usage[i] += (float)(rand_r(&seed) % 21 - 10);
+                if (usage[i] < 0.0f) usage[i] = 0.0f;
+                if (usage[i] > 100.0f) usage[i] = 100.0f;
+                int len = snprintf(bufs[batch], sizeof(bufs[batch]), "FLEET host%05d %.2f %.2f %.2f %d %d\n", i, usage[i],
+                                   usage[i] / 25.0f, 40.0f + (i % 50), 4 << (i % 4), usage[i] >= ALERT_THRESHOLD);
+                iov[batch].iov_base = bufs[batch];
+                iov[batch].iov_len = len;
+                memset(&msgs[batch], 0, sizeof(msgs[batch]));
+                msgs[batch].msg_hdr.msg_name = &to;
+                msgs[batch].msg_hdr.msg_namelen = sizeof(to);
+                msgs[batch].msg_hdr.msg_iov = &iov[batch];
+                msgs[batch].msg_hdr.msg_iovlen = 1;
+            }
+            sendmmsg(sock, msgs, batch, 0);
+        }
+        usleep(FLEET_FRAME_MS * 1000);
+    }
+}
+
+/*
+ * Runs the fleet view (-f) until 'q' or a signal: receives samples on
+ * FLEET_PORT and redraws every FLEET_FRAME_MS, or at once after a key.
+ */
+int fleet_view(int port, int load_hosts) {
+    fleet_hosts = calloc(FLEET_MAX_HOSTS, sizeof(struct fleet_host));
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!fleet_hosts || sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: cannot receive fleet samples on UDP port %d: %s\n", port, strerror(errno));
+        if (sock >= 0) close(sock);
+        free(fleet_hosts);
+        return 1;
+    }
+    int rcvbuf = FLEET_RCVBUF_BYTES;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    pid_t loader = load_hosts > 0 ? fleet_load_start(port, load_hosts) : -1;
+
+    initscr();
+    noecho();
+    cbreak();
+    keypad(stdscr, TRUE);
+    timeout(0);
+    curs_set(FALSE);
+
+    int top = 0;
+    double frame_ms = 0.0, rx_rate = 0.0, next_frame = 0.0, rate_start = 0.0;
+    unsigned long long rate_msgs = 0;
+    while (keep_running) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        double now = ts.tv_sec + ts.tv_nsec / 1e9;
+        int redraw = now >= next_frame;
+        for (int ch; (ch = getch()) != ERR;) {
+            int page = LINES > 5 ? LINES - 4 : 1;
+            redraw = 1;
+            if (ch == 'q' || ch == 'Q') keep_running = 0;
+            else if (ch == KEY_UP) top--;
+            else if (ch == KEY_DOWN) top++;
+            else if (ch == KEY_PPAGE) top -= page;
+            else if (ch == KEY_NPAGE) top += page;
+            else if (ch == KEY_HOME) top = 0;
+            else if (ch == KEY_END) top = fleet_nhosts;
+            else if (ch == 's') {
+                fleet_sort = (fleet_sort + 1) % FLEET_SORTS;
+                fleet_order_dirty = 1;
+            } else if (ch == 'r') {
+                fleet_reverse = !fleet_reverse;
+                fleet_order_dirty = 1;
+            } else if (ch == KEY_RESIZE) fleet_drawn_rows = 0;
+        }
+        if (!keep_running) break;
+        if (redraw) {
+            if (now - rate_start >= 1.0) {
+                rx_rate = rate_start > 0.0 ? (fleet_msgs - rate_msgs) / (now - rate_start) : 0.0;
+                rate_msgs = fleet_msgs;
+                rate_start = now;
+            }
+            int max_top = fleet_nhosts - (LINES - 4);
+            if (top > max_top) top = max_top;
+            if (top < 0) top = 0;
+            fleet_draw(top, now, rx_rate, frame_ms);
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            frame_ms = (ts.tv_sec + ts.tv_nsec / 1e9 - now) * 1e3;
+            if (now >= next_frame) next_frame = now + FLEET_FRAME_MS / 1e3;
+        }
+        // sleep until the next frame, a datagram or a key
+        struct pollfd pfd[2] = {{sock, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        int wait_ms = (int)((next_frame - now) * 1e3) + 1;
+        if (poll(pfd, 2, wait_ms > 0 ? wait_ms : 0) > 0 && (pfd[0].revents & POLLIN)) fleet_receive(sock);
+    }
+
+    endwin();
+    if (loader > 0) {
+        kill(loader, SIGTERM);
+        waitpid(loader, NULL, 0);
+    }
+    close(sock);
+    printf("Fleet view: %d hosts, %llu samples received, %llu malformed, %llu from hosts over FLEET_MAX_HOSTS\n",
+           fleet_nhosts, fleet_msgs, fleet_bad, fleet_dropped);
+    free(fleet_drawn);
+    free(fleet_hosts);
+    return 0;
+}
+#else
+int fleet_send_open(const char *target) {
+    errno = ENOSYS;
+    return -1;
+}
+void fleet_send(const struct cpu_sample *cur) {}
+void fleet_send_close() {}
+int fleet_view(int port, int load_hosts) {
+    fprintf(stderr, "Error: built without ENABLE_FLEET\n");
+    return 1;
+}
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-p PID] [-s procfs|ebpf] [-e pread|uring] [-r FILE | -R FILE [-F]] [-u HOST[:PORT]] [-B N] [-I N]\n"
+            "       %s -f [-L N]\n"
+            "  -p PID     show the hottest thread groups of one process\n"
+            "  -s SOURCE  per-process CPU source: procfs scan or sched_switch eBPF (default %s)\n"
+            "  -e ENGINE  I/O for per-tick /proc reads and log writes: pread, or one io_uring batch per tick (default %s)\n"
+            "  -r FILE    record the per-tick /proc reads to FILE\n"
+            "  -R FILE    replay a recording at the recorded pace instead of reading /proc\n"
+            "  -F         replay as fast as possible and report ticks per second\n"
+            "  -u TARGET  send every sample to the fleet view at HOST[:PORT] (default port %d)\n"
+            "  -f         show the fleet view: samples from other monitors on UDP port %d\n"
+            "  -L N       with -f, also simulate N hosts sending from this machine\n"
+            "  -B N       start N idle processes, time both sources and exit\n"
+            "  -I N       count system calls per tick of both I/O engines over N ticks and exit\n",
+            prog, prog, PROC_SOURCE == PROC_SOURCE_EBPF ? "ebpf" : "procfs", IO_ENGINE == IO_ENGINE_URING ? "uring" : "pread",
+            FLEET_PORT, FLEET_PORT);
+}
+
+int main(int argc, char **argv) {
+    int bench_pids = 0, drill_pid = 0, bench_ticks = 0, io_engine = IO_ENGINE, fast = 0, fleet = 0, fleet_load = 0;
+    const char *record_path = NULL, *replay_path = NULL, *fleet_target = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:e:r:R:Fu:fL:B:I:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            drill_pid = atoi(optarg);
+            if (drill_pid <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "procfs") == 0) proc_source = PROC_SOURCE_PROCFS;
+            else if (strcmp(optarg, "ebpf") == 0) proc_source = PROC_SOURCE_EBPF;
+            else {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "pread") == 0) io_engine = IO_ENGINE_PREAD;
+            else if (strcmp(optarg, "uring") == 0) io_engine = IO_ENGINE_URING;
+            else {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'R':
+            replay_path = optarg;
+            break;
+        case 'F':
+            fast = 1;
+            break;
+        case 'u':
+            fleet_target = optarg;
+            break;
+        case 'f':
+            fleet = 1;
+            break;
+        case 'L':
+            fleet_load = atoi(optarg);
+            if (fleet_load <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'I':
+            bench_ticks = atoi(optarg);
+            if (bench_ticks <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'B':
+            bench_pids = atoi(optarg);
+            if (bench_pids <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (bench_pids) return bench_proc_sources(bench_pids);
+    if (bench_ticks) return bench_io_engines(bench_ticks);
+    if ((record_path && replay_path) || (fast && !replay_path) || (fleet_load && !fleet)) {
+        usage(argv[0]);
+        return 2;
+    }
+    // perf groups and profile rings hold PERF_EVENTS + 1 descriptors per CPU, past the usual 1024 on big hosts
+    struct rlimit rl;
+    long conf_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    rlim_t want_fds = (rlim_t)(conf_cpus > 0 ? conf_cpus : MAX_CPUS) * (PERF_EVENTS + 1) + 256;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < want_fds) {
+        rl.rlim_cur = rl.rlim_max < want_fds ? rl.rlim_max : want_fds;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    // only the character set: numbers in the log and exports keep the C locale's decimal point
+    setlocale(LC_CTYPE, "");
+    ui_utf8 = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+    if (fleet) {
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+        return fleet_view(FLEET_PORT, fleet_load);
+    }
+    int replay = replay_path != NULL;
+    if (replay && replay_open(replay_path, fast) != 0) {
+        fprintf(stderr, "Error: cannot replay %s: %s\n", replay_path, strerror(errno));
+        return 1;
+    }
+    if (replay && (drill_pid || io_engine != IO_ENGINE_PREAD || fleet_target)) {
+        fprintf(stderr, "Warning: -p, -e and -u do not apply to a replay, ignoring them\n");
+        drill_pid = 0;
+        io_engine = IO_ENGINE_PREAD;
+        fleet_target = NULL;
+    }
+    if (replay) {
+        // the replayed samples stay out of the live log and everything the live monitor serves
+        static char replay_log[512];
+        snprintf(replay_log, sizeof(replay_log), "%s.log", replay_path);
+        log_path = replay_log;
+    }
+    if (fleet_target && fleet_send_open(fleet_target) != 0) {
+        fprintf(stderr, "Error: cannot send samples to %s: %s\n", fleet_target, strerror(errno));
+        return 1;
+    }
+    if (record_path && record_open(record_path) != 0) {
+        fprintf(stderr, "Error: cannot record to %s: %s\n", record_path, strerror(errno));
+        return 1;
+    }
+    if (drill_pid && threads_open(drill_pid) != 0) {
+        fprintf(stderr, "Error: cannot read the threads of process %d: %s\n", drill_pid, strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN);      // a client that hangs up mid-response is dropped on EPIPE, not fatal
+
+    // Prepare UDP socket if enabled; a replay only logs its alerts, the server already had them
+#if SEND_ALERTS
+    if (!replay) {
+        udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (udp_sock < 0) {
+            fprintf(stderr, "Warning: could not create UDP socket: %s\n", strerror(errno));
+            // continue without network alerts
+            udp_sock = -1;
+        } else {
+            memset(&server_addr, 0, sizeof(server_addr));
+            server_addr.sin_family = AF_INET;
+            server_addr.sin_port = htons(SERVER_PORT);
+            if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
+                fprintf(stderr, "Warning: invalid SERVER_IP '%s'\n", SERVER_IP);
+                close(udp_sock);
+                udp_sock = -1;
+            }
+        }
+    }
+#endif
+
+    open_log();
+    write_log("Starting CPU monitor");
+    if (io_engine == IO_ENGINE_URING) {
+        if (uring_open() == 0) write_log("Batching per-tick /proc reads and log writes through io_uring");
+        else write_log("Warning: io_uring unavailable (%s), using pread", strerror(errno));
+    }
+    if (!replay) {
+        metrics_open();
+        shm_publish_open();
+        query_open();
+    }
+    if (replay) write_log("Replaying %s%s", replay_path, fast ? " as fast as possible" : "");
+    else if (record_path) write_log("Recording per-tick /proc reads to %s", record_path);
+    if (proc_source == PROC_SOURCE_EBPF && !replay) {
+        if (ebpf_open() == 0) write_log("Per-process CPU from eBPF sched_switch");
+        else {
+            write_log("Warning: eBPF source unavailable (%s), scanning /proc", strerror(errno));
+            proc_source = PROC_SOURCE_PROCFS;
+        }
+    }
+
+    int thread_pid_active = drill_pid != 0;
+    if (thread_pid_active) write_log("Drilling into the threads of process %d", drill_pid);
+
+    int cpu_cores = get_cpu_cores();
+
+    // ncurses init
+    initscr();
+    noecho();
+    cbreak();
+    timeout(0); // non-blocking getch
+    curs_set(FALSE);
+
+    // two snapshots of the packed counters; cur_times flips once a read succeeds
+    static unsigned long long cpu_times[2][(MAX_CPUS + 1) * CPU_TIME_FIELDS];
+    static unsigned char cpu_seen[2][MAX_CPUS];  // cpuN rows present in each snapshot
+    unsigned char online[MAX_CPUS], was_online[MAX_CPUS];
+    memset(was_online, 0, sizeof(was_online));
+    int span = 0;                  // CPUs covered by the per-core arrays so far
+    unsigned long long stat_counters[STAT_COUNTERS];
+    int cur_times = 0;
+    static struct cpu_sample cur;
+    cur.min_usage = 100.0;
+    if (!replay) journal_open(&cur); // a replay must not mix its samples into the live journal
+    int ok_times = 0, ok_sys = 0, ok_mem = 0, ok_disk = 0, ok_net = 0, ok_irq = 0;
+    int cycle = 0;
+    struct timespec replay_start;
+    clock_gettime(CLOCK_MONOTONIC, &replay_start);
+
+    while (keep_running) {
+        if (replay && !replay_next_tick()) break;
+        record_tick();
+        uring_tick();              // this tick's /proc reads and the log lines since the last one
+        unsigned long long *times = cpu_times[cur_times], *prev = cpu_times[!cur_times];
+        unsigned char *seen = cpu_seen[cur_times], *prev_seen = cpu_seen[!cur_times];
+        unsigned long long prev_idle, prev_total, idle, total;
+        get_cpu_times(times, stat_counters, seen, &cur.ncores, &ok_times);
+        cpu_row_sums(prev, &prev_idle, &prev_total);
+        cpu_row_sums(times, &idle, &total);
+        double usage = calculate_cpu_usage(prev_idle, prev_total, idle, total, ok_times);
+        // the first cycle has no previous sample, so its 0.0 is not a measurement
+        cur.valid = ok_times && prev_total != 0 && total > prev_total;
+
+        // online mask: sysfs when available, else the cpuN lines of this read
+        if (ok_times && get_online_cpus(online) < 0) memcpy(online, seen, sizeof(online));
+        if (cur.ncores > span) span = cur.ncores;
+        int hotplug = 0;
+        cur.nonline = 0;
+        for (int c = 0; c < span; ++c) {
+            if (ok_times && online[c] != was_online[c]) {
+                // skip the first snapshot ever, when every CPU "comes online"
+                if (prev_total != 0) write_log("CPU hotplug: cpu%d is now %s", c, online[c] ? "online" : "offline");
+                was_online[c] = online[c];
+                hotplug = prev_total != 0;
+            }
+            cur.nonline += was_online[c];
+        }
+        // the aggregate delta of an interval with a hotplug event mixes two CPU sets; keep it out of the statistics
+        if (hotplug) cur.valid = 0;
+        // a hot-added vCPU was not present when the topology was built
+        for (int c = 0; hotplug && c < span; ++c) {
+            if (was_online[c] && (c >= topo.ncpus || topo.cpu_core[c] < 0)) {
+                topology_init();
+                break;
+            }
+        }
+        if (cur.nonline > 0) cpu_cores = cur.nonline;
+
+        // a CPU needs a row in both snapshots to have a delta; one that just came back waits a cycle
+        for (int c = 0; c < span; ++c) {
+            cur.core_online[c] = ok_times && c < cur.ncores && was_online[c] && seen[c] && prev_seen[c];
+            if (!cur.core_online[c]) {
+                cur.core_usage[c] = 0.0;
+                continue;
+            }
+            const unsigned long long *row = times + (c + 1) * CPU_TIME_FIELDS, *prow = prev + (c + 1) * CPU_TIME_FIELDS;
+            cpu_row_sums(prow, &prev_idle, &prev_total);
+            cpu_row_sums(row, &idle, &total);
+            cur.core_usage[c] = calculate_cpu_usage(prev_idle, prev_total, idle, total, ok_times);
+        }
+
+        // update previous for next cycle (always update to current if ok)
+        if (ok_times) {
+            calculate_cpu_breakdown(prev, times, cur.ncores + 1, &cur.breakdown[0][0]);
+            for (int c = 0; c < cur.ncores; ++c) {
+                if (!cur.core_online[c]) memset(cur.breakdown[c + 1], 0, sizeof(cur.breakdown[c + 1]));
+            }
+            cur_times = !cur_times;
+            get_sched_stats(stat_counters, &cur.sched);
+        }
+        const struct sched_sample *sched = &cur.sched;
+        const float *agg = cur.breakdown[0];
+
+        if (!replay) sample_processes(); // processes, threads, interrupts, cpufreq and perf are not recorded
+        if (thread_pid_active && !sample_threads()) {
+            write_log("Warning: process %d exited, thread drill-down stopped", drill_pid);
+            thread_pid_active = 0;
+        }
+
+        // compute system info
+        get_system_info(&cur.loadavg1, &cur.loadavg5, &cur.loadavg15, &cur.uptime, &ok_sys);
+        get_mem_info(&cur.mem, &ok_mem);
+        const struct mem_sample *mem = &cur.mem;
+        double swap_rate = mem->vm_rate[VM_PSWPIN] + mem->vm_rate[VM_PSWPOUT];
+        get_disk_stats(cur.disks, &cur.ndisks, &ok_disk);
+        get_net_stats(cur.nets, &cur.nnets, &ok_net);
+        if (!replay) {
+            get_interrupts(&ok_irq);
+            get_freq_stats(&cur.freq, cur.core_usage, cur.core_online, cur.ncores);
+            get_perf_stats(&cur.perf, cur.core_online, cur.ncores);
+        }
+        topology_rollup(cur.core_usage, cur.core_online, cur.ncores, &cur.topo);
+        const struct perf_sample *perf = &cur.perf;
+        const struct topo_sample *ts = &cur.topo;
+        const struct freq_sample *freq = &cur.freq;
+
+        // on first cycle usage is 0; we keep showing it but leave it out of the statistics
+        double cpu_usage = cur.usage = usage;
+        if (cur.valid) {
+            if (cpu_usage > cur.max_usage) cur.max_usage = cpu_usage;
+            if (cpu_usage < cur.min_usage) cur.min_usage = cpu_usage;
+            stats_add(&agg_stats, cpu_usage);
+            for (int c = 0; c < cur.ncores; ++c) {
+                if (cur.core_online[c]) stats_add(&core_stats[c], cur.core_usage[c]);
+            }
+        }
+        double p50 = stats_quantile(&agg_stats, 0.50);
+        double p95 = stats_quantile(&agg_stats, 0.95);
+        double p99 = stats_quantile(&agg_stats, 0.99);
+        cur.alert = cpu_usage >= ALERT_THRESHOLD;
+        if (cur.valid && cur.alert) {
+            cur.alert_samples++;
+            if (cur.alert_since == 0.0) {
+                struct timeval tv;
+                sample_wall(&tv);
+                cur.alert_since = (double)tv.tv_sec;
+            }
+        } else if (cur.valid) {
+            cur.alert_since = 0.0;
+        }
+        cur.cycle = cycle;
+
+        // write to log every cycle (or you can throttle); the first cycle has no usage to report
+        if (cur.valid) {
+            write_log("CPU: %.2f%% | Max: %.2f | Min: %.2f | Loadavg: %.2f/%.2f/%.2f | Uptime: %.2f s"
+                      " | EWMA: %.2f | Avg%ds: %.2f+-%.2f | P50/95/99: %.2f/%.2f/%.2f"
+                      " | Usr/Nice/Sys/IOw/IRQ/SIRQ/Steal/Guest: %.2f/%.2f/%.2f/%.2f/%.2f/%.2f/%.2f/%.2f",
+                      cpu_usage, cur.max_usage, cur.min_usage, cur.loadavg1, cur.loadavg5, cur.loadavg15, cur.uptime,
+                      agg_stats.ewma, STATS_WINDOW_SECONDS, stats_mean(&agg_stats), stats_stddev(&agg_stats), p50, p95, p99,
+                      agg[CT_USER], agg[CT_NICE], agg[CT_SYSTEM], agg[CT_IOWAIT], agg[CT_IRQ], agg[CT_SOFTIRQ],
+                      agg[CT_STEAL], agg[CT_GUEST] + agg[CT_GUEST_NICE]);
+        }
+        if (freq->ncpus > 0 || freq->nzones > 0) {
+            write_log("Freq: Avg: %.0f MHz | Max: %.0f MHz | Weighted usage: %.2f%% | Temp: %.1f C | Throttle events: %llu%s",
+                      freq->avg_mhz, freq->avg_max_mhz, freq->weighted_usage, freq->max_temp_c, freq->throttle_events,
+                      freq->throttled ? " | THROTTLED" : "");
+        }
+        if (topo.nnodes > 1 || topo.nsockets > 1) {
+            char nodes[256];
+            size_t len = 0;
+            nodes[0] = '\0';
+            for (int n = 0; n < topo.nnodes && len < sizeof(nodes); ++n) {
+                len += snprintf(nodes + len, sizeof(nodes) - len, "%snode%d %.2f", n ? " " : "", topo.node_id[n], ts->node_usage[n]);
+            }
+            write_log("Topo: %s | Imbalance: %.2f | SMT saturated cores: %d of %d", nodes, ts->node_imbalance, ts->smt_busy, topo.ncores);
+        }
+        if (perf->ncpus > 0) write_log("Perf: %s", perf_summary(perf));
+        if (thread_pid_active) write_log("Threads: %s", threads_summary());
+        write_log("Sched: Running: %llu | Blocked: %llu | Ctxt: %.0f/s | Intr: %.0f/s | Forks: %.1f/s | RunQ delay: %.3f ms",
+                  sched->procs_running, sched->procs_blocked, sched->ctxt_rate, sched->intr_rate, sched->fork_rate,
+                  sched->runq_delay_ms);
+        if (ok_mem) {
+            write_log("Mem: %.2f%% | Avail: %llu MiB | Swap: %.2f%% | Dirty: %llu MiB | Scan k/d: %.0f/%.0f/s"
+                      " | Steal k/d: %.0f/%.0f/s | Swap in/out: %.0f/%.0f/s | Majflt: %.0f/s",
+                      mem->used_pct, mem->meminfo[MI_MEMAVAILABLE] / 1024, mem->swap_used_pct, mem->meminfo[MI_DIRTY] / 1024,
+                      mem->vm_rate[VM_PGSCAN_KSWAPD], mem->vm_rate[VM_PGSCAN_DIRECT],
+                      mem->vm_rate[VM_PGSTEAL_KSWAPD], mem->vm_rate[VM_PGSTEAL_DIRECT],
+                      mem->vm_rate[VM_PSWPIN], mem->vm_rate[VM_PSWPOUT], mem->vm_rate[VM_PGMAJFAULT]);
+        }
+        if (ok_disk && cur.ndisks > 0) {
+            double r = 0, w = 0, rkb = 0, wkb = 0;
+            const struct disk_rate *busiest = &cur.disks[0];
+            for (int d = 0; d < cur.ndisks; ++d) {
+                r += cur.disks[d].reads;
+                w += cur.disks[d].writes;
+                rkb += cur.disks[d].read_kb;
+                wkb += cur.disks[d].write_kb;
+                if (cur.disks[d].util > busiest->util) busiest = &cur.disks[d];
+            }
+            write_log("Disk: %d devices | IOPS r/w: %.0f/%.0f | MB/s r/w: %.2f/%.2f | Busiest: %s util %.1f%% await %.2f ms qd %.2f",
+                      cur.ndisks, r, w, rkb / 1024, wkb / 1024, busiest->name, busiest->util, busiest->await_ms, busiest->queue_depth);
+        }
+        if (ok_net && cur.nnets > 0) {
+            double rx = 0, tx = 0, rxp = 0, txp = 0, drops = 0, errs = 0;
+            for (int n = 0; n < cur.nnets; ++n) {
+                const struct net_rate *nr = &cur.nets[n];
+                rx += nr->rx_bytes;
+                tx += nr->tx_bytes;
+                rxp += nr->rx_packets;
+                txp += nr->tx_packets;
+                drops += nr->rx_drops + nr->tx_drops;
+                errs += nr->rx_errors + nr->tx_errors;
+            }
+            write_log("Net: %d interfaces | MB/s rx/tx: %.2f/%.2f | Pkts/s rx/tx: %.0f/%.0f | Drops: %.0f/s | Errors: %.0f/s",
+                      cur.nnets, rx / 1048576, tx / 1048576, rxp, txp, drops, errs);
+        }
+#if TRACK_INTERRUPTS
+        if (ok_irq) {
+            // busiest source of either kind, with the share its busiest CPU takes
+            const struct irq_matrix *bm = &irq_hw;
+            int br = -1;
+            for (int k = 0; k < 2; ++k) {
+                const struct irq_matrix *m = k ? &irq_soft : &irq_hw;
+                for (int r = 0; r < m->nrows; ++r) {
+                    if (br < 0 || m->row_rate[r] > bm->row_rate[br]) { bm = m; br = r; }
+                }
+            }
+            if (br >= 0) {
+                write_log("Irq: Hard: %.0f/s | Soft: %.0f/s | Busiest: %s %.0f/s, %.1f%% on cpu%d",
+                          irq_hw.total_rate, irq_soft.total_rate, bm->name[br], bm->row_rate[br],
+                          irq_row_share(bm, br), bm->col_cpu[bm->row_top[br]]);
+            }
+        }
+#endif
+        if (cur.valid && agg_stats.count % STATS_LOG_EVERY == 0) {
+            for (int c = 0; c < cur.ncores; ++c) {
+                if (!cur.core_online[c]) continue;
+                const struct stream_stats *st = &core_stats[c];
+                const float *b = cur.breakdown[c + 1];
+                write_log("Stats cpu%d | EWMA: %.2f | Avg%ds: %.2f+-%.2f | P50/95/99: %.2f/%.2f/%.2f"
+                          " | Usr/Sys/IOw/IRQ/SIRQ/Steal: %.2f/%.2f/%.2f/%.2f/%.2f/%.2f", c,
+                          st->ewma, STATS_WINDOW_SECONDS, stats_mean(st), stats_stddev(st),
+                          stats_quantile(st, 0.50), stats_quantile(st, 0.95), stats_quantile(st, 0.99),
+                          b[CT_USER] + b[CT_NICE], b[CT_SYSTEM], b[CT_IOWAIT], b[CT_IRQ], b[CT_SOFTIRQ], b[CT_STEAL]);
+            }
+        }
+
+        // publish for scrapers and local consumers before drawing
+        metrics_render(&cur);
+        shm_publish(&cur);
+        fleet_send(&cur);
+        if (cur.valid) {
+            history_append(&cur);
+            journal_append(&cur);
+        }
+        graph_update();
+        last_sample = &cur;
+
+        // render ncurses UI
+        clear();
+        mvprintw(0, 0, "Real-Time CPU Usage Monitor (PID %d)", getpid());
+        if (replay) printw("  REPLAY %s tick %d", timestamp_now(), cycle + 1);
+        mvprintw(1, 0, "Current CPU Usage: %.2f%%", cpu_usage);
+        mvprintw(2, 0, "Max CPU Usage Observed: %.2f%%", cur.max_usage);
+        mvprintw(3, 0, "Min CPU Usage Observed: %.2f%%", cur.min_usage);
+        mvprintw(4, 0, "EWMA: %.2f%%  Avg(%ds): %.2f%% +- %.2f  P50/P95/P99: %.2f / %.2f / %.2f",
+                 agg_stats.ewma, STATS_WINDOW_SECONDS, stats_mean(&agg_stats), stats_stddev(&agg_stats), p50, p95, p99);
+        mvprintw(5, 0, "Load Averages (1/5/15 min): %.2f / %.2f / %.2f", cur.loadavg1, cur.loadavg5, cur.loadavg15);
+        mvprintw(6, 0, "System Uptime: %.2f seconds", cur.uptime);
+        mvprintw(7, 0, "Number of CPU Cores: %d  (%d physical, %d per core, %d sockets, %d NUMA nodes)",
+                 cpu_cores, topo.ncores, topo.smt, topo.nsockets, topo.nnodes);
+        mvprintw(8, 0, "usr %.1f  nice %.1f  sys %.1f  iowait %.1f  irq %.1f  softirq %.1f  steal %.1f  guest %.1f",
+                 agg[CT_USER], agg[CT_NICE], agg[CT_SYSTEM], agg[CT_IOWAIT], agg[CT_IRQ], agg[CT_SOFTIRQ],
+                 agg[CT_STEAL], agg[CT_GUEST] + agg[CT_GUEST_NICE]);
+
+        int usage_bar_width = 40;
+        int usage_fill = (int)((cpu_usage / 100.0) * usage_bar_width);
+        if (usage_fill < 0) usage_fill = 0;
+        if (usage_fill > usage_bar_width) usage_fill = usage_bar_width;
+
+        mvprintw(9, 0, "[");
+        for (int i = 0; i < usage_fill; ++i) mvprintw(9, i + 1, "#");
+        for (int i = usage_fill; i < usage_bar_width; ++i) mvprintw(9, i + 1, "-");
+        mvprintw(9, usage_bar_width + 1, "]");
+        if (freq->ncpus > 0) printw(" %.0f/%.0f MHz  freq-weighted %.2f%%", freq->avg_mhz, freq->avg_max_mhz, freq->weighted_usage);
+        if (freq->throttled) {
+            attron(A_BOLD);
+            printw("  THROTTLED");
+            attroff(A_BOLD);
+        }
+        if (freq->nzones > 0) mvprintw(10, 0, "Temp: %.1f C max over %d thermal zones", freq->max_temp_c, freq->nzones);
+
+        // alerting logic
+        alert_reset();
+        if (cpu_usage >= ALERT_THRESHOLD) {
+            raise_alert("CPU", cpu_usage, "%", ALERT_THRESHOLD, &cur);
+            if (!replay) profile_start("CPU", online, span);
+        }
+        if (cur.valid && agg[CT_STEAL] >= STEAL_ALERT_THRESHOLD) raise_alert("STEAL", agg[CT_STEAL], "%", STEAL_ALERT_THRESHOLD, &cur);
+        if (cur.valid && agg[CT_IOWAIT] >= IOWAIT_ALERT_THRESHOLD) raise_alert("IOWAIT", agg[CT_IOWAIT], "%", IOWAIT_ALERT_THRESHOLD, &cur);
+        if (freq->throttle_events > 0) raise_alert("THROTTLE", (double)freq->throttle_events, " events", 1.0, &cur);
+        for (int z = 0; z < freq->nzones; ++z) {
+            if (freq->zone_trip_c[z] > 0.0 && freq->zone_temp_c[z] >= freq->zone_trip_c[z]) {
+                char kind[48];
+                snprintf(kind, sizeof(kind), "THERMAL:%s", freq->zone_type[z]);
+                raise_alert(kind, freq->zone_temp_c[z], "C", freq->zone_trip_c[z], &cur);
+            }
+        }
+        if (ts->node_imbalance >= NUMA_IMBALANCE_ALERT) raise_alert("NUMA", ts->node_imbalance, "%", NUMA_IMBALANCE_ALERT, &cur);
+        if (sched->ctxt_rate >= CTXT_ALERT_RATE) raise_alert("CTXT", sched->ctxt_rate, "/s", CTXT_ALERT_RATE, &cur);
+        if (sched->fork_rate >= FORK_ALERT_RATE) raise_alert("FORK", sched->fork_rate, "/s", FORK_ALERT_RATE, &cur);
+        if (sched->runq_delay_ms >= RUNQ_DELAY_ALERT_MS) raise_alert("RUNQ", sched->runq_delay_ms, "ms", RUNQ_DELAY_ALERT_MS, &cur);
+        if (ok_mem && mem->used_pct >= MEM_ALERT_THRESHOLD) raise_alert("MEM", mem->used_pct, "%", MEM_ALERT_THRESHOLD, &cur);
+        if (ok_mem && swap_rate >= SWAP_ALERT_RATE) raise_alert("SWAP", swap_rate, "/s", SWAP_ALERT_RATE, &cur);
+        if (ok_mem && mem->vm_rate[VM_PGSCAN_DIRECT] >= DIRECT_SCAN_ALERT_RATE) {
+            raise_alert("RECLAIM", mem->vm_rate[VM_PGSCAN_DIRECT], "/s", DIRECT_SCAN_ALERT_RATE, &cur);
+        }
+        for (int d = 0; ok_disk && d < cur.ndisks; ++d) {
+            char kind[48];
+            if (cur.disks[d].util >= DISK_UTIL_ALERT) {
+                snprintf(kind, sizeof(kind), "UTIL:%s", cur.disks[d].name);
+                raise_alert(kind, cur.disks[d].util, "%", DISK_UTIL_ALERT, &cur);
+            }
+            if (cur.disks[d].await_ms >= DISK_AWAIT_ALERT_MS) {
+                snprintf(kind, sizeof(kind), "AWAIT:%s", cur.disks[d].name);
+                raise_alert(kind, cur.disks[d].await_ms, "ms", DISK_AWAIT_ALERT_MS, &cur);
+            }
+        }
+        for (int n = 0; ok_net && n < cur.nnets; ++n) {
+            char kind[48];
+            const struct net_rate *nr = &cur.nets[n];
+            if (nr->rx_drops + nr->tx_drops >= NET_DROP_ALERT_RATE) {
+                snprintf(kind, sizeof(kind), "DROPS:%s", nr->name);
+                raise_alert(kind, nr->rx_drops + nr->tx_drops, "/s", NET_DROP_ALERT_RATE, &cur);
+            }
+            if (nr->rx_errors + nr->tx_errors >= NET_ERROR_ALERT_RATE) {
+                snprintf(kind, sizeof(kind), "NETERR:%s", nr->name);
+                raise_alert(kind, nr->rx_errors + nr->tx_errors, "/s", NET_ERROR_ALERT_RATE, &cur);
+            }
+        }
+#if TRACK_INTERRUPTS
+        if (ok_irq) {
+            check_irq_cpu_spread(&irq_hw, "IRQ", &cur);
+            check_irq_balance(&irq_soft, "SOFTIRQ", &cur);
+        }
+#endif
+        if (alert_text[0]) {
+            attron(A_BOLD);
+            mvprintw(11, 0, "ALERT: %s", alert_text);
+            attroff(A_BOLD);
+        } else {
+            mvprintw(11, 0, "Status: OK");
+        }
+        if (cur.alert_samples) {
+            mvprintw(12, 0, "Samples in alert: %llu", cur.alert_samples);
+            if (cur.alert_since != 0.0) {
+                time_t since = (time_t)cur.alert_since;
+                struct tm tm = *localtime(&since);
+                printw("  in alert since %02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+            }
+        }
+
+        mvprintw(13, 0, "Press 'q' to quit, 'g' to toggle the graphs. Cycle: %d", cycle++);
+
+        // sections below the header are stacked from row 15 down
+        int row = 15;
+        row = draw_history_graph(row, cur.ncores);
+        row = draw_threads(row);
+        if (perf->mode != PERF_MODE_OFF) mvprintw(row++, 0, "Perf: %s", perf_summary(perf));
+        mvprintw(row++, 0, "Sched: running %llu  blocked %llu  ctxt %.0f/s  intr %.0f/s  forks %.1f/s  runq delay %.3f ms",
+                 sched->procs_running, sched->procs_blocked, sched->ctxt_rate, sched->intr_rate, sched->fork_rate,
+                 sched->runq_delay_ms);
+        if (topo.nnodes > 1 || topo.nsockets > 1 || topo.smt > 1) {
+            move(row, 0);
+            for (int n = 0; n < topo.nnodes && topo.nnodes > 1; ++n) printw("node%d %.1f%%  ", topo.node_id[n], ts->node_usage[n]);
+            for (int k = 0; k < topo.nsockets && topo.nsockets > 1; ++k) printw("socket%d %.1f%%  ", topo.socket_id[k], ts->socket_usage[k]);
+            if (topo.nnodes > 1) printw("NUMA imbalance %.1f  ", ts->node_imbalance);
+            if (topo.smt > 1) printw("SMT saturated %d/%d cores", ts->smt_busy, topo.ncores);
+            row++;
+        }
+        mvprintw(row++, 0, "Memory: %.1f%% used  %llu MiB available of %llu MiB  dirty %llu MiB  swap %.1f%% used",
+                 mem->used_pct, mem->meminfo[MI_MEMAVAILABLE] / 1024, mem->meminfo[MI_MEMTOTAL] / 1024,
+                 mem->meminfo[MI_DIRTY] / 1024, mem->swap_used_pct);
+        mvprintw(row++, 0, "Reclaim/s: scan %.0f kswapd %.0f direct  steal %.0f kswapd %.0f direct  swap in %.0f out %.0f  majflt %.0f",
+                 mem->vm_rate[VM_PGSCAN_KSWAPD], mem->vm_rate[VM_PGSCAN_DIRECT], mem->vm_rate[VM_PGSTEAL_KSWAPD],
+                 mem->vm_rate[VM_PGSTEAL_DIRECT], mem->vm_rate[VM_PSWPIN], mem->vm_rate[VM_PSWPOUT],
+                 mem->vm_rate[VM_PGMAJFAULT]);
+        row++;
+
+        if (cur.ndisks > 0) {
+            mvprintw(row++, 0, "%-12s %9s %9s %9s %9s %9s %7s %6s", "DEVICE", "r/s", "w/s", "rMB/s", "wMB/s", "await ms", "qdepth", "util%");
+            for (int d = 0; d < cur.ndisks && d < 8 && row < LINES; ++d) {
+                const struct disk_rate *dr = &cur.disks[d];
+                mvprintw(row++, 0, "%-12s %9.1f %9.1f %9.2f %9.2f %9.2f %7.2f %6.1f", dr->name, dr->reads, dr->writes,
+                         dr->read_kb / 1024, dr->write_kb / 1024, dr->await_ms, dr->queue_depth, dr->util);
+            }
+            if (cur.ndisks > 8) mvprintw(row++, 0, "... %d more devices", cur.ndisks - 8);
+            row++;
+        }
+
+        if (cur.nnets > 0) {
+            mvprintw(row++, 0, "%-12s %9s %9s %10s %10s %9s %9s", "IFACE", "rxMB/s", "txMB/s", "rxpkt/s", "txpkt/s", "drops/s", "errs/s");
+            for (int n = 0; n < cur.nnets && n < 8 && row < LINES; ++n) {
+                const struct net_rate *nr = &cur.nets[n];
+                mvprintw(row++, 0, "%-12s %9.2f %9.2f %10.0f %10.0f %9.0f %9.0f", nr->name, nr->rx_bytes / 1048576,
+                         nr->tx_bytes / 1048576, nr->rx_packets, nr->tx_packets, nr->rx_drops + nr->tx_drops,
+                         nr->rx_errors + nr->tx_errors);
+            }
+            if (cur.nnets > 8) mvprintw(row++, 0, "... %d more interfaces", cur.nnets - 8);
+            row++;
+        }
+
+#if TRACK_INTERRUPTS
+        if (ok_irq) {
+            row = draw_irq_heatmap(&irq_hw, "IRQ x CPU", row);
+            row = draw_irq_heatmap(&irq_soft, "SOFTIRQ x CPU", row);
+            row++;
+        }
+#endif
+
+        // per-core statistics, as many cores as fit on screen
+        mvprintw(row++, 0, "%-6s %7s %7s %9s %13s %7s %7s %6s %6s %6s %6s %6s %6s %7s %6s %5s", "CORE", "NOW", "EWMA", "AVG", "STDDEV",
+                 "P95", "P99", "USR", "SYS", "IOW", "IRQ", "SIRQ", "STEAL", "RQms", "MHz", "IPC");
+        for (int c = 0; c < cur.ncores && row < LINES; ++c) {
+            if (!cur.core_online[c]) {
+                mvprintw(row++, 0, "cpu%-3d %s", c, was_online[c] ? "online, waiting for a second sample" : "offline");
+                continue;
+            }
+            const struct stream_stats *st = &core_stats[c];
+            const float *b = cur.breakdown[c + 1];
+            mvprintw(row++, 0, "cpu%-3d %6.2f%% %6.2f%% %8.2f%% %13.2f %6.2f%% %6.2f%% %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %7.3f %6.0f %5.2f",
+                     c, cur.core_usage[c], st->ewma, stats_mean(st), stats_stddev(st),
+                     stats_quantile(st, 0.95), stats_quantile(st, 0.99),
+                     b[CT_USER] + b[CT_NICE], b[CT_SYSTEM], b[CT_IOWAIT], b[CT_IRQ], b[CT_SOFTIRQ], b[CT_STEAL],
+                     sched->core_runq_delay_ms[c], freq->cur_mhz[c], perf->ipc[c]);
+        }
+        refresh();
+
+        // collect stacks for a running alert profile, writing it out once it is over
+        profile_tick();
+
+        // check user input
+        int ch = getch();
+        if (ch == 'q' || ch == 'Q') {
+            keep_running = 0;
+            break;
+        }
+        if (ch == 'g' || ch == 'G') graph_toggle();
+
+        // sleep, serving scrapes in the meantime
+        wait_for_events(replay ? replay_delay_us() : DELAY_US);
+    }
+
+    // cleanup
+    endwin();
+    if (replay) {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double secs = (end.tv_sec - replay_start.tv_sec) + (end.tv_nsec - replay_start.tv_nsec) / 1e9;
+        write_log("Replayed %d ticks in %.3f s (%.0f ticks/s)", cycle, secs, secs > 0.0 ? cycle / secs : 0.0);
+        printf("Replayed %d ticks in %.3f s (%.0f ticks/s)\n", cycle, secs, secs > 0.0 ? cycle / secs : 0.0);
+    }
+    replay_close();
+    record_close();
+    fleet_send_close();
+    if (!replay) {
+        metrics_close();
+        shm_publish_close();
+        query_close();
+    }
+    journal_close();
+    perf_close();
+    ebpf_close();
+    threads_close();
+    profile_tick();                // writes out a profile that is still running
+    profile_close();
+    write_log("Shutting down CPU monitor");
+    uring_close();
+    close_log();
+#if SEND_ALERTS
+    if (udp_sock >= 0) close(udp_sock);
+#endif
+    return 0;
+}
@@ -0,0 +1,485 @@
+// cpu_collector.c
+// Companion collector for cpu_monitor: receives UDP alerts from many monitors
+// and keeps the latest state per host.
+// Compile: gcc cpu_collector.c -o cpu_collector -lpthread
+// Run: ./cpu_collector [-p port] [-t threads] [-d]
+// Load test: ./cpu_collector -L 2000 -n 50   (2000 synthetic hosts x 50 alerts)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <linux/filter.h>
+
+#define DEFAULT_PORT 9999          // must match SERVER_PORT in cpu_monitor
+#define RECV_BATCH 64              // datagrams per recvmmsg call
+#define MSG_MAX 512                // alert messages are formatted into 512 bytes
+#define TABLE_INITIAL 1024         // initial slots per shard (power of two)
+#define RCVBUF_BYTES (4 * 1024 * 1024)
+#define LOADTEST_SENDERS 4         // sender threads in load test mode
+
+/*
+ * Latest state for one host, keyed by its IPv4 source address.
+ * 32 bytes so two entries share a cache line.
+ */
+struct host_entry {
+    uint32_t ip;                   // network byte order, 0 = empty slot
+    uint32_t alerts;
+    float cpu;
+    float load1, load5, load15;
+    double last_seen;
+};
+
+/*
+ * One receive shard: a SO_REUSEPORT socket, its thread and the hosts it owns.
+ * A reuseport filter sends each source address to a fixed socket, so a host
+ * lives in exactly one shard (even after its monitor restarts on a new source
+ * port) and a shard's table is only ever touched by its own thread.
+ */
+struct shard {
+    int id;
+    int sock;
+    pthread_t thread;
+    struct host_entry *table;
+    uint32_t mask;                 // capacity - 1
+    uint32_t count;                // written with __atomic stores, read by the reporter
+    unsigned long long packets;    // read by the reporter with __atomic loads
+    unsigned long long bad;
+    unsigned long long dropped;    // new hosts turned away because the table could not grow
+} __attribute__((aligned(64)));
+
+static volatile int keep_running = 1;
+static int listen_port = DEFAULT_PORT;
+static int nshards = 0;
+static struct shard *shards = NULL;
+
+// forward declarations
+void handle_signal(int sig);
+double now_seconds();
+int open_shard_socket(int port);
+int attach_shard_filter(int sock, int n);
+int table_init(struct shard *s, uint32_t capacity);
+struct host_entry *table_lookup(struct shard *s, uint32_t ip);
+int parse_alert(const char *msg, size_t len, float *cpu, float *l1, float *l5, float *l15);
+void *shard_main(void *arg);
+void report_totals(unsigned long long *packets, unsigned long long *bad, unsigned long long *dropped, unsigned long long *hosts);
+void dump_hosts(int limit);
+int run_load_test(int hosts, int rounds);
+
+void handle_signal(int sig) {
+    keep_running = 0;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int open_shard_socket(int port) {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) return -1;
+    int one = 1;
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+        close(s);
+        return -1;
+    }
+    int rcvbuf = RCVBUF_BYTES;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    // short timeout so workers notice keep_running going to 0
+    struct timeval tv = { 0, 200000 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// allocates an empty table; returns -1 and leaves s untouched when out of memory
+int table_init(struct shard *s, uint32_t capacity) {
+    struct host_entry *table = calloc(capacity, sizeof(struct host_entry));
+    if (!table) return -1;
+    s->table = table;
+    s->mask = capacity - 1;
+    __atomic_store_n(&s->count, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * Picks the shard from a hash of the IPv4 source address instead of the
+ * default 4-tuple hash. Attached to one socket, it applies to the group;
+ * sockets are indexed in the order they were bound.
+ */
+int attach_shard_filter(int sock, int n) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 12), // IPv4 saddr
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761u),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 8),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)n),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+static inline uint32_t hash_ip(uint32_t ip) {
+    return (uint32_t)(ip * 2654435761u);
+}
+
+/*
+ * Linear probing lookup that inserts on miss. The table doubles once it is
+ * 70% full, which is the only time the receive path allocates. If that
+ * allocation fails the old table is kept, and a host that is not in it yet
+ * is turned away with NULL.
+ */
+struct host_entry *table_lookup(struct shard *s, uint32_t ip) {
+    uint32_t count = s->count;
+    int full = (count + 1) * 10 > (s->mask + 1) * 7;
+    if (full) {
+        uint32_t old_cap = s->mask + 1, old_count = count;
+        struct host_entry *old = s->table;
+        if (table_init(s, old_cap * 2) == 0) {
+            for (uint32_t i = 0; i < old_cap; ++i) {
+                if (!old[i].ip) continue;
+                uint32_t j = hash_ip(old[i].ip) & s->mask;
+                while (s->table[j].ip) j = (j + 1) & s->mask;
+                s->table[j] = old[i];
+            }
+            free(old);
+            __atomic_store_n(&s->count, old_count, __ATOMIC_RELAXED);
+            full = 0;
+        }
+    }
+    uint32_t i = hash_ip(ip) & s->mask;
+    while (s->table[i].ip) {
+        if (s->table[i].ip == ip) return &s->table[i];
+        i = (i + 1) & s->mask;
+    }
+    if (full) return NULL;
+    s->table[i].ip = ip;
+    __atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELAXED);
+    return &s->table[i];
+}
+
+/*
+ * Parses "<date> <time> ALERT <KIND> <value><unit> load 1.00/2.00/3.00" as sent
+ * by raise_alert(). *cpu is only set for CPU alerts. Returns 1 on success.
+ */
+int parse_alert(const char *msg, size_t len, float *cpu, float *l1, float *l5, float *l15) {
+    const char *end = msg + len;
+    const char *p = memmem(msg, len, "ALERT ", 6);
+    if (!p) return 0;
+    p += 6;
+    char *q;
+    if (end - p > 4 && memcmp(p, "CPU ", 4) == 0) {
+        *cpu = strtof(p + 4, &q);
+        if (q == p + 4 || q >= end) return 0;
+        p = q;
+    }
+    p = memmem(p, end - p, "load ", 5);
+    if (!p) return 0;
+    p += 5;
+    *l1 = strtof(p, &q);
+    if (q == p || *q != '/') return 0;
+    p = q + 1;
+    *l5 = strtof(p, &q);
+    if (q == p || *q != '/') return 0;
+    p = q + 1;
+    *l15 = strtof(p, &q);
+    return q != p;
+}
+
+void *shard_main(void *arg) {
+    struct shard *s = arg;
+
+    // pin the shard to one core so its table stays in that core's cache
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(s->id % ncpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    static __thread char bufs[RECV_BATCH][MSG_MAX + 1];
+    static __thread struct sockaddr_in addrs[RECV_BATCH];
+    static __thread struct iovec iov[RECV_BATCH];
+    static __thread struct mmsghdr msgs[RECV_BATCH];
+    for (int i = 0; i < RECV_BATCH; ++i) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = MSG_MAX;
+    }
+
+    while (keep_running) {
+        for (int i = 0; i < RECV_BATCH; ++i) {
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+        int n = recvmmsg(s->sock, msgs, RECV_BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            fprintf(stderr, "Warning: shard %d recvmmsg failed: %s\n", s->id, strerror(errno));
+            break;
+        }
+        double now = now_seconds();
+        unsigned long long bad = 0, dropped = 0;
+        for (int i = 0; i < n; ++i) {
+            float cpu = -1.0f, l1, l5, l15;
+            bufs[i][msgs[i].msg_len] = '\0';
+            if (!parse_alert(bufs[i], msgs[i].msg_len, &cpu, &l1, &l5, &l15)) {
+                bad++;
+                continue;
+            }
+            struct host_entry *e = table_lookup(s, addrs[i].sin_addr.s_addr);
+            if (!e) {
+                dropped++;
+                continue;
+            }
+            if (cpu >= 0.0f) e->cpu = cpu;
+            e->load1 = l1;
+            e->load5 = l5;
+            e->load15 = l15;
+            e->alerts++;
+            e->last_seen = now;
+        }
+        __atomic_fetch_add(&s->packets, (unsigned long long)n, __ATOMIC_RELAXED);
+        if (bad) __atomic_fetch_add(&s->bad, bad, __ATOMIC_RELAXED);
+        if (dropped) __atomic_fetch_add(&s->dropped, dropped, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+void report_totals(unsigned long long *packets, unsigned long long *bad, unsigned long long *dropped, unsigned long long *hosts) {
+    *packets = *bad = *dropped = *hosts = 0;
+    for (int i = 0; i < nshards; ++i) {
+        *packets += __atomic_load_n(&shards[i].packets, __ATOMIC_RELAXED);
+        *bad += __atomic_load_n(&shards[i].bad, __ATOMIC_RELAXED);
+        *dropped += __atomic_load_n(&shards[i].dropped, __ATOMIC_RELAXED);
+        *hosts += __atomic_load_n(&shards[i].count, __ATOMIC_RELAXED);
+    }
+}
+
+static int cmp_cpu_desc(const void *a, const void *b) {
+    const struct host_entry *x = a, *y = b;
+    return (x->cpu < y->cpu) - (x->cpu > y->cpu);
+}
+
+/*
+ * Prints the hottest hosts. Only called once the shard threads have exited.
+ */
+void dump_hosts(int limit) {
+    unsigned long long total = 0;
+    for (int i = 0; i < nshards; ++i) total += shards[i].count;
+    if (total == 0) return;
+    struct host_entry *all = malloc(total * sizeof(*all));
+    if (!all) return;
+    size_t n = 0;
+    for (int i = 0; i < nshards; ++i) {
+        for (uint32_t j = 0; j <= shards[i].mask; ++j) {
+            if (shards[i].table[j].ip) all[n++] = shards[i].table[j];
+        }
+    }
+    qsort(all, n, sizeof(*all), cmp_cpu_desc);
+    double now = now_seconds();
+    printf("%-16s %8s %8s %20s %10s\n", "HOST", "CPU%", "ALERTS", "LOAD 1/5/15", "AGE(s)");
+    for (size_t i = 0; i < n && (int)i < limit; ++i) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &all[i].ip, ip, sizeof(ip));
+        char load[32];
+        snprintf(load, sizeof(load), "%.2f/%.2f/%.2f", all[i].load1, all[i].load5, all[i].load15);
+        printf("%-16s %8.2f %8u %20s %10.1f\n", ip, all[i].cpu, all[i].alerts, load, now - all[i].last_seen);
+    }
+    free(all);
+}
+
+struct sender {
+    int first_host;
+    int nhosts;
+    int rounds;
+    unsigned long long sent;
+};
+
+static void *sender_main(void *arg) {
+    struct sender *sd = arg;
+    int *socks = calloc(sd->nhosts, sizeof(int));
+    if (!socks) return NULL;
+
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(listen_port);
+    dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // every synthetic host gets its own loopback address, 127.x.y.z
+    for (int i = 0; i < sd->nhosts; ++i) {
+        uint32_t h = sd->first_host + i + 2;
+        socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (socks[i] < 0) continue;
+        struct sockaddr_in src;
+        memset(&src, 0, sizeof(src));
+        src.sin_family = AF_INET;
+        src.sin_addr.s_addr = htonl(0x7f000000u | (h & 0xffffff));
+        if (bind(socks[i], (struct sockaddr*)&src, sizeof(src)) != 0) {
+            close(socks[i]);
+            socks[i] = -1;
+        }
+    }
+
+    char msg[MSG_MAX];
+    for (int r = 0; r < sd->rounds && keep_running; ++r) {
+        for (int i = 0; i < sd->nhosts; ++i) {
+            if (socks[i] < 0) continue;
+            int len = snprintf(msg, sizeof(msg), "2024-01-01 00:00:00.000 ALERT CPU %.2f%% load %.2f/%.2f/%.2f",
+                               80.0 + (sd->first_host + i + r) % 20, r * 0.01, i * 0.01, 1.0);
+            if (sendto(socks[i], msg, len, 0, (struct sockaddr*)&dst, sizeof(dst)) == len) sd->sent++;
+        }
+    }
+    for (int i = 0; i < sd->nhosts; ++i) {
+        if (socks[i] >= 0) close(socks[i]);
+    }
+    free(socks);
+    return NULL;
+}
+
+/*
+ * Drives the running shards with a fleet of synthetic monitors on loopback
+ * and reports delivered packet rate and host table coverage.
+ */
+int run_load_test(int hosts, int rounds) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)hosts + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < (rlim_t)hosts + 64) {
+            hosts = (int)rl.rlim_cur - 64;
+            fprintf(stderr, "Warning: file limit caps load test at %d hosts\n", hosts);
+        }
+    }
+
+    struct sender senders[LOADTEST_SENDERS];
+    pthread_t threads[LOADTEST_SENDERS];
+    int per = (hosts + LOADTEST_SENDERS - 1) / LOADTEST_SENDERS;
+    double t0 = now_seconds();
+    for (int i = 0; i < LOADTEST_SENDERS; ++i) {
+        senders[i].first_host = i * per;
+        senders[i].nhosts = (i + 1) * per > hosts ? hosts - i * per : per;
+        if (senders[i].nhosts < 0) senders[i].nhosts = 0;
+        senders[i].rounds = rounds;
+        senders[i].sent = 0;
+        pthread_create(&threads[i], NULL, sender_main, &senders[i]);
+    }
+    unsigned long long sent = 0;
+    for (int i = 0; i < LOADTEST_SENDERS; ++i) {
+        pthread_join(threads[i], NULL);
+        sent += senders[i].sent;
+    }
+    double t1 = now_seconds();
+
+    // let the shards drain what is still queued on their sockets
+    unsigned long long packets, bad, dropped, seen, last = ~0ULL;
+    for (;;) {
+        usleep(300000);
+        report_totals(&packets, &bad, &dropped, &seen);
+        if (packets == last) break;
+        last = packets;
+    }
+    double t2 = now_seconds();
+
+    printf("Load test: %d hosts x %d rounds\n", hosts, rounds);
+    printf("  sent %llu in %.3f s (%.0f msg/s)\n", sent, t1 - t0, sent / (t1 - t0));
+    printf("  received %llu (%.2f%% loss), %llu malformed, %llu dropped, %.0f msg/s end-to-end\n",
+           packets, sent ? 100.0 * (double)(sent - packets) / sent : 0.0, bad, dropped, packets / (t2 - t0 - 0.3));
+    printf("  hosts tracked %llu/%d across %d shards\n", seen, hosts, nshards);
+    return seen == (unsigned long long)hosts && packets == sent && bad == 0 && dropped == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int load_hosts = 0, load_rounds = 10, dump = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:L:n:d")) != -1) {
+        switch (opt) {
+        case 'p': listen_port = atoi(optarg); break;
+        case 't': nshards = atoi(optarg); break;
+        case 'L': load_hosts = atoi(optarg); break;
+        case 'n': load_rounds = atoi(optarg); break;
+        case 'd': dump = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-t threads] [-d] [-L hosts -n rounds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    if (nshards <= 0) nshards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nshards <= 0) nshards = 1;
+    shards = calloc(nshards, sizeof(struct shard));
+    if (!shards) return 1;
+    for (int i = 0; i < nshards; ++i) {
+        shards[i].id = i;
+        shards[i].sock = open_shard_socket(listen_port);
+        if (shards[i].sock < 0) {
+            fprintf(stderr, "Error: could not bind UDP port %d: %s\n", listen_port, strerror(errno));
+            return 1;
+        }
+        if (table_init(&shards[i], TABLE_INITIAL) != 0) {
+            fprintf(stderr, "Error: out of memory for host table\n");
+            return 1;
+        }
+    }
+    if (nshards > 1 && attach_shard_filter(shards[0].sock, nshards) != 0)
+        fprintf(stderr, "Warning: could not route hosts to shards by address (%s); a restarted monitor may be counted twice\n",
+                strerror(errno));
+    for (int i = 0; i < nshards; ++i) {
+        pthread_create(&shards[i].thread, NULL, shard_main, &shards[i]);
+    }
+
+    int rc = 0;
+    if (load_hosts > 0) {
+        rc = run_load_test(load_hosts, load_rounds);
+        keep_running = 0;
+    } else {
+        printf("Collecting alerts on UDP port %d with %d shards\n", listen_port, nshards);
+        unsigned long long prev = 0;
+        while (keep_running) {
+            sleep(1);
+            unsigned long long packets, bad, dropped, hosts;
+            report_totals(&packets, &bad, &dropped, &hosts);
+            printf("hosts=%llu packets=%llu rate=%llu/s malformed=%llu dropped=%llu\n", hosts, packets, packets - prev, bad,
+                   dropped);
+            fflush(stdout);
+            prev = packets;
+        }
+    }
+
+    for (int i = 0; i < nshards; ++i) {
+        pthread_join(shards[i].thread, NULL);
+        close(shards[i].sock);
+    }
+    if (dump) dump_hosts(50);
+    for (int i = 0; i < nshards; ++i) free(shards[i].table);
+    free(shards);
+    return rc;
+}
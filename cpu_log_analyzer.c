@@ -0,0 +1,517 @@
+// cpu_log_analyzer.c
+// Offline analysis of cpu_monitor logs: hourly CPU percentiles, alert counts
+// and time spent above the alert threshold.
+// Compile: gcc -O2 cpu_log_analyzer.c -o cpu_log_analyzer -lpthread -lz
+// Run: ./cpu_log_analyzer [-t threshold] [-j threads] [file ...]
+//      (default files: cpu_monitor.log and its rotations, .gz included)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define DEFAULT_THRESHOLD 80.0     // must match ALERT_THRESHOLD in cpu_monitor
+#define CHUNK_BYTES (8 << 20)      // work unit handed to a parser thread
+#define HIST_BINS 1001             // usage histogram in 0.1% steps, exact for the percentiles we print
+#define GAP_MAX_S 5.0              // longer gaps between samples are restarts and are not counted
+#define MAX_KINDS 16               // distinct alert kinds (CPU, STEAL, IOWAIT, ...)
+#define TS_LEN 23                  // "YYYY-MM-DD HH:MM:SS.mmm"
+
+/*
+ * Samples of one hour. The hour is the log's local time, kept as hours since
+ * 1970-01-01 so it can be sorted and printed without time zone lookups.
+ */
+struct hour_stats {
+    long hour;
+    unsigned long long samples;
+    unsigned long long alerts;
+    double sum, max;
+    double above_s;                // seconds with usage >= threshold
+    uint32_t hist[HIST_BINS];
+};
+
+// growable hour table with an open-addressing index; one per thread, merged at the end
+struct hour_table {
+    struct hour_stats *rows;
+    int nrows, cap;
+    int *index;                    // row + 1, 0 = empty
+    int mask;
+};
+
+struct alert_kind {
+    char name[16];
+    unsigned long long count;
+};
+
+// one input file, mapped or decompressed into memory
+struct log_file {
+    const char *path;
+    char *data;
+    size_t size;
+    int mapped;                    // munmap rather than free
+};
+
+/*
+ * A slice of one file that starts at a line and ends after a newline. The
+ * interval of the first sample above the threshold depends on the last sample
+ * of the previous chunk, so each chunk reports its edges and the merge adds
+ * that interval afterwards.
+ */
+struct chunk {
+    int file;
+    size_t begin, end;
+    double first_ts, first_usage;  // first_ts < 0: no sample in the chunk
+    double last_ts;
+};
+
+struct worker {
+    pthread_t thread;
+    struct hour_table hours;
+    struct alert_kind kinds[MAX_KINDS];
+    int nkinds;
+    unsigned long long lines, bad;
+} __attribute__((aligned(64)));
+
+static struct log_file *files;
+static int nfiles;
+static struct chunk *chunks;
+static int nchunks;
+static int next_work;              // next file (decompression) or chunk (parsing) to hand out
+static double threshold = DEFAULT_THRESHOLD;
+
+// forward declarations
+double now_seconds();
+int load_file(struct log_file *f);
+void split_chunks();
+struct hour_stats *hour_lookup(struct hour_table *t, long hour);
+const char *parse_timestamp(const char *p, const char *end, long *hour, double *ts);
+const char *parse_float(const char *p, const char *end, double *v);
+void parse_chunk(struct worker *w, struct chunk *c);
+void *load_main(void *arg);
+void *parse_main(void *arg);
+double hist_quantile(const struct hour_stats *h, double q);
+void report(struct worker *workers, int nworkers);
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Maps a plain log read-only, or inflates a .gz rotation into memory.
+ * Returns 0 or -1 with errno set.
+ */
+int load_file(struct log_file *f) {
+    size_t len = strlen(f->path);
+    if (len > 3 && strcmp(f->path + len - 3, ".gz") == 0) {
+        gzFile gz = gzopen(f->path, "rb");
+        if (!gz) return -1;
+        gzbuffer(gz, 256 * 1024);
+        size_t cap = 16 << 20;
+        f->data = malloc(cap);
+        f->size = 0;
+        for (;;) {
+            if (cap - f->size < (1 << 20)) {
+                char *grown = f->data ? realloc(f->data, cap * 2) : NULL;
+                if (grown) {
+                    f->data = grown;
+                    cap *= 2;
+                }
+            }
+            if (!f->data || cap - f->size < (1 << 20)) {
+                gzclose(gz);
+                errno = ENOMEM;
+                return -1;
+            }
+            int n = gzread(gz, f->data + f->size, (unsigned)(cap - f->size));
+            if (n < 0) {
+                gzclose(gz);
+                errno = EIO;
+                return -1;
+            }
+            if (n == 0) break;
+            f->size += n;
+        }
+        gzclose(gz);
+        return 0;
+    }
+    int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    f->size = st.st_size;
+    if (f->size == 0) {
+        close(fd);
+        return 0;
+    }
+    f->data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (f->data == MAP_FAILED) {
+        f->data = NULL;
+        return -1;
+    }
+    madvise(f->data, f->size, MADV_SEQUENTIAL);
+    f->mapped = 1;
+    return 0;
+}
+
+// cuts every file into CHUNK_BYTES pieces, moving each cut forward to just after a newline
+void split_chunks() {
+    int cap = 0;
+    for (int i = 0; i < nfiles; ++i) cap += files[i].size / CHUNK_BYTES + 1;
+    chunks = calloc(cap, sizeof(struct chunk));
+    nchunks = 0;
+    for (int i = 0; i < nfiles; ++i) {
+        const char *data = files[i].data;
+        size_t pos = 0, size = files[i].size;
+        while (pos < size) {
+            size_t end = pos + CHUNK_BYTES;
+            if (end >= size) {
+                end = size;
+            } else {
+                const char *nl = memchr(data + end, '\n', size - end);
+                end = nl ? (size_t)(nl - data) + 1 : size;
+            }
+            struct chunk *c = &chunks[nchunks++];
+            c->file = i;
+            c->begin = pos;
+            c->end = end;
+            pos = end;
+        }
+    }
+}
+
+struct hour_stats *hour_lookup(struct hour_table *t, long hour) {
+    if (!t->index) {
+        t->mask = 255;
+        t->index = calloc(t->mask + 1, sizeof(int));
+    }
+    uint32_t slot = (uint32_t)(hour * 2654435761u) & t->mask;
+    for (;;) {
+        int r = t->index[slot];
+        if (r == 0) break;
+        if (t->rows[r - 1].hour == hour) return &t->rows[r - 1];
+        slot = (slot + 1) & t->mask;
+    }
+    if (t->nrows == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 64;
+        t->rows = realloc(t->rows, t->cap * sizeof(struct hour_stats));
+    }
+    struct hour_stats *h = &t->rows[t->nrows++];
+    memset(h, 0, sizeof(*h));
+    h->hour = hour;
+    t->index[slot] = t->nrows;
+    if (t->nrows * 2 > t->mask) {
+        // grow the index and rehash every row
+        free(t->index);
+        t->mask = t->mask * 2 + 1;
+        t->index = calloc(t->mask + 1, sizeof(int));
+        for (int r = 0; r < t->nrows; ++r) {
+            uint32_t s = (uint32_t)(t->rows[r].hour * 2654435761u) & t->mask;
+            while (t->index[s]) s = (s + 1) & t->mask;
+            t->index[s] = r + 1;
+        }
+    }
+    return h;
+}
+
+// days since 1970-01-01 of a proleptic Gregorian date (Howard Hinnant's days_from_civil)
+static long days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static inline int digits2(const char *p) { return (p[0] - '0') * 10 + (p[1] - '0'); }
+
+/*
+ * Parses the "YYYY-MM-DD HH:MM:SS.mmm" prefix that write_log() puts on every
+ * line. Returns the position after it, or NULL if the line does not start
+ * with a timestamp.
+ */
+const char *parse_timestamp(const char *p, const char *end, long *hour, double *ts) {
+    if (end - p < TS_LEN + 1 || p[4] != '-' || p[7] != '-' || p[10] != ' ' || p[13] != ':' || p[16] != ':' || p[19] != '.')
+        return NULL;
+    static const unsigned char at[] = {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18, 20, 21, 22};
+    for (size_t i = 0; i < sizeof(at); ++i) {
+        if ((unsigned)(p[at[i]] - '0') > 9) return NULL;
+    }
+    int year = digits2(p) * 100 + digits2(p + 2);
+    long days = days_from_civil(year, digits2(p + 5), digits2(p + 8));
+    *hour = days * 24 + digits2(p + 11);
+    *ts = *hour * 3600.0 + digits2(p + 14) * 60 + digits2(p + 17) + ((p[20] - '0') * 100 + digits2(p + 21)) / 1000.0;
+    return p + TS_LEN + 1;
+}
+
+/*
+ * Parses the fixed-point numbers write_log() prints ("12.34"), without
+ * strtod() and its locale handling. Returns the position after the number,
+ * or NULL if there is none.
+ */
+const char *parse_float(const char *p, const char *end, double *v) {
+    static const double scale[] = {1, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9};
+    int neg = p < end && *p == '-';
+    p += neg;
+    const char *start = p;
+    unsigned long long n = 0;
+    while (p < end && (unsigned)(*p - '0') <= 9) n = n * 10 + (*p++ - '0');
+    int frac = 0;
+    if (p < end && *p == '.') {
+        for (++p; p < end && (unsigned)(*p - '0') <= 9; ++p) {
+            if (frac < 9) {
+                n = n * 10 + (*p - '0');
+                frac++;
+            }
+        }
+    }
+    if (p == start) return NULL;
+    *v = (neg ? -(double)n : (double)n) * scale[frac];
+    return p;
+}
+
+/*
+ * Parses the lines of one chunk. Only two kinds of line matter: the per-tick
+ * "CPU: ..." sample and "ALERT triggered: <time> ALERT <kind> ...".
+ */
+void parse_chunk(struct worker *w, struct chunk *c) {
+    const char *p = files[c->file].data + c->begin, *end = files[c->file].data + c->end;
+    double prev_ts = -1.0;
+    c->first_ts = -1.0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        w->lines++;
+        long hour;
+        double ts, usage;
+        const char *q = parse_timestamp(p, eol, &hour, &ts);
+        if (!q) {
+            w->bad++;
+        } else if (eol - q > 5 && memcmp(q, "CPU: ", 5) == 0) {
+            if (!parse_float(q + 5, eol, &usage)) {
+                w->bad++;
+            } else {
+                struct hour_stats *h = hour_lookup(&w->hours, hour);
+                h->samples++;
+                h->sum += usage;
+                if (usage > h->max) h->max = usage;
+                int bin = (int)(usage * 10.0 + 0.5);
+                h->hist[bin < 0 ? 0 : bin >= HIST_BINS ? HIST_BINS - 1 : bin]++;
+                if (prev_ts < 0.0) {
+                    c->first_ts = ts;
+                    c->first_usage = usage;
+                } else if (usage >= threshold && ts > prev_ts && ts - prev_ts <= GAP_MAX_S) {
+                    h->above_s += ts - prev_ts;
+                }
+                prev_ts = ts;
+            }
+        } else if (eol - q > 17 && memcmp(q, "ALERT triggered: ", 17) == 0) {
+            hour_lookup(&w->hours, hour)->alerts++;
+            // the message repeats the timestamp, then "ALERT <kind> <value>"
+            const char *k = q + 17 + TS_LEN + 1;
+            if (k + 6 < eol && memcmp(k, "ALERT ", 6) == 0) {
+                k += 6;
+                const char *ke = memchr(k, ' ', eol - k);
+                size_t n = ke ? (size_t)(ke - k) : (size_t)(eol - k);
+                if (n >= sizeof(w->kinds[0].name)) n = sizeof(w->kinds[0].name) - 1;
+                int i = 0;
+                while (i < w->nkinds && (strncmp(w->kinds[i].name, k, n) != 0 || w->kinds[i].name[n] != '\0')) i++;
+                if (i == w->nkinds && w->nkinds < MAX_KINDS) memcpy(w->kinds[w->nkinds++].name, k, n);
+                if (i < w->nkinds) w->kinds[i].count++;
+            }
+        }
+        p = eol + 1;
+    }
+    c->last_ts = prev_ts;
+}
+
+void *load_main(void *arg) {
+    for (;;) {
+        int i = __atomic_fetch_add(&next_work, 1, __ATOMIC_RELAXED);
+        if (i >= nfiles) return NULL;
+        if (load_file(&files[i]) != 0) {
+            fprintf(stderr, "Warning: skipping %s: %s\n", files[i].path, strerror(errno));
+            free(files[i].data);
+            files[i].data = NULL;
+            files[i].size = 0;
+        }
+    }
+}
+
+void *parse_main(void *arg) {
+    struct worker *w = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&next_work, 1, __ATOMIC_RELAXED);
+        if (i >= nchunks) return NULL;
+        parse_chunk(w, &chunks[i]);
+    }
+}
+
+double hist_quantile(const struct hour_stats *h, double q) {
+    unsigned long long rank = (unsigned long long)(q * (h->samples - 1)), seen = 0;
+    for (int b = 0; b < HIST_BINS; ++b) {
+        seen += h->hist[b];
+        if (seen > rank) return b / 10.0;
+    }
+    return 100.0;
+}
+
+static int cmp_hour(const void *a, const void *b) {
+    long x = ((const struct hour_stats *)a)->hour, y = ((const struct hour_stats *)b)->hour;
+    return x < y ? -1 : x > y;
+}
+
+// merges the per-thread tables and prints one row per hour and the totals
+void report(struct worker *workers, int nworkers) {
+    struct hour_table all = {0};
+    struct alert_kind kinds[MAX_KINDS];
+    int nkinds = 0;
+    memset(kinds, 0, sizeof(kinds));
+    for (int t = 0; t < nworkers; ++t) {
+        struct worker *w = &workers[t];
+        for (int r = 0; r < w->hours.nrows; ++r) {
+            const struct hour_stats *src = &w->hours.rows[r];
+            struct hour_stats *dst = hour_lookup(&all, src->hour);
+            dst->samples += src->samples;
+            dst->alerts += src->alerts;
+            dst->sum += src->sum;
+            dst->above_s += src->above_s;
+            if (src->max > dst->max) dst->max = src->max;
+            for (int b = 0; b < HIST_BINS; ++b) dst->hist[b] += src->hist[b];
+        }
+        for (int k = 0; k < w->nkinds; ++k) {
+            int i = 0;
+            while (i < nkinds && strcmp(kinds[i].name, w->kinds[k].name) != 0) i++;
+            if (i == nkinds && nkinds < MAX_KINDS) strcpy(kinds[nkinds++].name, w->kinds[k].name);
+            if (i < nkinds) kinds[i].count += w->kinds[k].count;
+        }
+    }
+    // the interval between the last sample of a chunk and the first of the next
+    for (int i = 1; i < nchunks; ++i) {
+        const struct chunk *a = &chunks[i - 1], *b = &chunks[i];
+        if (a->file != b->file || a->last_ts < 0.0 || b->first_ts < 0.0 || b->first_usage < threshold) continue;
+        double gap = b->first_ts - a->last_ts;
+        if (gap > 0.0 && gap <= GAP_MAX_S) hour_lookup(&all, (long)(b->first_ts / 3600.0))->above_s += gap;
+    }
+
+    qsort(all.rows, all.nrows, sizeof(struct hour_stats), cmp_hour);
+    printf("%-13s %8s %7s %7s %7s %7s %7s %7s %10s\n",
+           "hour", "samples", "mean", "p50", "p95", "p99", "max", "alerts", "above(s)");
+    unsigned long long samples = 0, alerts = 0;
+    double above = 0.0;
+    for (int r = 0; r < all.nrows; ++r) {
+        const struct hour_stats *h = &all.rows[r];
+        samples += h->samples;
+        alerts += h->alerts;
+        above += h->above_s;
+        time_t t = (time_t)h->hour * 3600;
+        struct tm tm;
+        gmtime_r(&t, &tm);         // hours are already local time
+        if (h->samples == 0) {
+            printf("%04d-%02d-%02d %02d %8d %7s %7s %7s %7s %7s %7llu %10.1f\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                   tm.tm_hour, 0, "-", "-", "-", "-", "-", h->alerts, h->above_s);
+            continue;
+        }
+        printf("%04d-%02d-%02d %02d %8llu %7.2f %7.1f %7.1f %7.1f %7.2f %7llu %10.1f\n", tm.tm_year + 1900, tm.tm_mon + 1,
+               tm.tm_mday, tm.tm_hour, h->samples, h->sum / h->samples, hist_quantile(h, 0.50), hist_quantile(h, 0.95),
+               hist_quantile(h, 0.99), h->max, h->alerts, h->above_s);
+    }
+    printf("Total: %llu samples over %d hours | %llu alerts", samples, all.nrows, alerts);
+    for (int k = 0; k < nkinds; ++k) printf("%s%s %llu", k ? ", " : " (", kinds[k].name, kinds[k].count);
+    printf("%s | %.1f s at or above %.1f%%\n", nkinds ? ")" : "", above, threshold);
+    free(all.rows);
+    free(all.index);
+}
+
+int main(int argc, char **argv) {
+    int nthreads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:j:")) != -1) {
+        switch (opt) {
+        case 't': threshold = atof(optarg); break;
+        case 'j': nthreads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threshold] [-j threads] [file ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+
+    glob_t g = {0};
+    if (optind < argc) {
+        nfiles = argc - optind;
+        files = calloc(nfiles, sizeof(struct log_file));
+        for (int i = 0; i < nfiles; ++i) files[i].path = argv[optind + i];
+    } else {
+        if (glob("cpu_monitor.log", 0, NULL, &g) == GLOB_NOSPACE || glob("cpu_monitor.log.*", GLOB_APPEND, NULL, &g) == GLOB_NOSPACE) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 1;
+        }
+        nfiles = (int)g.gl_pathc;
+        files = calloc(nfiles, sizeof(struct log_file));
+        for (int i = 0; i < nfiles; ++i) files[i].path = g.gl_pathv[i];
+    }
+    if (nfiles == 0) {
+        fprintf(stderr, "Error: no cpu_monitor.log files found\n");
+        return 1;
+    }
+
+    double t0 = now_seconds();
+    int nworkers = nthreads;
+    struct worker *workers = aligned_alloc(64, nworkers * sizeof(struct worker));
+    memset(workers, 0, nworkers * sizeof(struct worker));
+
+    // map or inflate the files in parallel, then parse the chunks in parallel
+    next_work = 0;
+    for (int i = 0; i < nworkers; ++i) pthread_create(&workers[i].thread, NULL, load_main, NULL);
+    for (int i = 0; i < nworkers; ++i) pthread_join(workers[i].thread, NULL);
+    double t1 = now_seconds();
+    split_chunks();
+    next_work = 0;
+    for (int i = 0; i < nworkers; ++i) pthread_create(&workers[i].thread, NULL, parse_main, &workers[i]);
+    for (int i = 0; i < nworkers; ++i) pthread_join(workers[i].thread, NULL);
+    double t2 = now_seconds();
+
+    report(workers, nworkers);
+
+    size_t bytes = 0;
+    unsigned long long lines = 0, bad = 0;
+    for (int i = 0; i < nfiles; ++i) bytes += files[i].size;
+    for (int i = 0; i < nworkers; ++i) {
+        lines += workers[i].lines;
+        bad += workers[i].bad;
+    }
+    fprintf(stderr, "Read %d files, %.1f MB, %llu lines (%llu unparsed) with %d threads: load %.3f s, parse %.3f s (%.2f GB/s)\n",
+            nfiles, bytes / 1e6, lines, bad, nworkers, t1 - t0, t2 - t1, t2 > t1 ? bytes / (t2 - t1) / 1e9 : 0.0);
+
+    for (int i = 0; i < nfiles; ++i) {
+        if (files[i].mapped) munmap(files[i].data, files[i].size);
+        else free(files[i].data);
+    }
+    for (int i = 0; i < nworkers; ++i) {
+        free(workers[i].hours.rows);
+        free(workers[i].hours.index);
+    }
+    free(workers);
+    free(chunks);
+    free(files);
+    globfree(&g);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// cpu_shm.c
+// Reader side of the cpu_monitor shared-memory sample ring (see cpu_shm.h).
+// Link into a client: gcc my_agent.c cpu_shm.c -o my_agent
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cpu_shm.h"
+
+int cpu_shm_open(struct cpu_shm_reader *r, const char *name) {
+    r->fd = -1;
+    r->hdr = NULL;
+    int fd = shm_open(name ? name : CPU_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct cpu_shm_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(struct cpu_shm_header), PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    const struct cpu_shm_header *hdr = p;
+    if (hdr->magic != CPU_SHM_MAGIC || hdr->version != CPU_SHM_VERSION || hdr->slots != CPU_SHM_SLOTS) {
+        munmap(p, sizeof(struct cpu_shm_header));
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    r->fd = fd;
+    r->hdr = hdr;
+    return 0;
+}
+
+void cpu_shm_close(struct cpu_shm_reader *r) {
+    if (r->hdr) munmap((void *)r->hdr, sizeof(struct cpu_shm_header));
+    if (r->fd >= 0) close(r->fd);
+    r->hdr = NULL;
+    r->fd = -1;
+}
+
+uint64_t cpu_shm_head(const struct cpu_shm_reader *r) {
+    return __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+int cpu_shm_read(const struct cpu_shm_reader *r, uint64_t index, struct cpu_shm_sample *out) {
+    const struct cpu_shm_sample *slot = &r->hdr->ring[index % CPU_SHM_SLOTS];
+    for (int tries = 0; tries < CPU_SHM_READ_TRIES; ++tries) {
+        uint64_t s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            sched_yield(); // writer is in the middle of this slot
+            continue;
+        }
+        memcpy(out, slot, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t s2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+        if (s1 != s2) continue;
+        if (s1 != 0 && out->index == index) return 0;
+        errno = ENOENT;
+        return -1;
+    }
+    errno = cpu_shm_writer_alive(r) ? EAGAIN : ESRCH;
+    return -1;
+}
+
+int cpu_shm_latest(const struct cpu_shm_reader *r, struct cpu_shm_sample *out) {
+    for (int tries = 0; tries < 4; ++tries) {
+        uint64_t head = cpu_shm_head(r);
+        if (head == 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (cpu_shm_read(r, head - 1, out) == 0) return 0;
+        if (errno != ENOENT) return -1; // stuck slot; retrying the same sample would not help
+    }
+    return -1;
+}
+
+int cpu_shm_writer_alive(const struct cpu_shm_reader *r) {
+    pid_t pid = (pid_t)r->hdr->writer_pid;
+    if (pid <= 0) return 0;
+    return kill(pid, 0) == 0 || errno == EPERM; // EPERM: alive, owned by another user
+}
@@ -0,0 +1,81 @@
+// cpu_shm.h
+// Shared-memory sample ring published by cpu_monitor (PUBLISH_SHM) and the
+// client library used to read it (cpu_shm.c).
+//
+// The monitor is the only writer. Every slot carries its own sequence counter
+// (a seqlock): it is odd while the slot is being written and even once the
+// sample is complete, so readers copy a slot and retry if the counter moved.
+// Readers never write to the segment and can never stall the monitor.
+
+#ifndef CPU_SHM_H
+#define CPU_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CPU_SHM_NAME "/cpu_monitor"   // POSIX shm object, appears as /dev/shm/cpu_monitor
+#define CPU_SHM_MAGIC 0x43505553u     // "CPUS"
+#define CPU_SHM_VERSION 3
+#define CPU_SHM_SLOTS 1024            // ring capacity, power of two
+#define CPU_SHM_MAX_CPUS 256
+#define CPU_SHM_TIME_FIELDS 10        // user nice system idle iowait irq softirq steal guest guest_nice
+#define CPU_SHM_MAX_NETS 16
+#define CPU_SHM_READ_TRIES 10000      // attempts on a slot that stays mid-write before giving up
+
+// per-interface rates, all per second
+struct cpu_shm_net {
+    char name[16];
+    double rx_bytes, tx_bytes;
+    double rx_packets, tx_packets;
+    double rx_drops, tx_drops;
+    double rx_errors, tx_errors;
+};
+
+struct cpu_shm_sample {
+    uint64_t seq;                     // seqlock, odd while being written
+    uint64_t index;                   // sample number, slot = index % CPU_SHM_SLOTS
+    double timestamp;                 // wall clock seconds since the epoch
+    double usage, max_usage, min_usage;
+    double loadavg1, loadavg5, loadavg15;
+    double uptime;
+    uint32_t ncores;
+    uint32_t alert;
+    float breakdown[CPU_SHM_TIME_FIELDS]; // aggregate % of the interval per CPU state
+    float core_usage[CPU_SHM_MAX_CPUS]; // -1 for a CPU that is offline
+    uint32_t nnets;
+    uint32_t pad;
+    struct cpu_shm_net nets[CPU_SHM_MAX_NETS];
+};
+
+struct cpu_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t max_cpus;
+    uint64_t writer_pid;
+    uint64_t head;                    // samples published so far; latest is head - 1
+    char pad[32];                     // keep head on its own cache line away from the ring
+    struct cpu_shm_sample ring[CPU_SHM_SLOTS];
+};
+
+struct cpu_shm_reader {
+    int fd;
+    const struct cpu_shm_header *hdr;
+};
+
+/*
+ * Client API. Functions return 0 on success and -1 on failure with errno set.
+ * cpu_shm_read() fails with ENOENT when the sample has not been published yet
+ * or has already been overwritten by a newer one. A slot that is still being
+ * written after CPU_SHM_READ_TRIES attempts fails with EAGAIN, or with ESRCH
+ * when the writer is gone (killed in the middle of a write, the slot never
+ * completes). cpu_shm_writer_alive() tells whether the monitor still runs.
+ */
+int cpu_shm_open(struct cpu_shm_reader *r, const char *name);
+void cpu_shm_close(struct cpu_shm_reader *r);
+uint64_t cpu_shm_head(const struct cpu_shm_reader *r);
+int cpu_shm_read(const struct cpu_shm_reader *r, uint64_t index, struct cpu_shm_sample *out);
+int cpu_shm_latest(const struct cpu_shm_reader *r, struct cpu_shm_sample *out);
+int cpu_shm_writer_alive(const struct cpu_shm_reader *r);
+
+#endif
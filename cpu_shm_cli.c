@@ -0,0 +1,119 @@
+// cpu_shm_cli.c
+// Reads samples that cpu_monitor publishes to shared memory (PUBLISH_SHM).
+// Compile: gcc cpu_shm_cli.c cpu_shm.c -o cpu_shm_cli
+// Run: ./cpu_shm_cli latest      print the most recent sample
+//      ./cpu_shm_cli tail [-c]   follow new samples (-c adds per-core usage)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "cpu_shm.h"
+
+#define POLL_US 50000              // how often tail checks for new samples
+
+static volatile int keep_running = 1;
+
+void handle_signal(int sig) {
+    keep_running = 0;
+}
+
+static void print_sample(const struct cpu_shm_sample *s, int cores) {
+    time_t t = (time_t)s->timestamp;
+    struct tm tm = *localtime(&t);
+    printf("%04d-%02d-%02d %02d:%02d:%02d #%llu CPU: %.2f%% | Max: %.2f | Min: %.2f | Loadavg: %.2f/%.2f/%.2f | Uptime: %.2f s%s\n",
+           tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+           (unsigned long long)s->index, s->usage, s->max_usage, s->min_usage,
+           s->loadavg1, s->loadavg5, s->loadavg15, s->uptime, s->alert ? " | ALERT" : "");
+    printf("    usr %.1f nice %.1f sys %.1f idle %.1f iowait %.1f irq %.1f softirq %.1f steal %.1f guest %.1f\n",
+           s->breakdown[0], s->breakdown[1], s->breakdown[2], s->breakdown[3], s->breakdown[4],
+           s->breakdown[5], s->breakdown[6], s->breakdown[7], s->breakdown[8] + s->breakdown[9]);
+    for (uint32_t n = 0; n < s->nnets && n < CPU_SHM_MAX_NETS; ++n) {
+        const struct cpu_shm_net *net = &s->nets[n];
+        printf("    %-10s rx %.2f MB/s %.0f pkt/s  tx %.2f MB/s %.0f pkt/s  drops %.0f/s  errors %.0f/s\n",
+               net->name, net->rx_bytes / 1048576, net->rx_packets, net->tx_bytes / 1048576, net->tx_packets,
+               net->rx_drops + net->tx_drops, net->rx_errors + net->tx_errors);
+    }
+    if (cores) {
+        for (uint32_t c = 0; c < s->ncores && c < CPU_SHM_MAX_CPUS; ++c) {
+            if (s->core_usage[c] < 0.0f) printf("%scpu%u off", c ? "  " : "    ", c);
+            else printf("%scpu%u %.1f", c ? "  " : "    ", c, s->core_usage[c]);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    int cores = 0;
+    const char *cmd = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0) cores = 1;
+        else if (!cmd) cmd = argv[i];
+    }
+    if (!cmd || (strcmp(cmd, "latest") != 0 && strcmp(cmd, "tail") != 0)) {
+        fprintf(stderr, "Usage: %s latest|tail [-c]\n", argv[0]);
+        return 2;
+    }
+
+    struct cpu_shm_reader r;
+    if (cpu_shm_open(&r, CPU_SHM_NAME) != 0) {
+        fprintf(stderr, "Error: could not open shared memory '%s': %s (is cpu_monitor running with PUBLISH_SHM?)\n",
+                CPU_SHM_NAME, strerror(errno));
+        return 1;
+    }
+
+    struct cpu_shm_sample s;
+    if (strcmp(cmd, "latest") == 0) {
+        int rc = cpu_shm_latest(&r, &s);
+        if (rc == 0) print_sample(&s, cores);
+        else if (errno == ENOENT) fprintf(stderr, "No sample published yet\n");
+        else fprintf(stderr, "Error: could not read the latest sample: %s\n", strerror(errno));
+        if (rc != 0 && !cpu_shm_writer_alive(&r)) fprintf(stderr, "The writer (PID %llu) is no longer running\n",
+                                                           (unsigned long long)r.hdr->writer_pid);
+        cpu_shm_close(&r);
+        return rc == 0 ? 0 : 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    uint64_t next = cpu_shm_head(&r);
+    if (next > 0) next--; // start with the latest sample
+    int idle_polls = 0;
+    while (keep_running) {
+        uint64_t head = cpu_shm_head(&r);
+        // a monitor that was killed leaves the segment behind; stop instead of waiting forever
+        if (head == next && ++idle_polls * POLL_US >= 1000000) {
+            idle_polls = 0;
+            if (!cpu_shm_writer_alive(&r)) {
+                fprintf(stderr, "Error: the writer (PID %llu) is no longer running\n", (unsigned long long)r.hdr->writer_pid);
+                cpu_shm_close(&r);
+                return 1;
+            }
+        }
+        if (head > next + CPU_SHM_SLOTS) {
+            fprintf(stderr, "Warning: fell behind, skipped %llu samples\n",
+                    (unsigned long long)(head - next - CPU_SHM_SLOTS));
+            next = head - CPU_SHM_SLOTS;
+        }
+        for (; next < head; ++next) {
+            idle_polls = 0;
+            if (cpu_shm_read(&r, next, &s) == 0) {
+                print_sample(&s, cores);
+            } else if (errno != ENOENT) {
+                fprintf(stderr, "Error: sample %llu: %s\n", (unsigned long long)next,
+                        errno == ESRCH ? "left half-written by a writer that is no longer running" : strerror(errno));
+                if (errno == ESRCH) {
+                    cpu_shm_close(&r);
+                    return 1;
+                }
+            }
+        }
+        fflush(stdout);
+        usleep(POLL_US);
+    }
+    cpu_shm_close(&r);
+    return 0;
+}